@@ -12,6 +12,9 @@
 
 #define UTIL_PAGEMMAP_DEFAULT_BUFF_SIZE    (PAGE_SIZE*10)
 
+/* 2MB of entries per pread(), i.e., 1GB of address space. */
+#define UTIL_PAGEMAP_BATCH_BUFF_SIZE       (PAGE_SIZE*512)
+
 #define PME_PRESENT     (1Ull << 63)
 #define PME_SOFT_DIRTY  (1Ull << 55)
 
@@ -32,6 +35,16 @@ typedef struct util_pagemap_s {
 
 typedef int (*util_pagemap_walk_cb)(u64_t *entry, void *addr, void *cb_args);
 
+/* Called for a run of num_pages consecutive matching pages starting at addr. */
+typedef int (*util_pagemap_run_cb)(u64_t *entries, void *addr,
+    size_t num_pages, void *cb_args);
+
+#define UTIL_PAGEMAP_VEC_LEN 4
+typedef u64_t util_pagemap_vec_t
+    __attribute__((vector_size(UTIL_PAGEMAP_VEC_LEN*sizeof(u64_t))));
+typedef long long util_pagemap_vmask_t
+    __attribute__((vector_size(UTIL_PAGEMAP_VEC_LEN*sizeof(u64_t))));
+
 static inline int util_pagemap_init(pid_t pid, util_pagemap_t *pm,
     void *map_buff, size_t map_buff_len)
 {
@@ -147,5 +160,103 @@ static inline int util_pagemap_proc_walk(util_pagemap_t *pm,
     return 0;
 }
 
+/*
+ * Index of the first entry in [i, n) that matches flags (match=1) or does
+ * not match flags (match=0). Whole vectors of entries are skipped with a
+ * single compare.
+ */
+static inline size_t util_pagemap_scan(u64_t *map, size_t i, size_t n,
+    u64_t flags, int match)
+{
+    util_pagemap_vec_t v, vflags = { flags, flags, flags, flags };
+    util_pagemap_vec_t zero = { 0, 0, 0, 0 };
+    util_pagemap_vmask_t m;
+
+    for (;i+UTIL_PAGEMAP_VEC_LEN<=n;i+=UTIL_PAGEMAP_VEC_LEN) {
+        memcpy(&v, &map[i], sizeof(v));
+        v &= vflags;
+        if (match) {
+            if (v[0] | v[1] | v[2] | v[3]) {
+                break;
+            }
+        }
+        else {
+            m = (v == zero);
+            if (m[0] | m[1] | m[2] | m[3]) {
+                break;
+            }
+        }
+    }
+    for (;i<n;i++) {
+        if (!!(map[i] & flags) == match) {
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * Batched walk: reads up to pm->buff_len bytes of entries per pread() and
+ * calls cb once per run of consecutive pages matching flags (any page if
+ * flags is 0). Runs are split at buffer boundaries.
+ */
+static inline int util_pagemap_walk_runs(util_pagemap_t *pm, void *addr,
+    size_t len, u64_t flags, util_pagemap_run_cb cb, void *cb_args)
+{
+    size_t i, end, size, num_entries;
+    int ret = 0;
+
+    assert(len % PAGE_SIZE == 0);
+    while (len > 0) {
+        size = MIN((pm->buff_len/sizeof(u64_t))*PAGE_SIZE, len);
+        ret = util_pagemap_get(pm, addr, size);
+        if (ret < 0) {
+            return ret;
+        }
+        num_entries = size/PAGE_SIZE;
+        i = 0;
+        while (i < num_entries) {
+            if (flags) {
+                i = util_pagemap_scan(pm->map, i, num_entries, flags, 1);
+                end = util_pagemap_scan(pm->map, i, num_entries, flags, 0);
+            }
+            else {
+                end = num_entries;
+            }
+            if (i == end) {
+                break;
+            }
+            ret = cb(&pm->map[i], (char*)addr + i*PAGE_SIZE, end-i, cb_args);
+            if (ret < 0) {
+                return ret;
+            }
+            i = end;
+        }
+        addr = (char*)addr + size;
+        len -= size;
+    }
+
+    return ret;
+}
+
+static inline int util_pagemap_proc_walk_runs(util_pagemap_t *pm,
+    util_proc_maps_t *maps, u64_t flags, util_pagemap_run_cb cb, void *cb_args)
+{
+    int i;
+    int ret;
+
+    for (i=0;i<maps->num_entries;i++) {
+        unsigned long start = maps->entries[i].vm_start;
+        unsigned long end = maps->entries[i].vm_end;
+        ret = util_pagemap_walk_runs(pm, (void*) start, end-start,
+            flags, cb, cb_args);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
 #endif /* _UTIL_PAGEMAP_H */
 
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -685,5 +686,513 @@ static inline int util_proc_maps_diff(util_proc_maps_t *maps,
     return hasdiff;
 }
 
+
+/*
+ * Sorted-snapshot helpers. Entries of a parsed snapshot are sorted by
+ * address and do not overlap, so lookups can use binary search.
+ */
+static inline int util_proc_maps_search(util_proc_maps_t *maps,
+    unsigned long addr)
+{
+    int lo = 0, hi = maps->num_entries, mid;
+
+    /* Index of the first entry ending above addr. */
+    while (lo < hi) {
+        mid = lo + (hi-lo)/2;
+        if (maps->entries[mid].vm_end <= addr) {
+            lo = mid+1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static inline util_proc_maps_entry_t* util_proc_maps_search_by_addr(
+    util_proc_maps_t *maps, unsigned long addr)
+{
+    int i = util_proc_maps_search(maps, addr);
+
+    if (i < maps->num_entries
+        && UTIL_PROC_MAPS_ENTRY_CONTAINS_ADDR(&maps->entries[i], addr)) {
+        return &maps->entries[i];
+    }
+    return NULL;
+}
+
+/*
+ * Layout-only diff of two sorted snapshots in a single linear pass. Overlapping
+ * entries are compared with util_proc_maps_entry_diff() (data is never
+ * compared), entries with no counterpart are reported with a NULL peer.
+ * Return value as in util_proc_maps_diff().
+ */
+static inline int util_proc_maps_layout_diff(util_proc_maps_t *maps,
+    util_proc_maps_t *maps2, int flags, util_proc_maps_diff_cb_t cb,
+    void *cb_args)
+{
+    int i = 0, j = 0, ret, hasdiff = 0;
+    int matched = 0, matched2 = 0;
+    util_proc_maps_entry_t *e, *e2;
+
+    flags |= DIFF_FLAG(ALLOW_DATA_DIFF);
+    while (i < maps->num_entries || j < maps2->num_entries) {
+        e = i < maps->num_entries ? &maps->entries[i] : NULL;
+        e2 = j < maps2->num_entries ? &maps2->entries[j] : NULL;
+        if (e && e2 && UTIL_PROC_MAPS_ENTRY_OVERLAPS(e, e2)) {
+            ret = util_proc_maps_entry_diff(e, e2, 0, 0, flags);
+            matched = matched2 = 1;
+            if (e->vm_end <= e2->vm_end) {
+                i++;
+                matched = 0;
+            }
+            if (e2->vm_end <= e->vm_end) {
+                j++;
+                matched2 = 0;
+            }
+        }
+        else if (e && (!e2 || e->vm_end <= e2->vm_start)) {
+            ret = matched ? 0 : util_proc_maps_entry_diff(e, NULL, 0, 0, flags);
+            e2 = NULL;
+            i++;
+            matched = 0;
+        }
+        else {
+            ret = matched2 ? 0 : util_proc_maps_entry_diff(NULL, e2, 0, 0, flags);
+            e = NULL;
+            j++;
+            matched2 = 0;
+        }
+        if (!cb) {
+            if (ret)
+                return ret;
+        } else {
+            ret = cb(e, e2, ret, cb_args);
+            if (ret < 0)
+                return ret;
+            if (ret > 0)
+                hasdiff = 1;
+        }
+    }
+
+    return hasdiff;
+}
+
+/*
+ * Incremental VMA tracker. The address space is parsed once and the sorted
+ * snapshot is then kept current from the mmap()/munmap()/mprotect()/brk()
+ * calls the caller reports, so lookups and filters do not need to reparse
+ * /proc. Changes the tracker cannot model (e.g., mremap()) mark it stale and
+ * the next util_proc_maps_tracker_get() reparses. Mappings created behind
+ * the caller's back (e.g., by libc internals) are only picked up by
+ * util_proc_maps_tracker_sync(), which reports the differences. The heap
+ * end is refreshed from the program break on every
+ * util_proc_maps_tracker_get().
+ * The entries can be kept in caller-owned storage instead of the heap (see
+ * util_proc_maps_tracker_adopt()), in which case the tracker never
+ * allocates and the caller is responsible for refreshing it when stale.
+ * The tracker is not thread-safe.
+ */
+typedef struct util_proc_maps_tracker_s {
+    util_proc_maps_t maps;
+    int capacity;
+    int external;
+    int stale;
+    unsigned long brk;
+    unsigned long num_updates;
+    unsigned long num_parses;
+} util_proc_maps_tracker_t;
+
+#define UTIL_PROC_MAPS_PAGE_ALIGN(A) \
+    ((((unsigned long)(A)) + PAGE_SIZE-1) & ~((unsigned long)PAGE_SIZE-1))
+
+#define UTIL_PROC_MAPS_TRACKER_ACTIVE(T) ((T)->maps.entries != NULL)
+
+/* Raw program break, bypassing (possibly wrapped) sbrk(). */
+#define UTIL_PROC_MAPS_CURBRK() ((unsigned long) syscall(SYS_brk, 0))
+
+static inline int util_proc_maps_tracker_init(util_proc_maps_tracker_t *t)
+{
+    int ret, i;
+
+    memset(t, 0, sizeof(util_proc_maps_tracker_t));
+    ret = util_proc_maps_parse(getpid(), &t->maps);
+    if (ret) {
+        memset(t, 0, sizeof(util_proc_maps_tracker_t));
+        return ret;
+    }
+    for (i=0;i<t->maps.num_entries;i++) {
+        t->maps.entries[i].owner = &t->maps;
+    }
+    t->capacity = t->maps.num_entries;
+    t->brk = UTIL_PROC_MAPS_PAGE_ALIGN(UTIL_PROC_MAPS_CURBRK());
+    t->num_parses = 1;
+    return 0;
+}
+
+static inline void util_proc_maps_tracker_destroy(util_proc_maps_tracker_t *t)
+{
+    if (!t->external) {
+        util_proc_maps_destroy(&t->maps);
+    }
+    memset(t, 0, sizeof(util_proc_maps_tracker_t));
+}
+
+/*
+ * Replace the tracked entries with those of maps (which may be t->maps
+ * itself), copied into the caller-owned storage for capacity entries.
+ * From then on updates that do not fit mark the tracker stale, and
+ * util_proc_maps_tracker_get() returns NULL until the caller adopts a
+ * fresh snapshot again. Returns -ENOMEM if maps does not fit.
+ */
+static inline int util_proc_maps_tracker_adopt(util_proc_maps_tracker_t *t,
+    util_proc_maps_t *maps, util_proc_maps_entry_t *entries, int capacity)
+{
+    util_proc_maps_entry_t *old = t->maps.entries;
+    int i;
+
+    if (maps->num_entries > capacity) {
+        return -ENOMEM;
+    }
+    if (entries != maps->entries) {
+        memcpy(entries, maps->entries,
+            sizeof(util_proc_maps_entry_t)*maps->num_entries);
+    }
+    t->maps.pid = maps->pid;
+    t->maps.num_entries = maps->num_entries;
+    t->maps.entries = entries;
+    for (i=0;i<t->maps.num_entries;i++) {
+        t->maps.entries[i].owner = &t->maps;
+        t->maps.entries[i].buff = NULL;
+    }
+    if (!t->external && old && old != entries) {
+        free(old);
+    }
+    if (maps != &t->maps) {
+        t->brk = UTIL_PROC_MAPS_PAGE_ALIGN(UTIL_PROC_MAPS_CURBRK());
+        t->stale = 0;
+        t->num_parses++;
+    }
+    t->capacity = capacity;
+    t->external = 1;
+    return 0;
+}
+
+static inline void util_proc_maps_tracker_invalidate(
+    util_proc_maps_tracker_t *t)
+{
+    t->stale = 1;
+}
+
+static inline int __util_proc_maps_tracker_insert(util_proc_maps_tracker_t *t,
+    int i, util_proc_maps_entry_t *entry)
+{
+    util_proc_maps_entry_t *entries;
+
+    if (t->maps.num_entries == t->capacity) {
+        if (t->external) {
+            t->stale = 1;
+            return -ENOMEM;
+        }
+        entries = realloc(t->maps.entries,
+            sizeof(util_proc_maps_entry_t)*(t->capacity+1)*2);
+        if (!entries) {
+            t->stale = 1;
+            return -ENOMEM;
+        }
+        t->maps.entries = entries;
+        t->capacity = (t->capacity+1)*2;
+    }
+    if (i < t->maps.num_entries) {
+        memmove(&t->maps.entries[i+1], &t->maps.entries[i],
+            sizeof(util_proc_maps_entry_t)*(t->maps.num_entries-i));
+    }
+    t->maps.entries[i] = *entry;
+    t->maps.entries[i].owner = &t->maps;
+    t->maps.entries[i].buff = NULL;
+    t->maps.num_entries++;
+    return 0;
+}
+
+/* Split the entry containing addr (if any) so that an entry starts at addr. */
+static inline int __util_proc_maps_tracker_split(util_proc_maps_tracker_t *t,
+    unsigned long addr)
+{
+    int i = util_proc_maps_search(&t->maps, addr);
+    util_proc_maps_entry_t entry;
+
+    if (i == t->maps.num_entries || t->maps.entries[i].vm_start >= addr) {
+        return 0;
+    }
+    entry = t->maps.entries[i];
+    entry.pgoff += addr - entry.vm_start;
+    entry.vm_start = addr;
+    t->maps.entries[i].vm_end = addr;
+    return __util_proc_maps_tracker_insert(t, i+1, &entry);
+}
+
+/* Merge entry i with the next one, as the kernel does for anonymous VMAs. */
+static inline void __util_proc_maps_tracker_merge(util_proc_maps_tracker_t *t,
+    int i)
+{
+    util_proc_maps_entry_t *e, *next;
+
+    if (i < 0 || i+1 >= t->maps.num_entries) {
+        return;
+    }
+    e = &t->maps.entries[i];
+    next = e+1;
+    if (e->vm_end != next->vm_start || e->ino || next->ino
+        || !UTIL_PROC_MAPS_ENTRY_PROT_EQUALS(e, next)
+        || !UTIL_PROC_MAPS_ENTRY_SHARED_EQUALS(e, next)
+        || UTIL_PROC_MAPS_ENTRY_IS_SHARED(e)
+        || !UTIL_PROC_MAPS_ENTRY_NAME_EQUALS(e, next)
+        || !(UTIL_PROC_MAPS_ENTRY_IS_ANON(e)
+        || UTIL_PROC_MAPS_ENTRY_NAME_EQUALS_STR(e, __HEAP))) {
+        return;
+    }
+    e->vm_end = next->vm_end;
+    util_proc_maps_entry_remove(&t->maps, next);
+}
+
+static inline int util_proc_maps_tracker_unmap(util_proc_maps_tracker_t *t,
+    unsigned long start, unsigned long end)
+{
+    int i, j;
+
+    if (!UTIL_PROC_MAPS_TRACKER_ACTIVE(t) || start >= end) {
+        return 0;
+    }
+    end = UTIL_PROC_MAPS_PAGE_ALIGN(end);
+    if (__util_proc_maps_tracker_split(t, start)
+        || __util_proc_maps_tracker_split(t, end)) {
+        return -ENOMEM;
+    }
+    i = util_proc_maps_search(&t->maps, start);
+    for (j=i;j<t->maps.num_entries && t->maps.entries[j].vm_end <= end;j++);
+    if (j > i) {
+        memmove(&t->maps.entries[i], &t->maps.entries[j],
+            sizeof(util_proc_maps_entry_t)*(t->maps.num_entries-j));
+        t->maps.num_entries -= j-i;
+    }
+    t->num_updates++;
+    return 0;
+}
+
+/* major, minor and ino identify the mapped file, 0 for anonymous memory. */
+static inline int util_proc_maps_tracker_map(util_proc_maps_tracker_t *t,
+    unsigned long start, unsigned long end, int prot, int shared,
+    unsigned long long pgoff, int major, int minor, unsigned long ino,
+    const char *name)
+{
+    util_proc_maps_entry_t entry;
+    int i, ret;
+
+    if (!UTIL_PROC_MAPS_TRACKER_ACTIVE(t) || start >= end) {
+        return 0;
+    }
+    end = UTIL_PROC_MAPS_PAGE_ALIGN(end);
+    ret = util_proc_maps_tracker_unmap(t, start, end);
+    if (ret) {
+        return ret;
+    }
+    memset(&entry, 0, sizeof(entry));
+    entry.vm_start = start;
+    entry.vm_end = end;
+    entry.r = prot & PROT_READ ? 'r' : '-';
+    entry.w = prot & PROT_WRITE ? 'w' : '-';
+    entry.x = prot & PROT_EXEC ? 'x' : '-';
+    UTIL_PROC_MAPS_ENTRY_SET_SHARED(&entry, shared);
+    entry.pgoff = pgoff;
+    entry.major = major;
+    entry.minor = minor;
+    entry.ino = ino;
+    snprintf(entry.name, sizeof(entry.name), "%s", name ? name : __ANON);
+    i = util_proc_maps_search(&t->maps, start);
+    ret = __util_proc_maps_tracker_insert(t, i, &entry);
+    if (ret) {
+        return ret;
+    }
+    __util_proc_maps_tracker_merge(t, i);
+    __util_proc_maps_tracker_merge(t, i-1);
+    return 0;
+}
+
+static inline int util_proc_maps_tracker_protect(util_proc_maps_tracker_t *t,
+    unsigned long start, unsigned long end, int prot)
+{
+    int i, first;
+    util_proc_maps_entry_t *e;
+
+    if (!UTIL_PROC_MAPS_TRACKER_ACTIVE(t) || start >= end) {
+        return 0;
+    }
+    end = UTIL_PROC_MAPS_PAGE_ALIGN(end);
+    if (__util_proc_maps_tracker_split(t, start)
+        || __util_proc_maps_tracker_split(t, end)) {
+        return -ENOMEM;
+    }
+    first = i = util_proc_maps_search(&t->maps, start);
+    for (;i<t->maps.num_entries && t->maps.entries[i].vm_start < end;i++) {
+        e = &t->maps.entries[i];
+        e->r = prot & PROT_READ ? 'r' : '-';
+        e->w = prot & PROT_WRITE ? 'w' : '-';
+        e->x = prot & PROT_EXEC ? 'x' : '-';
+    }
+    for (i=i-1;i>=first-1;i--) {
+        __util_proc_maps_tracker_merge(t, i);
+    }
+    t->num_updates++;
+    return 0;
+}
+
+/* Report a new program break. */
+static inline int util_proc_maps_tracker_brk(util_proc_maps_tracker_t *t,
+    unsigned long brk)
+{
+    util_proc_maps_entry_t *heap;
+
+    if (!UTIL_PROC_MAPS_TRACKER_ACTIVE(t)) {
+        return 0;
+    }
+    brk = UTIL_PROC_MAPS_PAGE_ALIGN(brk);
+    if (brk == t->brk) {
+        return 0;
+    }
+    if (brk < t->brk) {
+        util_proc_maps_tracker_unmap(t, brk, t->brk);
+        t->brk = brk;
+        return 0;
+    }
+    heap = t->brk ? util_proc_maps_search_by_addr(&t->maps, t->brk-1) : NULL;
+    if (heap && heap->vm_end == t->brk
+        && UTIL_PROC_MAPS_ENTRY_NAME_EQUALS_STR(heap, __HEAP)
+        && (heap+1 == &t->maps.entries[t->maps.num_entries]
+        || (heap+1)->vm_start >= brk)) {
+        heap->vm_end = brk;
+        t->brk = brk;
+        t->num_updates++;
+        return 0;
+    }
+    util_proc_maps_tracker_map(t, t->brk, brk, PROT_READ|PROT_WRITE, 0, 0,
+        0, 0, 0, __HEAP);
+    t->brk = brk;
+    return 0;
+}
+
+static inline util_proc_maps_t* util_proc_maps_tracker_get(
+    util_proc_maps_tracker_t *t)
+{
+    unsigned long num_parses = t->num_parses;
+
+    if (t->stale && t->external) {
+        return NULL;
+    }
+    if (t->stale) {
+        util_proc_maps_tracker_destroy(t);
+        if (util_proc_maps_tracker_init(t)) {
+            return NULL;
+        }
+        t->num_parses = num_parses+1;
+    }
+    if (!UTIL_PROC_MAPS_TRACKER_ACTIVE(t)) {
+        return NULL;
+    }
+    util_proc_maps_tracker_brk(t, UTIL_PROC_MAPS_CURBRK());
+    return &t->maps;
+}
+
+/*
+ * Copy the entries accepted by cb (as in util_proc_maps_parse_filter()) into
+ * a new snapshot, to be released with util_proc_maps_destroy(). If
+ * maps->entries is not NULL, it has room for capacity entries and is used
+ * instead of allocating, or -ENOSPC is returned if that is not enough.
+ */
+static inline int util_proc_maps_tracker_filter(util_proc_maps_tracker_t *t,
+    util_proc_maps_t *maps, int capacity, util_proc_maps_parse_cb_t cb,
+    void *cb_args)
+{
+    util_proc_maps_t *tmaps = util_proc_maps_tracker_get(t);
+    util_proc_maps_entry_t entry, *entries = maps->entries;
+    int i, ret, stop = 0;
+
+    if (!tmaps) {
+        return -ENOENT;
+    }
+    if (entries && capacity < tmaps->num_entries) {
+        return -ENOSPC;
+    }
+    memset(maps, 0, sizeof(util_proc_maps_t));
+    maps->pid = tmaps->pid;
+    maps->entries = entries ? entries
+        : malloc(sizeof(util_proc_maps_entry_t)*(tmaps->num_entries+1));
+    if (!maps->entries) {
+        return -ENOMEM;
+    }
+    for (i=0;!stop && i<tmaps->num_entries;i++) {
+        entry = tmaps->entries[i];
+        entry.owner = maps;
+        if (cb) {
+            ret = cb(&entry, cb_args);
+            switch (ret) {
+            case UTIL_PROC_MAPS_RET_SAVE:
+                break;
+            case UTIL_PROC_MAPS_RET_SAVE_AND_STOP:
+                stop = 1;
+                break;
+            case UTIL_PROC_MAPS_RET_CONTINUE:
+                continue;
+            case UTIL_PROC_MAPS_RET_STOP:
+                return 0;
+            default:
+                util_proc_maps_destroy(maps);
+                return -ENOENT;
+            }
+        }
+        maps->entries[maps->num_entries++] = entry;
+    }
+
+    return 0;
+}
+
+/*
+ * Reparse /proc, diff the new snapshot against the tracked one (see
+ * util_proc_maps_layout_diff()) and adopt it.
+ */
+static inline int util_proc_maps_tracker_sync(util_proc_maps_tracker_t *t,
+    int flags, util_proc_maps_diff_cb_t cb, void *cb_args)
+{
+    util_proc_maps_tracker_t t2;
+    util_proc_maps_t *maps;
+    int i, ret;
+
+    maps = util_proc_maps_tracker_get(t);
+    if (!maps) {
+        return -ENOENT;
+    }
+    ret = util_proc_maps_tracker_init(&t2);
+    if (ret) {
+        return ret;
+    }
+    ret = util_proc_maps_layout_diff(maps, &t2.maps, flags, cb, cb_args);
+    t2.num_parses = t->num_parses+1;
+    t2.num_updates = t->num_updates;
+    if (t->external) {
+        if (util_proc_maps_tracker_adopt(t, &t2.maps, t->maps.entries,
+            t->capacity)) {
+            t->stale = 1;
+        }
+        t->num_parses = t2.num_parses;
+        util_proc_maps_tracker_destroy(&t2);
+        return ret;
+    }
+    util_proc_maps_tracker_destroy(t);
+    *t = t2;
+    for (i=0;i<t->maps.num_entries;i++) {
+        t->maps.entries[i].owner = &t->maps;
+    }
+    return ret;
+}
+
 #endif /* _UTIL_PROC_MAPS_H */
 
@@ -0,0 +1,164 @@
+#ifndef _UTIL_SHMSTATS_H
+#define _UTIL_SHMSTATS_H
+
+#include "util_def.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "shmem.h"
+
+/*
+ * Live statistics exported through a named shared-memory segment
+ * (/dev/shm/<prefix>.<pid>). The process updates the payload between
+ * util_shmstats_write_begin() and util_shmstats_write_end(); external
+ * monitors take consistent snapshots with util_shmstats_read() without
+ * stopping or signalling the process (seqlock protocol: odd sequence
+ * numbers mean an update is in progress).
+ */
+#define UTIL_SHMSTATS_MAGIC     0x74536853
+#define UTIL_SHMSTATS_VERSION   1
+
+typedef struct util_shmstats_hdr_s {
+    unsigned int magic;
+    unsigned int version;
+    volatile unsigned long seq;
+    unsigned long payload_size;
+    unsigned long payload_version;
+    int pid;
+} __attribute__((aligned(64))) util_shmstats_hdr_t;
+
+#define UTIL_SHMSTATS_PAYLOAD(H) ((void*)(((util_shmstats_hdr_t*)(H))+1))
+
+#define _UTIL_SHMSTATS_BARRIER() __sync_synchronize()
+
+static inline void util_shmstats_name(char *name, const char *prefix, int pid)
+{
+    snprintf(name, NAME_MAX, "/%s.%d", prefix, pid);
+}
+
+static inline util_shmstats_hdr_t* util_shmstats_create(util_shmem_seg_t *seg,
+    const char *prefix, size_t payload_size, unsigned long payload_version)
+{
+    util_shmstats_hdr_t *hdr;
+    int ret;
+
+    util_shmstats_name(seg->name, prefix, getpid());
+    seg->size = sizeof(util_shmstats_hdr_t) + payload_size;
+    seg->addr = NULL;
+    ret = util_shmem_open_new(seg);
+    if (ret) {
+        return NULL;
+    }
+    ret = util_shmem_open_attach(seg, 0);
+    close(seg->id);
+    if (ret) {
+        util_shmem_open_del(seg);
+        return NULL;
+    }
+    hdr = (util_shmstats_hdr_t*) seg->addr;
+    memset(hdr, 0, seg->size);
+    hdr->version = UTIL_SHMSTATS_VERSION;
+    hdr->payload_size = payload_size;
+    hdr->payload_version = payload_version;
+    hdr->pid = getpid();
+    _UTIL_SHMSTATS_BARRIER();
+    hdr->magic = UTIL_SHMSTATS_MAGIC;
+
+    return hdr;
+}
+
+static inline void util_shmstats_destroy(util_shmem_seg_t *seg)
+{
+    util_shmem_open_detach(seg);
+    util_shmem_open_del(seg);
+}
+
+/* Attach to the segment of another process (monitor side). */
+static inline util_shmstats_hdr_t* util_shmstats_open(util_shmem_seg_t *seg,
+    const char *prefix, int pid)
+{
+    util_shmstats_hdr_t *hdr;
+    struct stat st;
+    int ret;
+
+    util_shmstats_name(seg->name, prefix, pid);
+    seg->id = shm_open(seg->name, O_RDWR, 0);
+    if (seg->id == -1) {
+        return NULL;
+    }
+    if (fstat(seg->id, &st) == -1 || st.st_size < sizeof(util_shmstats_hdr_t)) {
+        close(seg->id);
+        errno = EINVAL;
+        return NULL;
+    }
+    seg->size = st.st_size;
+    ret = util_shmem_open_attach(seg, 0);
+    close(seg->id);
+    if (ret) {
+        return NULL;
+    }
+    hdr = (util_shmstats_hdr_t*) seg->addr;
+    if (hdr->magic != UTIL_SHMSTATS_MAGIC || hdr->version != UTIL_SHMSTATS_VERSION
+        || sizeof(util_shmstats_hdr_t) + hdr->payload_size > seg->size) {
+        util_shmem_open_detach(seg);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return hdr;
+}
+
+static inline void util_shmstats_close(util_shmem_seg_t *seg)
+{
+    util_shmem_open_detach(seg);
+}
+
+static inline void util_shmstats_write_begin(util_shmstats_hdr_t *hdr)
+{
+    hdr->seq++;
+    _UTIL_SHMSTATS_BARRIER();
+}
+
+static inline void util_shmstats_write_end(util_shmstats_hdr_t *hdr)
+{
+    _UTIL_SHMSTATS_BARRIER();
+    hdr->seq++;
+}
+
+/*
+ * Copy a consistent snapshot of the payload into buff. Returns -1 (EAGAIN)
+ * if no consistent snapshot could be taken within max_retries attempts
+ * (0 means retry forever).
+ */
+static inline int util_shmstats_read(util_shmstats_hdr_t *hdr,
+    void *buff, size_t size, unsigned max_retries)
+{
+    unsigned long seq1, seq2;
+    unsigned retries = 0;
+
+    if (size > hdr->payload_size) {
+        size = hdr->payload_size;
+    }
+    do {
+        seq1 = hdr->seq;
+        _UTIL_SHMSTATS_BARRIER();
+        if (seq1 & 1) {
+            continue;
+        }
+        memcpy(buff, UTIL_SHMSTATS_PAYLOAD(hdr), size);
+        _UTIL_SHMSTATS_BARRIER();
+        seq2 = hdr->seq;
+        if (seq1 == seq2) {
+            return 0;
+        }
+    } while (!max_retries || ++retries < max_retries);
+
+    errno = EAGAIN;
+    return -1;
+}
+
+#endif /* _UTIL_SHMSTATS_H */
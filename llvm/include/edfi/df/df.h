@@ -18,6 +18,9 @@ extern edfi_onstart_t edfi_onstart_p;
 extern edfi_onfdp_t edfi_onfdp_p;
 extern edfi_onfault_t edfi_onfault_p;
 extern edfi_onstop_t edfi_onstop_p;
+extern int edfi_onfdp_armed;
+extern int edfi_onfdp_armed_bb;
+extern int edfi_onfdp_armed_fdp;
 
 /* DF default handlers. */
 void edfi_onstart_default(char *params);
@@ -35,6 +38,7 @@ int edfi_onfdp_bb_index(int bb_index);
 void edfi_onfdp_min_fdp_interval_update();
 void edfi_onfdp_min_fault_time_interval_update();
 int edfi_onfdp_max_time();
+void edfi_onfdp_update_armed();
 
 /* DF API. */
 int edfi_start(edfi_context_t *context, char *params);
@@ -44,6 +48,7 @@ int edfi_stat(edfi_context_t *context);
 void edfi_print_stats();
 int edfi_update_context(edfi_context_t *context);
 int edfi_process_cmd(edfi_cmd_data_t *data);
+void edfi_bb_counters_fold();
 
 #endif
 
@@ -0,0 +1,29 @@
+#ifndef _EDFI_SHMSTATS_H
+#define _EDFI_SHMSTATS_H
+
+/*
+ * Live EDFI statistics exported in /dev/shm/edfi.stats.<pid> when
+ * EDFI_SHMSTATS=1. The payload is refreshed every EDFI_SHMSTATS_INTERVAL_MS
+ * milliseconds and can be sampled with util_shmstats_open() and
+ * util_shmstats_read() from common/util/shmstats.h.
+ */
+#define EDFI_SHMSTATS_PREFIX                "edfi.stats"
+#define EDFI_SHMSTATS_VERSION               1
+#define EDFI_SHMSTATS_INTERVAL_MS_DEFAULT   100
+
+typedef struct {
+    unsigned long long total_faults;
+    unsigned long long total_bb_executions;
+    unsigned long long num_updates;
+    int fault_fdp_count;
+    int faultinjection_enabled;
+    unsigned int num_bbs;
+    unsigned int num_fault_types;
+    /* bb_num_executions[num_bbs] follows (indexed by bb_index-1). */
+    unsigned long long bb_num_executions[0];
+} edfi_shmstats_t;
+
+#define EDFI_SHMSTATS_SIZE(NUM_BBS) \
+    (sizeof(edfi_shmstats_t) + (NUM_BBS)*sizeof(unsigned long long))
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _LTCKPT_SNAPSHOT_H
+#define _LTCKPT_SNAPSHOT_H
+
+#include <stdint.h>
+
+/*
+ * file structure (native endianness):
+ *   struct ltckpt_snapshot_header header;   (padded to LTCKPT_SNAPSHOT_HEADER_SIZE)
+ *   { struct ltckpt_snapshot_range range; char data[range.len]; } ranges[header.num_ranges];
+ *
+ * Ranges hold the non-zero pages of the checkpointed memory at a top of
+ * the loop; pages missing from the file were all zeros. The header is
+ * written last, a file with a zero magic is an incomplete snapshot.
+ */
+
+#define LTCKPT_SNAPSHOT_MAGIC 0x7053744c
+#define LTCKPT_SNAPSHOT_VERSION 1
+#define LTCKPT_SNAPSHOT_FILE "ltckpt.snapshot"
+#define LTCKPT_SNAPSHOT_HEADER_SIZE 4096
+
+struct ltckpt_snapshot_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t page_size;
+	uint32_t pid;
+	uint32_t reserved;
+	uint64_t checkpoint;	/* CTX num_checkpoints at the snapshot */
+	uint64_t num_ranges;
+	uint64_t num_bytes;	/* data bytes, excluding range headers */
+	char approach[16];
+};
+
+struct ltckpt_snapshot_range {
+	uint64_t addr;
+	uint64_t len;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _LTCKPT_STATFILE_H
+#define _LTCKPT_STATFILE_H
+
+#include <stdint.h>
+
+/*
+ * file structure (native endianness, mmap-able):
+ *   struct ltckpt_stats_header header;
+ *   struct ltckpt_stats_record records[header.num_records];
+ *
+ * header.num_records is only updated on flush, so a file from a crashed
+ * run may contain more (complete) records than advertised.
+ */
+
+#define LTCKPT_STATS_MAGIC 0x7453744c
+#define LTCKPT_STATS_VERSION 1
+#define LTCKPT_STATS_FILE "ltckpt.stat"
+
+enum ltckpt_stats_kind {
+	/* ltckpt_stat_dump(): key=address, value=store count. */
+	LTCKPT_STATS_KIND_STORE_COUNT = 1,
+	/* softdirty: key=page address, value=number of times saved. */
+	LTCKPT_STATS_KIND_PAGE_COUNT,
+	/* softdirty: key=checkpoint index, value=number of pages saved. */
+	LTCKPT_STATS_KIND_PAGE_NUM,
+	__LTCKPT_STATS_NUM_KINDS
+};
+
+struct ltckpt_stats_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t pid;
+	uint32_t reserved;
+	uint64_t num_records;
+};
+
+struct ltckpt_stats_record {
+	uint32_t kind;
+	uint32_t iteration;
+	uint64_t key;
+	uint64_t value;
+};
+
+#endif
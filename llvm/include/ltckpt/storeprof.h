@@ -0,0 +1,32 @@
+#ifndef _LTCKPT_STOREPROF_H
+#define _LTCKPT_STOREPROF_H
+
+#include <stdint.h>
+
+/*
+ * Store execution profile, written at exit by binaries built with
+ * -ltckpt_profile_gen and read back by -ltckpt_profile_use:
+ *   struct ltckpt_storeprof_header header;
+ *   uint64_t counts[header.num_sites];
+ *
+ * Sites are the stores and memory intrinsics of the module numbered in
+ * module order before instrumentation; hash identifies the numbering, so a
+ * profile only applies to the bitcode it was collected on. Sites that were
+ * not instrumented have a zero count.
+ */
+
+#define LTCKPT_STOREPROF_MAGIC 0x7350744c
+#define LTCKPT_STOREPROF_VERSION 1
+#define LTCKPT_STOREPROF_FILE "ltckpt.sprof"
+
+struct ltckpt_storeprof_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t pid;
+	uint32_t reserved2;
+	uint64_t hash;
+	uint64_t num_sites;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _LTCKPT_WPROF_H
+#define _LTCKPT_WPROF_H
+
+#include <stdint.h>
+
+/*
+ * Binary export of the recovery-window profiler (ltckpt_wprof_export()):
+ *   struct ltckpt_wprof_header header;
+ *   struct ltckpt_wprof_record records[header.num_records];
+ *
+ * The first record holds the global counters, with all keys set to 0. The
+ * last one holds the sites that did not fit in the table (header.num_dropped
+ * lookups), with all keys set to LTCKPT_WPROF_DROPPED. Function names are
+ * exported as addresses in the profiled binary.
+ */
+
+#define LTCKPT_WPROF_MAGIC 0x666f7057
+#define LTCKPT_WPROF_VERSION 1
+#define LTCKPT_WPROF_DROPPED UINT64_MAX
+
+struct ltckpt_wprof_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t num_records;
+	uint32_t num_dropped;
+};
+
+struct ltckpt_wprof_pol {
+	uint64_t bb_in;
+	uint64_t bb_out;
+	uint64_t end;
+	uint64_t end_k;
+	uint64_t end_s;
+	uint64_t end_n;
+	uint64_t ended_cumulative;
+};
+
+struct ltckpt_wprof_record {
+	uint64_t caller2;
+	uint64_t caller1;
+	uint64_t caller0;
+	uint64_t func_name;
+	struct ltckpt_wprof_pol pes;
+	struct ltckpt_wprof_pol dfa;
+	struct ltckpt_wprof_pol opt;
+	struct ltckpt_wprof_pol rwindow;
+};
+
+#endif
@@ -9,6 +9,7 @@
 #include <errno.h>
 
 #include <smmap/smmap_common.h>
+#include <smmap/smmap_user.h>
 
 int smmap_ctl_fd __attribute__ ((weak));
 
@@ -31,6 +32,9 @@ static inline int __smmap_ctl(smmap_ctl_t *ctl)
 {
     int ret;
 
+    if (__smmap_user_enabled()) {
+        return __smmap_user_ctl(ctl);
+    }
     if (!smmap_ctl_fd) {
         __smmap_init();
     }
@@ -0,0 +1,545 @@
+#ifndef _SMMAP_USER_H_
+#define _SMMAP_USER_H_
+
+/*
+ * Userspace smmap backend, for stock kernels without smmap.ko.
+ *
+ * Each smmap()ed range is backed by a memfd holding the checkpoint image.
+ * The writable private mappings found in the range at smmap() time are
+ * copied into the memfd and replaced by MAP_PRIVATE mappings of it, so the
+ * first write to a page after a checkpoint COWs it like in the kernel module.
+ * The memfd is also mapped MAP_SHARED at the shadow address.
+ *  - checkpoint: dirty (anonymous, according to /proc/self/pagemap) pages
+ *    are written back to the memfd and dropped with MADV_DONTNEED.
+ *  - rollback: private pages are dropped with MADV_DONTNEED, so the range
+ *    reads back the checkpoint image.
+ * Mappings created in the range after smmap() are not covered, the cost of
+ * a checkpoint is proportional to the mapped size of the range (pagemap
+ * scan) and the backend is not thread-safe. It is selected at build time
+ * with -DSMMAP_USERSPACE or at run time with SMMAP_USERSPACE=1.
+ */
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define SMMAP_USER_ENV            "SMMAP_USERSPACE"
+#define SMMAP_USER_PAGE_SIZE      4096UL
+#define SMMAP_USER_MAX_MAPS       SMMAP_DEFAULT_MAX_MAPS
+#define SMMAP_USER_MAX_VMAS       64
+#define SMMAP_USER_PAGEMAP_BATCH  512
+
+#define SMMAP_USER_PM_PRESENT     (1ULL << 63)
+#define SMMAP_USER_PM_SWAPPED     (1ULL << 62)
+#define SMMAP_USER_PM_FILE        (1ULL << 61)
+
+typedef enum smmap_user_scan_e {
+    SMMAP_USER_SCAN_SETUP,
+    SMMAP_USER_SCAN_CHECKPOINT
+} smmap_user_scan_t;
+
+typedef struct smmap_user_vma_s {
+    char *start;
+    char *end;
+    int prot;
+    int anon;
+} smmap_user_vma_t;
+
+typedef struct smmap_user_map_s {
+    char *addr;
+    char *shadow_addr;
+    unsigned long size;
+    int fd;
+    unsigned num_vmas;
+    smmap_user_vma_t vmas[SMMAP_USER_MAX_VMAS];
+} smmap_user_map_t;
+
+typedef struct smmap_user_s {
+    int pagemap_fd;
+    pid_t pagemap_pid;
+    smmap_stats_t stats;
+    smmap_user_map_t maps[SMMAP_USER_MAX_MAPS];
+} smmap_user_t;
+
+#define SMMAP_USER_STATE_SIZE \
+    ((sizeof(smmap_user_t) + SMMAP_USER_PAGE_SIZE - 1) & ~(SMMAP_USER_PAGE_SIZE - 1))
+
+/*
+ * The state lives in its own mapping (excluded from every range), so stats
+ * and the map table survive rollbacks of the data and bss sections.
+ */
+smmap_user_t *smmap_user __attribute__ ((weak));
+int smmap_user_mode __attribute__ ((weak));
+
+static inline int __smmap_user_enabled()
+{
+#ifdef SMMAP_USERSPACE
+    return 1;
+#else
+    char *env;
+
+    if (!smmap_user_mode) {
+        env = getenv(SMMAP_USER_ENV);
+        smmap_user_mode = env && atoi(env) ? 1 : -1;
+    }
+    return smmap_user_mode > 0;
+#endif
+}
+
+/*
+ * /proc/self/pagemap is resolved at open time, so a forked child has to
+ * open its own or it would scan the page table of its parent.
+ */
+static inline int __smmap_user_pagemap_open(smmap_user_t *state)
+{
+    if (state->pagemap_fd >= 0) {
+        close(state->pagemap_fd);
+    }
+    while ((state->pagemap_fd = open("/proc/self/pagemap", O_RDONLY)) < 0
+        && errno == EINTR);
+    state->pagemap_pid = getpid();
+    return state->pagemap_fd;
+}
+
+static inline smmap_user_t* __smmap_user_state()
+{
+    smmap_user_t *state;
+    int i;
+
+    if (smmap_user) {
+        if (smmap_user->pagemap_pid != getpid()
+            && __smmap_user_pagemap_open(smmap_user) < 0) {
+            return NULL;
+        }
+        return smmap_user;
+    }
+    state = (smmap_user_t*) mmap(NULL, SMMAP_USER_STATE_SIZE,
+        PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) {
+        return NULL;
+    }
+    state->pagemap_fd = -1;
+    if (__smmap_user_pagemap_open(state) < 0) {
+        munmap(state, SMMAP_USER_STATE_SIZE);
+        return NULL;
+    }
+    for (i = 0; i < SMMAP_USER_MAX_MAPS; i++) {
+        state->maps[i].fd = -1;
+    }
+    smmap_user = state;
+    return state;
+}
+
+static inline int __smmap_user_memfd(unsigned long size)
+{
+    int fd;
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, "smmap", 0);
+#else
+    char name[32];
+    snprintf(name, sizeof(name), "/smmap.%d", getpid());
+    fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+    if (fd >= 0) {
+        shm_unlink(name);
+    }
+#endif
+    if (fd < 0) {
+        return fd;
+    }
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static inline int __smmap_user_pwrite(int fd, char *buff, size_t size,
+    off_t offset)
+{
+    ssize_t ret;
+
+    while (size > 0) {
+        ret = pwrite(fd, buff, size, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        buff += ret;
+        size -= ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+static inline int __smmap_user_vma_add(smmap_user_map_t *map, char *start,
+    char *end, int prot, int anon)
+{
+    smmap_user_vma_t *vma;
+
+    if (start >= end) {
+        return 0;
+    }
+    if (map->num_vmas == SMMAP_USER_MAX_VMAS) {
+        errno = ENOMEM;
+        return -1;
+    }
+    vma = &map->vmas[map->num_vmas++];
+    vma->start = start;
+    vma->end = end;
+    vma->prot = prot;
+    vma->anon = anon;
+    return 0;
+}
+
+/*
+ * Collect the writable private mappings in the range, clipped to it and
+ * with the backend state carved out.
+ */
+static inline int __smmap_user_vmas_parse(smmap_user_t *state,
+    smmap_user_map_t *map)
+{
+    FILE *file;
+    char line[512], perms[5], name[256];
+    unsigned long start, end;
+    char *s, *e, *state_start, *state_end;
+    int n, prot, anon, ret = 0;
+
+    file = fopen("/proc/self/maps", "r");
+    if (!file) {
+        return -1;
+    }
+    state_start = (char*) state;
+    state_end = state_start + SMMAP_USER_STATE_SIZE;
+    map->num_vmas = 0;
+    while (ret == 0 && fgets(line, sizeof(line), file)) {
+        name[0] = '\0';
+        n = sscanf(line, "%lx-%lx %4s %*x %*s %*u %255[^\n]",
+            &start, &end, perms, name);
+        if (n < 3 || perms[0] != 'r' || perms[1] != 'w' || perms[3] != 'p') {
+            continue;
+        }
+        if (name[0] == '[' && strcmp(name, "[heap]")) {
+            continue;
+        }
+        s = (char*) start < map->addr ? map->addr : (char*) start;
+        e = (char*) end > map->addr + map->size ?
+            map->addr + map->size : (char*) end;
+        prot = PROT_READ|PROT_WRITE|(perms[2] == 'x' ? PROT_EXEC : 0);
+        anon = !name[0] || name[0] == '[';
+        if (s < state_end && e > state_start) {
+            ret = __smmap_user_vma_add(map, s, state_start, prot, anon);
+            if (ret == 0) {
+                ret = __smmap_user_vma_add(map, state_end, e, prot, anon);
+            }
+        }
+        else {
+            ret = __smmap_user_vma_add(map, s, e, prot, anon);
+        }
+    }
+    fclose(file);
+    return ret;
+}
+
+static inline int __smmap_user_flush(smmap_user_map_t *map, char *run,
+    char *end, smmap_user_scan_t mode)
+{
+    if (__smmap_user_pwrite(map->fd, run, end - run, run - map->addr) < 0) {
+        return -1;
+    }
+    if (mode == SMMAP_USER_SCAN_CHECKPOINT
+        && madvise(run, end - run, MADV_DONTNEED) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Write the relevant pages of a vma to the memfd: resident anonymous pages
+ * at setup time (the rest read as zero), COWed pages at checkpoint time.
+ */
+static inline int __smmap_user_scan(smmap_user_t *state, smmap_user_map_t *map,
+    smmap_user_vma_t *vma, smmap_user_scan_t mode)
+{
+    uint64_t entries[SMMAP_USER_PAGEMAP_BATCH];
+    char *page, *run = NULL;
+    unsigned long i, n, num_dirty = 0;
+    uint64_t e;
+    ssize_t ret;
+    int dirty;
+
+    for (page = vma->start; page < vma->end;
+        page += n*SMMAP_USER_PAGE_SIZE) {
+        n = (vma->end - page) / SMMAP_USER_PAGE_SIZE;
+        if (n > SMMAP_USER_PAGEMAP_BATCH) {
+            n = SMMAP_USER_PAGEMAP_BATCH;
+        }
+        ret = pread(state->pagemap_fd, entries, n*sizeof(uint64_t),
+            ((unsigned long) page / SMMAP_USER_PAGE_SIZE)*sizeof(uint64_t));
+        if (ret != (ssize_t) (n*sizeof(uint64_t))) {
+            if (ret < 0 && errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            e = entries[i];
+            if (mode == SMMAP_USER_SCAN_SETUP) {
+                dirty = (e & (SMMAP_USER_PM_PRESENT|SMMAP_USER_PM_SWAPPED)) != 0;
+            }
+            else {
+                dirty = (e & SMMAP_USER_PM_SWAPPED)
+                    || ((e & SMMAP_USER_PM_PRESENT) && !(e & SMMAP_USER_PM_FILE));
+            }
+            if (dirty) {
+                num_dirty++;
+                if (!run) {
+                    run = page + i*SMMAP_USER_PAGE_SIZE;
+                }
+            }
+            else if (run) {
+                if (__smmap_user_flush(map, run,
+                    page + i*SMMAP_USER_PAGE_SIZE, mode) < 0) {
+                    return -1;
+                }
+                run = NULL;
+            }
+        }
+    }
+    if (run && __smmap_user_flush(map, run, vma->end, mode) < 0) {
+        return -1;
+    }
+    if (mode == SMMAP_USER_SCAN_CHECKPOINT) {
+        state->stats.num_dirty_pages += num_dirty;
+        state->stats.num_cows += num_dirty;
+    }
+    return 0;
+}
+
+static inline smmap_user_map_t* __smmap_user_lookup(smmap_user_t *state,
+    char *addr)
+{
+    int i;
+
+    for (i = 0; i < SMMAP_USER_MAX_MAPS; i++) {
+        if (state->maps[i].fd >= 0 && state->maps[i].addr == addr) {
+            return &state->maps[i];
+        }
+    }
+    return NULL;
+}
+
+static inline void __smmap_user_map_del(smmap_user_t *state,
+    smmap_user_map_t *map)
+{
+    unsigned i;
+    unsigned long offset;
+
+    for (i = 0; i < map->num_vmas; i++) {
+        offset = map->vmas[i].start - map->addr;
+        munmap(map->shadow_addr + offset, map->vmas[i].end - map->vmas[i].start);
+    }
+    close(map->fd);
+    map->fd = -1;
+    state->stats.num_maps--;
+    state->stats.num_procs = state->stats.num_maps ? 1 : 0;
+}
+
+static inline int __smmap_user_smmap(char *addr, char *shadow_addr,
+    unsigned long size)
+{
+    smmap_user_t *state;
+    smmap_user_map_t *map;
+    smmap_user_vma_t *vma;
+    unsigned long offset, len;
+    unsigned i;
+    void *ret;
+
+    state = __smmap_user_state();
+    if (!state) {
+        return -1;
+    }
+    /* Mapping again (e.g., in a forked child) replaces the old image. */
+    map = __smmap_user_lookup(state, addr);
+    if (map) {
+        __smmap_user_map_del(state, map);
+    }
+    for (i = 0; i < SMMAP_USER_MAX_MAPS && state->maps[i].fd >= 0; i++);
+    if (i == SMMAP_USER_MAX_MAPS) {
+        errno = ENOMEM;
+        return -1;
+    }
+    map = &state->maps[i];
+    map->addr = addr;
+    map->shadow_addr = shadow_addr;
+    map->size = size;
+    if (__smmap_user_vmas_parse(state, map) < 0) {
+        return -1;
+    }
+    map->fd = __smmap_user_memfd(size);
+    if (map->fd < 0) {
+        return -1;
+    }
+    state->stats.num_maps++;
+    state->stats.num_procs = 1;
+    for (i = 0; i < map->num_vmas; i++) {
+        vma = &map->vmas[i];
+        offset = vma->start - addr;
+        len = vma->end - vma->start;
+        if (vma->anon) {
+            if (__smmap_user_scan(state, map, vma, SMMAP_USER_SCAN_SETUP) < 0) {
+                break;
+            }
+        }
+        else if (__smmap_user_pwrite(map->fd, vma->start, len, offset) < 0) {
+            break;
+        }
+        ret = mmap(vma->start, len, vma->prot, MAP_PRIVATE|MAP_FIXED,
+            map->fd, offset);
+        if (ret == MAP_FAILED) {
+            break;
+        }
+        ret = mmap(shadow_addr + offset, len, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_FIXED, map->fd, offset);
+        if (ret == MAP_FAILED) {
+            break;
+        }
+    }
+    if (i < map->num_vmas) {
+        map->num_vmas = i;
+        __smmap_user_map_del(state, map);
+        return -1;
+    }
+    return 0;
+}
+
+static inline int __smmap_user_smunmap(char *addr)
+{
+    smmap_user_t *state;
+    smmap_user_map_t *map;
+
+    state = __smmap_user_state();
+    if (!state) {
+        return -1;
+    }
+    map = __smmap_user_lookup(state, addr);
+    if (!map) {
+        errno = ENOENT;
+        return -1;
+    }
+    __smmap_user_map_del(state, map);
+    return 0;
+}
+
+static inline int __smmap_user_checkpoint(smmap_user_t *state)
+{
+    smmap_user_map_t *map;
+    unsigned i, j;
+
+    state->stats.num_checkpoints++;
+    for (i = 0; i < SMMAP_USER_MAX_MAPS; i++) {
+        map = &state->maps[i];
+        if (map->fd < 0) {
+            continue;
+        }
+        for (j = 0; j < map->num_vmas; j++) {
+            if (__smmap_user_scan(state, map, &map->vmas[j],
+                SMMAP_USER_SCAN_CHECKPOINT) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static inline int __smmap_user_rollback(smmap_user_t *state)
+{
+    smmap_user_map_t *map;
+    smmap_user_vma_t *vma;
+    unsigned i, j;
+
+    state->stats.num_rollbacks++;
+    for (i = 0; i < SMMAP_USER_MAX_MAPS; i++) {
+        map = &state->maps[i];
+        if (map->fd < 0) {
+            continue;
+        }
+        for (j = 0; j < map->num_vmas; j++) {
+            vma = &map->vmas[j];
+            if (madvise(vma->start, vma->end - vma->start, MADV_DONTNEED) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static inline int __smmap_user_smctl(smmap_smctl_op_t op, void *ptr)
+{
+    smmap_user_t *state;
+    unsigned num_procs, num_maps;
+
+    state = __smmap_user_state();
+    if (!state) {
+        return -1;
+    }
+    switch (op) {
+    case SMMAP_SMCTL_CHECKPOINT:
+        return __smmap_user_checkpoint(state);
+    case SMMAP_SMCTL_ROLLBACK_DEFAULT:
+        return __smmap_user_rollback(state);
+    case SMMAP_SMCTL_GET_STATS:
+        memcpy(ptr, &state->stats, sizeof(smmap_stats_t));
+        return 0;
+    case SMMAP_SMCTL_CLEAR_STATS:
+        num_procs = state->stats.num_procs;
+        num_maps = state->stats.num_maps;
+        memset(&state->stats, 0, sizeof(smmap_stats_t));
+        state->stats.num_procs = num_procs;
+        state->stats.num_maps = num_maps;
+        return 0;
+    default:
+        break;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+static inline int __smmap_user_ctl(smmap_ctl_t *ctl)
+{
+    switch (ctl->op) {
+    case SMMAP_CTL_SMMAP:
+        return __smmap_user_smmap(ctl->u.smmap.addr,
+            ctl->u.smmap.shadow_addr, ctl->u.smmap.size);
+    case SMMAP_CTL_SMUNMAP:
+        return __smmap_user_smunmap(ctl->u.smunmap.addr);
+    case SMMAP_CTL_SMCTL:
+        return __smmap_user_smctl(ctl->u.smctl.op, ctl->u.smctl.ptr);
+    default:
+        break;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+#else /* !__linux__ */
+
+static inline int __smmap_user_enabled()
+{
+    return 0;
+}
+
+static inline int __smmap_user_ctl(smmap_ctl_t *ctl)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* __linux__ */
+
+#endif /* _SMMAP_USER_H_ */
@@ -37,6 +37,46 @@ cloneInlineLoopsOpt("bbclone-inline-loops",
     cl::desc("Force (extracted) loop inlining."),
     cl::init(true), cl::NotHidden, cl::ValueRequired);
 
+static cl::opt<bool>
+cloneStickyOpt("bbclone-sticky",
+    cl::desc("Call the same clone of a cloned function directly from a clone, as long as the clone flag cannot have changed since entry (calls after a store to the flag or a call that may change it check the flag again)."),
+    cl::init(false), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<bool>
+cloneStickyTrustExternalOpt("bbclone-sticky-trust-external",
+    cl::desc("Assume calls to external functions do not change the clone flag in sticky mode (implied when the flag is internal and its address is not taken)."),
+    cl::init(false), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<unsigned>
+cloneHotOpt("bbclone-hot-clone",
+    cl::desc("Specify the clone executed most of the time (1 or 2, 0 to disable the hot/cold layout). Hot clones are laid out contiguously, cold clones are marked cold."),
+    cl::init(0), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<std::string>
+cloneHotSectionOpt("bbclone-hot-section",
+    cl::desc("Specify the section for hot clones with a NULL clone section."),
+    cl::init(".text.hot"), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<std::string>
+cloneColdSectionOpt("bbclone-cold-section",
+    cl::desc("Specify the section for cold clones with a NULL clone section."),
+    cl::init(".text.unlikely"), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<unsigned>
+cloneSizeBudgetOpt("bbclone-size-budget",
+    cl::desc("Specify the maximum code size increase due to cloning, in percent of the instructions in the module (0 for no limit). The coldest candidates are not cloned."),
+    cl::init(0), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<unsigned>
+cloneBudgetFallbackOpt("bbclone-budget-fallback",
+    cl::desc("Specify the clone whose section is assigned to the functions not cloned because of the size budget (1 or 2)."),
+    cl::init(2), cl::NotHidden, cl::ValueRequired);
+
+static cl::opt<std::string>
+cloneProfileOpt("bbclone-profile",
+    cl::desc("Specify a profile with a 'function count' pair per line to rank the candidates for the size budget (static call sites are used otherwise)."),
+    cl::init(""), cl::NotHidden, cl::ValueRequired);
+
 static cl::list<std::string>
 cloneExcludeCallstacksOpt("bbclone-exclude-callstacks-to",
     cl::desc("Specify all the comma-separated tuples to specify the functions whose callstacks should not be instrumented. Indirect calls are resolved according to the callee-mapper below (direct calls only by default)."),
@@ -60,9 +100,13 @@ hookClone2Opt("bbclone-clone2-hookname",
 /*
  * Example usage (ltckpt, strip required when instrumenting loops due to bugs in loop-extract):
  *  ./build.llvm [strip loop-extract] bbclone "bbclone-map=(^\$)|(^[^l].*\$)/^.*$/ltckpt_functions/NULL" bbclone-flag=sa_window__is_open bbclone-exclude-callstacks-to=sef_handle_message [bbclone-inline1=1] [bbclone-inline2=1] [debug-only=bbclone]
+ *  [bbclone-sticky=1] [bbclone-hot-clone=1] [bbclone-size-budget=50 [bbclone-profile=bbclone.prof]]
  */
 
 STATISTIC(numClonedFunctions, "Number of functions cloned");
+STATISTIC(numDeclinedFunctions, "Number of functions not cloned because of the size budget");
+STATISTIC(numStickyCalls, "Number of calls redirected to the caller's clone");
+STATISTIC(numFlagChangingFunctions, "Number of functions that may change the clone flag");
 
 namespace llvm {
 
@@ -107,6 +151,14 @@ bool BBClonePass::runOnModule(Module &M) {
     getHooks();
     cloneFunctions();
 
+    /* Stay in the selected clone across calls that cannot change the flag. */
+    if (cloneStickyOpt)
+        stickyCalls();
+
+    /* Group hot clones and move cold clones out of the way. */
+    if (cloneHotOpt)
+        layoutClones();
+
     /* Inline loops when requested. */
     if (cloneInlineLoopsOpt)
         inlineLoops();
@@ -158,25 +210,33 @@ void BBClonePass::cloneFunctions()
 #endif
     Module::FunctionListType &functionList = M->getFunctionList();
     std::vector<Function *> functions;
+    std::vector<std::pair<std::string, std::string> > sections;
     std::set<const Function*>::iterator skipFunctionsIt;
     for (Module::iterator it = functionList.begin(); it != functionList.end(); ++it) {
         Function *F = it;
+        std::string clone1SectionName;
+        std::string clone2SectionName;
         skipFunctionsIt = skipFunctions.find(F);
-        if (skipFunctionsIt == skipFunctions.end())
-            functions.push_back(F);
+        if (skipFunctionsIt != skipFunctions.end())
+            continue;
+        if (F->isIntrinsic() || F->isDeclaration() || !isCloneCandidate(F, clone1SectionName, clone2SectionName))
+            continue;
+        functions.push_back(F);
+        sections.push_back(std::pair<std::string, std::string>(clone1SectionName, clone2SectionName));
     }
+    if (cloneSizeBudgetOpt)
+        applySizeBudget(functions, sections);
+    clonedFunctions = functions;
     for (unsigned i=0;i<functions.size();i++) {
         Function *F = functions[i];
-        std::string clone1SectionName;
-        std::string clone2SectionName;
-        if (F->isIntrinsic() || F->isDeclaration() || !isCloneCandidate(F, clone1SectionName, clone2SectionName)) {
-            continue;
-        }
+        std::string clone1SectionName = sections[i].first;
+        std::string clone2SectionName = sections[i].second;
         numClonedFunctions++;
         StringRef prefix1(prefixOpt);
         StringRef prefix2(prefixOpt);
         Function *clone1 = PassUtil::cloneFunction(F, prefix1.str().append("1.").append(F->getName().str()), clone1SectionName);
         Function *clone2 = PassUtil::cloneFunction(F, prefix2.str().append("2.").append(F->getName().str()), clone2SectionName);
+        cloneMap[F] = std::pair<Function*, Function*>(clone1, clone2);
 
 	DEBUG(errs() << "curr func: " << F->getName() << "[ clones created: " << clone1->getName() << ", " << clone2->getName() << " ]\n");
 
@@ -295,6 +355,124 @@ void BBClonePass::cloneFunctions()
     }
 }
 
+void BBClonePass::loadProfile(std::map<std::string, uint64_t> &profile)
+{
+    std::ifstream in(cloneProfileOpt.c_str());
+    std::string name;
+    uint64_t count;
+
+    if (!in.is_open()) {
+        errs() << "Unable to open profile " << cloneProfileOpt << ", using static call sites\n";
+        return;
+    }
+    while (in >> name >> count)
+        profile[name] += count;
+}
+
+uint64_t BBClonePass::getFunctionSize(Function *F)
+{
+    uint64_t size = 0;
+    for (Function::iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI)
+        size += BI->size();
+
+    return size;
+}
+
+void BBClonePass::applySizeBudget(std::vector<Function*> &functions, std::vector<std::pair<std::string, std::string> > &sections)
+{
+    std::map<std::string, uint64_t> profile;
+    std::vector<std::pair<std::pair<uint64_t, uint64_t>, unsigned> > ranking;
+    std::vector<Function*> budgetFunctions;
+    std::vector<std::pair<std::string, std::string> > budgetSections;
+    std::vector<bool> keep(functions.size(), false);
+    uint64_t moduleSize = 0, budget, used = 0;
+
+    for (Module::iterator it = M->begin(); it != M->end(); ++it)
+        moduleSize += getFunctionSize(it);
+    budget = moduleSize * cloneSizeBudgetOpt / 100;
+    if (!cloneProfileOpt.empty())
+        loadProfile(profile);
+
+    /* Hotness is the profile count, or the number of static call sites. */
+    for (unsigned i=0;i<functions.size();i++) {
+        Function *F = functions[i];
+        uint64_t hotness = 0;
+        if (!profile.empty()) {
+            std::map<std::string, uint64_t>::iterator profileIt = profile.find(F->getName().str());
+            if (profileIt != profile.end())
+                hotness = profileIt->second;
+        }
+        else {
+#if LLVM_VERSION >= 37
+            for (Value::user_iterator UI = F->user_begin(), UE = F->user_end(); UI != UE; ++UI)
+#else
+            for (Value::use_iterator UI = F->use_begin(), UE = F->use_end(); UI != UE; ++UI)
+#endif
+                hotness++;
+        }
+        /* Hottest first, smaller first on ties. */
+        ranking.push_back(std::make_pair(std::make_pair(~hotness, getFunctionSize(F)), i));
+    }
+    std::sort(ranking.begin(), ranking.end());
+
+    /* Cloning a function adds (roughly) one more copy of its body. */
+    for (unsigned i=0;i<ranking.size();i++) {
+        uint64_t size = ranking[i].first.second;
+        if (used + size > budget)
+            continue;
+        used += size;
+        keep[ranking[i].second] = true;
+    }
+
+    for (unsigned i=0;i<functions.size();i++) {
+        Function *F = functions[i];
+        if (keep[i]) {
+            budgetFunctions.push_back(F);
+            budgetSections.push_back(sections[i]);
+            continue;
+        }
+        numDeclinedFunctions++;
+        DEBUG(errs() << "Not cloning function (size budget): " << F->getName() << "\n");
+        std::string &fallbackSectionName = cloneBudgetFallbackOpt == 1 ? sections[i].first : sections[i].second;
+        if (!fallbackSectionName.empty())
+            F->setSection(fallbackSectionName);
+    }
+    functions.swap(budgetFunctions);
+    sections.swap(budgetSections);
+}
+
+void BBClonePass::layoutClones()
+{
+    Module::FunctionListType &functionList = M->getFunctionList();
+    std::vector<Function*> hotClones, coldClones;
+
+    /* Walk the clones in module order, cloneMap is keyed on pointers. */
+    for (unsigned i=0;i<clonedFunctions.size();i++) {
+        std::pair<Function*, Function*> &clones = cloneMap[clonedFunctions[i]];
+        Function *hotClone = cloneHotOpt == 1 ? clones.first : clones.second;
+        Function *coldClone = cloneHotOpt == 1 ? clones.second : clones.first;
+        if (!hotClone->hasSection() && !cloneHotSectionOpt.empty())
+            hotClone->setSection(cloneHotSectionOpt);
+        if (!coldClone->hasSection() && !cloneColdSectionOpt.empty())
+            coldClone->setSection(cloneColdSectionOpt);
+#if LLVM_VERSION >= 33
+        coldClone->addFnAttr(Attribute::Cold);
+#endif
+        hotClones.push_back(hotClone);
+        coldClones.push_back(coldClone);
+    }
+
+    /* Functions are emitted in module order, keep hot clones together. */
+    for (unsigned i=0;i<hotClones.size();i++) {
+        functionList.remove(hotClones[i]);
+        functionList.push_back(hotClones[i]);
+    }
+    for (unsigned i=0;i<coldClones.size();i++) {
+        functionList.remove(coldClones[i]);
+        functionList.push_back(coldClones[i]);
+    }
+}
+
 void BBClonePass::inlineLoops()
 {
 #if LLVM_VERSION >= 37
@@ -321,6 +499,148 @@ void BBClonePass::inlineLoops()
     }
 }
 
+void BBClonePass::getFlagChangingFunctions()
+{
+    std::map<const Function*, std::set<const Function*> > callers;
+    std::set<const Function*> unknownCallers, externalCallers;
+    std::vector<const Function*> worklist;
+    bool flagEscapes = false, addressTaken = false;
+
+    /* Functions writing the flag, or everything if its address escapes. */
+#if LLVM_VERSION >= 37
+    for (Value::user_iterator UI = flagGV->user_begin(), UE = flagGV->user_end(); UI != UE; ++UI) {
+#else
+    for (Value::use_iterator UI = flagGV->use_begin(), UE = flagGV->use_end(); UI != UE; ++UI) {
+#endif
+        User *U = *UI;
+        if (isa<LoadInst>(U))
+            continue;
+        StoreInst *SI = dyn_cast<StoreInst>(U);
+        if (!SI || SI->getValueOperand() == flagGV) {
+            flagEscapes = true;
+            break;
+        }
+        worklist.push_back(SI->getParent()->getParent());
+    }
+    if (flagEscapes) {
+        errs() << "Clone flag " << flagGV->getName() << " escapes, assuming any call may change it\n";
+        for (Module::iterator it = M->begin(); it != M->end(); ++it)
+            flagChangingFunctions.insert(it);
+        flagChangedByUnknownCalls = flagChangedByExternalCalls = true;
+        return;
+    }
+
+    for (Module::iterator it = M->begin(); it != M->end(); ++it) {
+        Function *F = it;
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            CallSite CS = PassUtil::getCallSiteFromInstruction(&*I);
+            if (!CS.getInstruction() || isa<IntrinsicInst>(&*I) || isa<InlineAsm>(CS.getCalledValue()))
+                continue;
+            Function *callee = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+            if (!callee)
+                unknownCallers.insert(F);
+            else if (callee->isDeclaration())
+                externalCallers.insert(F);
+            else
+                callers[callee].insert(F);
+        }
+    }
+
+    /* External code can only reach the flag if it is visible or through callbacks. */
+    flagChangedByExternalCalls = !cloneStickyTrustExternalOpt && !flagGV->hasLocalLinkage();
+    if (flagChangedByExternalCalls)
+        worklist.insert(worklist.end(), externalCallers.begin(), externalCallers.end());
+    else
+        unknownCallers.insert(externalCallers.begin(), externalCallers.end());
+
+    while (!worklist.empty()) {
+        const Function *F = worklist.back();
+        worklist.pop_back();
+        if (!flagChangingFunctions.insert(F).second)
+            continue;
+        worklist.insert(worklist.end(), callers[F].begin(), callers[F].end());
+        if (!addressTaken && F->hasAddressTaken()) {
+            addressTaken = true;
+            worklist.insert(worklist.end(), unknownCallers.begin(), unknownCallers.end());
+        }
+    }
+    flagChangedByUnknownCalls = addressTaken;
+    flagChangedByExternalCalls |= addressTaken;
+    numFlagChangingFunctions += flagChangingFunctions.size();
+}
+
+bool BBClonePass::mayChangeFlag(Instruction *I)
+{
+    if (StoreInst *SI = dyn_cast<StoreInst>(I))
+        return SI->getPointerOperand() == flagGV;
+    CallSite CS = PassUtil::getCallSiteFromInstruction(I);
+    if (!CS.getInstruction() || isa<IntrinsicInst>(I) || isa<InlineAsm>(CS.getCalledValue()))
+        return false;
+    Function *callee = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+    if (!callee)
+        return flagChangedByUnknownCalls;
+    if (callee->isDeclaration())
+        return flagChangedByExternalCalls;
+    return flagChangingFunctions.count(callee) > 0;
+}
+
+void BBClonePass::stickyCalls()
+{
+    std::map<Function*, std::pair<Function*, Function*> >::iterator it, cit;
+
+    getFlagChangingFunctions();
+
+    /*
+     * A clone is only entered when the flag selects it, so a call can stay
+     * in the same clone as long as the flag cannot have changed since entry.
+     * Calls reached after a store to the flag or a call that may change it
+     * keep going through the original function, which checks the flag again.
+     */
+    for (it = cloneMap.begin(); it != cloneMap.end(); ++it) {
+        Function *clones[2] = { it->second.first, it->second.second };
+        for (unsigned i = 0; i < 2; i++) {
+            Function *F = clones[i];
+            std::set<BasicBlock*> changedIn, changedOut;
+            std::vector<BasicBlock*> worklist;
+
+            /* Blocks reachable from a flag change, which may run with a stale clone. */
+            for (Function::iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI) {
+                BasicBlock *BB = BI;
+                for (BasicBlock::iterator II = BB->begin(), IE = BB->end(); II != IE; ++II) {
+                    if (mayChangeFlag(II)) {
+                        worklist.push_back(BB);
+                        break;
+                    }
+                }
+            }
+            while (!worklist.empty()) {
+                BasicBlock *BB = worklist.back();
+                worklist.pop_back();
+                if (!changedOut.insert(BB).second)
+                    continue;
+                for (succ_iterator SI = succ_begin(BB), SE = succ_end(BB); SI != SE; ++SI) {
+                    changedIn.insert(*SI);
+                    worklist.push_back(*SI);
+                }
+            }
+
+            for (Function::iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI) {
+                BasicBlock *BB = BI;
+                bool changed = changedIn.count(BB) > 0;
+                for (BasicBlock::iterator II = BB->begin(), IE = BB->end(); II != IE && !changed; ++II) {
+                    CallSite CS = PassUtil::getCallSiteFromInstruction(II);
+                    Function *callee = CS.getInstruction() ? dyn_cast<Function>(CS.getCalledValue()) : NULL;
+                    if (callee && (cit = cloneMap.find(callee)) != cloneMap.end()) {
+                        CS.setCalledFunction(i == 0 ? cit->second.first : cit->second.second);
+                        numStickyCalls++;
+                    }
+                    changed = mayChangeFlag(II);
+                }
+            }
+        }
+    }
+}
+
 bool BBClonePass::isCloneCandidate(Function *F, std::string &clone1SectionName, std::string &clone2SectionName)
 {
     for (std::vector<std::pair<Regex*, Regex*> >::iterator it = regexList.begin(); it != regexList.end(); ++it) {
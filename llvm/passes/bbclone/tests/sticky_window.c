@@ -0,0 +1,31 @@
+/*
+ * Sticky calls across a window opened mid-function: the second
+ * handle_request() must run in the clone selected by the new flag value.
+ */
+#include <stdio.h>
+
+int sa_window__is_open;
+static int side, sides[2], num_sides;
+
+void hook_clone1(void) { side = 1; }
+void hook_clone2(void) { side = 2; }
+
+__attribute__((noinline)) void handle_request(void)
+{
+    sides[num_sides++] = side;
+}
+
+__attribute__((noinline)) void open_window(void)
+{
+    sa_window__is_open = 1;
+}
+
+int main(void)
+{
+    handle_request();
+    open_window();
+    handle_request();
+
+    printf("%d %d\n", sides[0], sides[1]);
+    return !(sides[0] == 2 && sides[1] == 1);
+}
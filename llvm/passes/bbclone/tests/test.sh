@@ -0,0 +1,26 @@
+#!/bin/bash
+
+set -o errexit
+set -o nounset
+
+ROOT=$( cd $( dirname $0 )/../../../.. && pwd )
+. $ROOT/script.inc
+
+MYPWD=$( cd $( dirname $0 ) && pwd )
+TMP=$( mktemp -d )
+trap "rm -rf $TMP" EXIT
+
+OPT="$LLVMPREFIX/bin/opt -load=$INSTALL_DIR/bbclone.so -bbclone"
+BBCLONE_ARGS="-bbclone-map=^\$/^(main|handle_request|open_window)\$/NULL/NULL -bbclone-flag=sa_window__is_open -bbclone-clone1-hookname=hook_clone1 -bbclone-clone2-hookname=hook_clone2 -bbclone-inline-loops=0 -bbclone-sticky=1"
+
+echo " - Sticky calls with a window opened mid-function..."
+$LLVMPREFIX/bin/clang -O1 -emit-llvm -c -o $TMP/sticky_window.bc $MYPWD/sticky_window.c
+$OPT $BBCLONE_ARGS -o $TMP/sticky_window.bbclone.bc $TMP/sticky_window.bc
+$LLVMPREFIX/bin/clang -o $TMP/sticky_window $TMP/sticky_window.bbclone.bc
+
+# the first call stays in the clone, the one after open_window() checks the flag again
+$LLVMPREFIX/bin/llvm-dis -o - $TMP/sticky_window.bbclone.bc | awk '/^define .*@bbclone.2.main/,/^}/' > $TMP/main.ll
+grep -q "call .*@bbclone.2.handle_request" $TMP/main.ll
+grep -q "call .*@handle_request" $TMP/main.ll
+$TMP/sticky_window
+echo "   Done."
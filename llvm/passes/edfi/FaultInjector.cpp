@@ -19,6 +19,7 @@
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 
 #include <assert.h>
+#include <math.h>
 #include <sys/time.h>
 #include <stdio.h>
 #include <string>
@@ -27,6 +28,7 @@
 #include <fcntl.h>
 
 #include "FaultInjector.h"
+#include "FunctionCache.h"
 #include "MapFile.h"
 
 #define EDFI_XSTR(s) EDFI_STR(s)
@@ -43,6 +45,7 @@ char edfi_stat_buff[FAULT_PRINTF_SZ];
     }
 
 #include <edfi/common.h>
+#include <edfi/df/statfile.h>
 
 using namespace llvm;
 
@@ -97,6 +100,11 @@ rand_seed("fault-rand-seed",
         cl::desc("Fault Injector: random seed value. when '0', current time is used. Default value: 123"),
         cl::init(123), cl::NotHidden, cl::ValueRequired);
 
+static cl::opt<std::string>
+profile_path("fault-profile",
+        cl::desc("Fault Injector: edfi.stat execution count profile of a previous run of the same build, requires -fault-randombb-fif. Makes it select executed basic blocks only, weighted by their execution count. Profile a build with EDFI_COUNT_ALL_BLOCKS, otherwise blocks are only counted when their DFL is hit"),
+        cl::init(""), cl::NotHidden);
+
 static cl::opt<int>
 random_BB_FIF_seed("fault-randombb-fif-seed",
         cl::desc("Fault Injector: random seed value for choosing basic blocks for -fault-randombb-fif. Default value: same as -fault-rand-seed value"),
@@ -107,6 +115,11 @@ rand_reseed_per_function("fault-rand-reseed-per-function",
         cl::desc("Fault Injector: reseed random number generator on a per function basis (based on the function name). Useful to preserve per-function randomness across runs. Default value: false"),
         cl::init(false), cl::NotHidden, cl::ValueRequired);
 
+static cl::opt<std::string>
+cache_dir("fault-cache-dir",
+        cl::desc("Fault Injector: directory to cache instrumented functions in, keyed on their IR and the options, to reinstrument only the functions that changed across builds. Requires -fault-rand-reseed-per-function (empty = no cache)"),
+        cl::init(""), cl::NotHidden);
+
 static cl::list<std::string>
 FunctionNames("fault-functions",
         cl::desc("Fault Injector: specify comma separated list of functions to be instrumented (empty = all functions)"), cl::NotHidden, cl::CommaSeparated);
@@ -143,6 +156,11 @@ do_unconditionalize("fault-unconditionalize",
         cl::desc("Fault Injector: use direct test rather than edfi_onfdp_p to allow running unconditionalize pass afterwards"),
         cl::init(0), cl::NotHidden);
 
+static cl::opt<bool>
+do_armed_fdp("fault-armed-fdp",
+        cl::desc("Fault Injector: only call the FDP callback when the runtime armed it (edfi_onfdp_armed), so that FDPs the default callback would reject, e.g. with fault injection disabled or within min_fdp_interval, take a load and a compare per basic block"),
+        cl::init(0), cl::NotHidden);
+
 static cl::opt<bool>
 do_inline_profiling("inline-profiling",
         cl::desc("Update edfi_context->bb_num_executions in the FDP itself, allow profiling while using unconditionalize"),
@@ -228,8 +246,12 @@ PASS_COMMON_INIT_ONCE();
     void replace_BB_FIF_key(std::map<BasicBlock *, float> &BB_FIF_map, BasicBlock *old_key, BasicBlock *new_key);
     void replaceUsesOfStructElement(GlobalVariable *Struct, Constant *NewElement, int index);
     void getAllocaInfo(Function *F, Instruction **allocaInsertionPoint, Instruction **firstNonAllocaInst);
+    void loadProfile(const std::string &path, unsigned num_bbs, std::vector<uint64_t> &bb_num_executions);
+    std::string getCacheConfig(SmallVector<FaultType*, 8> &FaultTypes);
+    std::string getCacheFunctionConfig(Function *F, std::map<BasicBlock *, float> &BB_FIF_map);
+    void shiftBBIndexes(Function *F, int delta, GlobalVariable *on_fdp_p_var, GlobalVariable *on_dfl_p_var, GlobalVariable *inject_bb_var, GlobalVariable *armed_bb_var);
     void initRegexMap(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, cl::list<std::string> &stringList);
-    void switchFlag(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, Function *F, GlobalVariable *enabled_var, GlobalVariable *enabled_version_var);
+    void switchFlag(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, Function *F, GlobalVariable *enabled_var, GlobalVariable *enabled_version_var, GlobalVariable *armed_var);
 
     void FaultInjector::getAnalysisUsage(AnalysisUsage &AU) const{
         AU.addRequired<LoopInfo>();
@@ -298,6 +320,20 @@ PASS_COMMON_INIT_ONCE();
             exit(1);
         }
 
+        GlobalVariable* armed_var = NULL;
+        GlobalVariable* armed_bb_var = NULL;
+        if(do_armed_fdp && !do_unconditionalize && !noDFTs){
+            armed_var = M.getNamedGlobal("edfi_onfdp_armed");
+            armed_bb_var = M.getNamedGlobal("edfi_onfdp_armed_bb");
+            GlobalVariable* armed_fdp_var = M.getNamedGlobal("edfi_onfdp_armed_fdp");
+            if(!armed_var || !armed_bb_var || !armed_fdp_var) {
+                errs() << "Error: no edfi_onfdp_armed, edfi_onfdp_armed_bb or edfi_onfdp_armed_fdp variable found";
+                exit(1);
+            }
+            /* tell the runtime the instrumented code honors the armed words */
+            armed_fdp_var->setInitializer(Constant1);
+        }
+
         GlobalVariable* on_dfl_p_var = M.getNamedGlobal("edfi_onfault_p");
         if(!on_dfl_p_var) {
             errs() << "Error: no on_dfl_p_var variable found";
@@ -343,15 +379,42 @@ PASS_COMMON_INIT_ONCE();
         /* add BBs for -fault-randombb-fif to BB_FIF_map */
 
         std::map<BasicBlock *, float> BB_FIF_map;
-        for(unsigned int i = 0; i < random_BB_FIF.first; i++){
-            /* todo: pct, instead of absolute number of selected BBs ? */
-            BasicBlock *BB = NULL;
-            do{
-                BB = AllBasicBlocks[rand() % AllBasicBlocks.size()];
-            }while(BB_FIF_map.count(BB)); // only insert unique values
-            /* for now, insert the original basic block.
-             * below, we will have to remap the fif value to the corrupted basic block clone */
-            BB_FIF_map.insert(std::pair<BasicBlock *, float>(BB, random_BB_FIF.second));
+        unsigned long num_profile_bbs=0;
+        if(profile_path.size() && !random_BB_FIF.first){
+            errs() << "Error: -fault-profile is only used by -fault-randombb-fif, which is not set\n";
+            exit(1);
+        }
+        if(profile_path.size()){
+            /* weighted sampling without replacement: take the R blocks with the largest log(u)/weight */
+            std::vector<uint64_t> bb_num_executions;
+            loadProfile(profile_path, AllBasicBlocks.size(), bb_num_executions);
+            std::vector<std::pair<double, unsigned int> > keys;
+            for(unsigned int i = 0; i < AllBasicBlocks.size(); i++){
+                if(bb_num_executions[i] == 0){
+                    continue;
+                }
+                double u = (rand() + 1.0) / ((double) RAND_MAX + 2.0);
+                keys.push_back(std::pair<double, unsigned int>(log(u) / bb_num_executions[i], i));
+            }
+            num_profile_bbs = keys.size();
+            if(keys.size() < random_BB_FIF.first){
+                errs() << "Warning: only " << keys.size() << " basic blocks executed in " << profile_path << ", selecting all of them\n";
+            }
+            std::sort(keys.begin(), keys.end());
+            for(unsigned int i = 0; i < random_BB_FIF.first && i < keys.size(); i++){
+                BB_FIF_map.insert(std::pair<BasicBlock *, float>(AllBasicBlocks[keys[keys.size() - 1 - i].second], random_BB_FIF.second));
+            }
+        }else{
+            for(unsigned int i = 0; i < random_BB_FIF.first; i++){
+                /* todo: pct, instead of absolute number of selected BBs ? */
+                BasicBlock *BB = NULL;
+                do{
+                    BB = AllBasicBlocks[rand() % AllBasicBlocks.size()];
+                }while(BB_FIF_map.count(BB)); // only insert unique values
+                /* for now, insert the original basic block.
+                 * below, we will have to remap the fif value to the corrupted basic block clone */
+                BB_FIF_map.insert(std::pair<BasicBlock *, float>(BB, random_BB_FIF.second));
+            }
         }
         
         /* random seed for everything except -fault-randombb-fif */
@@ -496,6 +559,17 @@ PASS_COMMON_INIT_ONCE();
         int bb_index=1, bb_index_fdp;
 	int fault_index;
 
+        /* cache of instrumented functions, only valid when the randomness is per function */
+        FunctionCache *cache = NULL;
+        unsigned long num_cached_functions = 0;
+        if(cache_dir.size()){
+            if(!rand_reseed_per_function || do_inline_profiling){
+                errs() << "Warning: -fault-cache-dir requires -fault-rand-reseed-per-function and no -inline-profiling, not caching\n";
+            }else{
+                cache = new FunctionCache(M, cache_dir, getCacheConfig(FaultTypes));
+            }
+        }
+
         std::vector<Constant*> bb_total_num_injected_initializer;
 
         for (Module::iterator it = M.getFunctionList().begin(); it != M.getFunctionList().end(); ++it) {
@@ -504,7 +578,7 @@ PASS_COMMON_INIT_ONCE();
             if(!can_instrument_function(F, module_regexes)){
                 if(is_edfi_section(F) && !do_unconditionalize){
                     /* this is all the instrumentation that is optionally needed for static edfi lib functions */
-                    switchFlag(switchFlagRegexMap, switchFlagRegexList, F, enabled_var, enabled_version_var);
+                    switchFlag(switchFlagRegexMap, switchFlagRegexList, F, enabled_var, enabled_version_var, armed_var);
                 }
                 continue;
             }
@@ -525,6 +599,36 @@ PASS_COMMON_INIT_ONCE();
 	    std::string functionName = F->getName();
 	    mapfile.writeFunction(functionName, functionRelPath);
 	    fault_index = 0;
+
+            /* reuse the function instrumented by a previous build, if unchanged */
+            std::string cacheKey;
+            FunctionCacheEntry cacheEntry;
+            if(cache){
+                cacheKey = cache->getKey(F, getCacheFunctionConfig(F, BB_FIF_map));
+                if(cacheKey.size() && cache->load(F, cacheKey, cacheEntry)){
+                    shiftBBIndexes(F, bb_index - cacheEntry.firstBBIndex, on_fdp_p_var, on_dfl_p_var, inject_bb_var, armed_bb_var);
+                    mapfile.replay(cacheEntry.mapEvents);
+                    for(std::vector<BasicBlock>::size_type i = 0; i < cacheEntry.bbStats.size(); i++){
+                        std::vector<unsigned long> &stats = cacheEntry.bbStats[i];
+                        for(std::vector<FaultType *>::size_type j = 0; j <  FaultTypes.size(); j++){
+                            FaultType *FT = FaultTypes[j];
+                            FT->num_injected_initializer.push_back(ConstantInt::get(Constant1->getType(), stats[1 + 2*j]));
+                            FT->num_injected_total += stats[1 + 2*j];
+                            FT->num_candidates_initializer.push_back(ConstantInt::get(Constant1->getType(), stats[2 + 2*j]));
+                            FT->num_candidates_total += stats[2 + 2*j];
+                        }
+                        bb_total_num_injected_initializer.push_back(ConstantInt::get(Constant1->getType(), stats[0]));
+                        bb_index++;
+                    }
+                    num_cached_functions++;
+                    continue;
+                }
+                if(cacheKey.size()){
+                    cacheEntry = FunctionCacheEntry();
+                    cacheEntry.firstBBIndex = bb_index;
+                    mapfile.record(&cacheEntry.mapEvents);
+                }
+            }
 	    
             BasicBlock *OldFirstBB = F->getBasicBlockList().begin();
             BasicBlock *ClonedOldFirstBB = NULL;
@@ -712,16 +816,42 @@ PASS_COMMON_INIT_ONCE();
                     }else if(noDFTs){
                         createFlagBasedBranchInst(M, Correct, Corrupted, enabled_var, Constant0, Header);
                     }else{
-                        /* Call fdp callback() for decision */
+                        /* Call fdp callback() for decision, if armed */
+                        BasicBlock *FDPBlock = Header;
+                        if(armed_var){
+                            /* 0: skip, 1: call if edfi_onfdp_armed_bb is 0 or this block, N: skip and count down */
+                            BasicBlock *ArmedBlock = BasicBlock::Create(M.getContext(), Header->getName() + ".FDPArmed", F, Correct);
+                            BasicBlock *CountdownBlock = BasicBlock::Create(M.getContext(), Header->getName() + ".FDPCountdown", F, Correct);
+                            BasicBlock *ArmedBBBlock = BasicBlock::Create(M.getContext(), Header->getName() + ".FDPArmedBB", F, Correct);
+                            FDPBlock = BasicBlock::Create(M.getContext(), Header->getName() + ".FDP", F, Correct);
+
+                            LoadInst* armed = new LoadInst(armed_var, "", false, Header);
+                            armed->setAlignment(4);
+                            BranchInst *branch = createFlagBasedBranchInst(M, Correct, ArmedBlock, armed, Constant0, Header);
+                            setBranchWeight(M, branch, 65536, 1);
+
+                            createFlagBasedBranchInst(M, ArmedBBBlock, CountdownBlock, armed, Constant1, ArmedBlock);
+
+                            BinaryOperator* countdown = BinaryOperator::Create(Instruction::Sub, armed, Constant1, "", CountdownBlock);
+                            new StoreInst(countdown, armed_var, false, CountdownBlock);
+                            BranchInst::Create(Correct, CountdownBlock);
+
+                            LoadInst* armed_bb = new LoadInst(armed_bb_var, "", false, ArmedBBBlock);
+                            armed_bb->setAlignment(4);
+                            ICmpInst* any_bb = new ICmpInst(*ArmedBBBlock, ICmpInst::ICMP_EQ, armed_bb, Constant0, "");
+                            ICmpInst* this_bb = new ICmpInst(*ArmedBBBlock, ICmpInst::ICMP_EQ, armed_bb, ConstantInt::get(Constant1->getType(), bb_index_fdp), "");
+                            BinaryOperator* bb_match = BinaryOperator::Create(Instruction::Or, any_bb, this_bb, "", ArmedBBBlock);
+                            BranchInst::Create(FDPBlock, Correct, bb_match, ArmedBBBlock);
+                        }
 #ifdef EDFI_STATIC_DFT
                         Function *fdp_callback_p = M.getFunction(EDFI_XSTR(EDFI_STATIC_DFT));
                         assert(fdp_callback_p);
 #else
-                        LoadInst* fdp_callback_p = new LoadInst(on_fdp_p_var, "", false, Header);
+                        LoadInst* fdp_callback_p = new LoadInst(on_fdp_p_var, "", false, FDPBlock);
                         fdp_callback_p->setAlignment(8);
 #endif
-                        CallInst* FDPFuncCall = CallInst::Create(fdp_callback_p, ConstantInt::get(Constant1->getType(), bb_index_fdp), "", Header);
-                        createFlagBasedBranchInst(M, Correct, Corrupted, FDPFuncCall, Constant0, Header);
+                        CallInst* FDPFuncCall = CallInst::Create(fdp_callback_p, ConstantInt::get(Constant1->getType(), bb_index_fdp), "", FDPBlock);
+                        createFlagBasedBranchInst(M, Correct, Corrupted, FDPFuncCall, Constant0, FDPBlock);
                     }
 		    bb_index_fdp++;
                 }
@@ -762,7 +892,7 @@ PASS_COMMON_INIT_ONCE();
 
             UFEN.runOnFunction(*F);
 	    if (!do_unconditionalize) {
-                switchFlag(switchFlagRegexMap, switchFlagRegexList, F, enabled_var, enabled_version_var);
+                switchFlag(switchFlagRegexMap, switchFlagRegexList, F, enabled_var, enabled_version_var, armed_var);
 	    }
 
             /* Basic block cloning and fault decision callback injection is done. Now inject faults. */
@@ -929,7 +1059,24 @@ PASS_COMMON_INIT_ONCE();
                 bb_index++;
             }
 
+            if(cache && cacheKey.size()){
+                /* the per basic block statistics were just appended to the initializers */
+                size_t first = bb_total_num_injected_initializer.size() - CorruptedClones.size();
+                for(std::vector<BasicBlock>::size_type i = 0; i <  CorruptedClones.size(); i++){
+                    std::vector<unsigned long> stats;
+                    stats.push_back(cast<ConstantInt>(bb_total_num_injected_initializer[first + i])->getZExtValue());
+                    for(std::vector<FaultType *>::size_type j = 0; j <  FaultTypes.size(); j++){
+                        FaultType *FT = FaultTypes[j];
+                        stats.push_back(cast<ConstantInt>(FT->num_injected_initializer[first + i])->getZExtValue());
+                        stats.push_back(cast<ConstantInt>(FT->num_candidates_initializer[first + i])->getZExtValue());
+                    }
+                    cacheEntry.bbStats.push_back(stats);
+                }
+                mapfile.record(NULL);
+                cache->store(F, cacheKey, cacheEntry);
+            }
         }
+        delete cache;
         
         ArrayType* FaultTypeCountType = ArrayType::get(IntegerType::get(M.getContext(), 32), AllBasicBlocks.size());
 
@@ -1024,6 +1171,8 @@ PASS_COMMON_INIT_ONCE();
         EDFI_STAT_PRINTER(EDFI_STATS_UL_FMT, "n_module_basicblocks", num_module_bbs);
         EDFI_STAT_PRINTER(EDFI_STATS_UL_FMT, "rand-seed", (unsigned long) rand_seed);
         EDFI_STAT_PRINTER(EDFI_STATS_UL_FMT, "randombb-fif-seed", (unsigned long) random_BB_FIF_seed);
+        EDFI_STAT_PRINTER(EDFI_STATS_UL_FMT, "n_profile_executed_basicblocks", num_profile_bbs);
+        EDFI_STAT_PRINTER(EDFI_STATS_UL_FMT, "n_cached_functions", num_cached_functions);
         
         EDFI_STAT_PRINTER(EDFI_STATS_HEADER_FMT, EDFI_STATS_SECTION_PROB_NAME);
         for(std::vector<FaultType *>::size_type i = 0; i <  FaultTypes.size(); i++){
@@ -1198,6 +1347,104 @@ PASS_COMMON_INIT_ONCE();
         }
     }
 
+    /* read the per basic block execution counts of an edfi.stat file (see statfile.h) */
+    void loadProfile(const std::string &path, unsigned num_bbs, std::vector<uint64_t> &bb_num_executions){
+        struct edfi_stats_header header;
+        FILE *file = fopen(path.c_str(), "rb");
+        if(!file){
+            errs() << "Error: cannot open profile " << path << "\n";
+            exit(1);
+        }
+        if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != EDFI_STATS_MAGIC){
+            errs() << "Error: " << path << " is not an EDFI statistics file\n";
+            exit(1);
+        }
+        if(header.num_bbs != num_bbs){
+            errs() << "Error: profile " << path << " has " << header.num_bbs << " basic blocks, expected " << num_bbs << "\n";
+            exit(1);
+        }
+        bb_num_executions.resize(num_bbs);
+        if(fseek(file, (long) header.num_fault_types * header.fault_name_len, SEEK_CUR) != 0
+            || (num_bbs && fread(&bb_num_executions[0], sizeof(uint64_t), num_bbs, file) != num_bbs)){
+            errs() << "Error: profile " << path << " is truncated\n";
+            exit(1);
+        }
+        fclose(file);
+    }
+
+    /* everything besides the function itself that determines how it is instrumented */
+    std::string getCacheConfig(SmallVector<FaultType*, 8> &FaultTypes){
+        std::string config;
+        raw_string_ostream os(config);
+        os << "pass=" << __DATE__ << " " << __TIME__;
+        os << ";seed=" << rand_seed << ";global-fif=" << (float) global_FIF;
+        os << ";statistics-only=" << statistics_only << ";noDFTs=" << noDFTs << ";noDFLs=" << noDFLs;
+        os << ";no-statistics-instructions=" << noStatisticsInstructions << ";dsn=" << dsnCompat << ";atc=" << atcCompat;
+        os << ";one-per-block=" << oneFaultPerBlock << ";loop-header-switching=" << doLoopHeaderSwitching;
+        os << ";unconditionalize=" << do_unconditionalize << ";armed-fdp=" << do_armed_fdp << ";fdp=" << fdp_varname;
+        for(unsigned int i = 0; i < switchFlagMap.size(); i++){
+            os << ";switch-flag=" << switchFlagMap[i];
+        }
+        for(std::vector<FaultType *>::size_type i = 0; i <  FaultTypes.size(); i++){
+            os << ";" << FaultTypes[i]->getName() << "=" << FaultTypes[i]->getProbability();
+        }
+        return os.str();
+    }
+
+    std::string getCacheFunctionConfig(Function *F, std::map<BasicBlock *, float> &BB_FIF_map){
+        std::string config;
+        raw_string_ostream os(config);
+        os << "fif=";
+        for (Function::iterator BI = F->begin(), BE = F->end(); BI != BE; ++BI) {
+            BasicBlock *BB = BI;
+            os << (BB_FIF_map.count(BB) ? BB_FIF_map[BB] : (float) global_FIF) << ",";
+        }
+        os << ";selector=";
+        for(std::set<std::pair<std::string, int> >::iterator it = fault_selector.begin(); it != fault_selector.end(); ++it){
+            if(!it->first.compare(F->getName())){
+                os << it->second << ",";
+            }
+        }
+        return os.str();
+    }
+
+    /* renumber the basic block indexes passed to the FDP and DFL callbacks of a cached function */
+    void shiftBBIndexes(Function *F, int delta, GlobalVariable *on_fdp_p_var, GlobalVariable *on_dfl_p_var, GlobalVariable *inject_bb_var, GlobalVariable *armed_bb_var){
+        if(delta == 0){
+            return;
+        }
+        for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+            if(CallInst *CI = dyn_cast<CallInst>(&*I)){
+                Value *callee = CI->getCalledValue();
+                LoadInst *LI = dyn_cast<LoadInst>(callee);
+                bool isCallback = LI && (LI->getPointerOperand() == on_fdp_p_var || LI->getPointerOperand() == on_dfl_p_var);
+#ifdef EDFI_STATIC_DFT
+                isCallback = isCallback || callee == F->getParent()->getFunction(EDFI_XSTR(EDFI_STATIC_DFT));
+#endif
+#ifdef EDFI_STATIC_DFL
+                isCallback = isCallback || callee == F->getParent()->getFunction(EDFI_XSTR(EDFI_STATIC_DFL));
+#endif
+                if(!isCallback || CI->getNumArgOperands() != 1){
+                    continue;
+                }
+                ConstantInt *index = cast<ConstantInt>(CI->getArgOperand(0));
+                CI->setArgOperand(0, ConstantInt::get(index->getType(), index->getSExtValue() + delta));
+            }else if(ICmpInst *IC = dyn_cast<ICmpInst>(&*I)){
+                /* -fault-unconditionalize compares edfi_inject_bb with the index, armed FDPs compare edfi_onfdp_armed_bb */
+                LoadInst *LI = dyn_cast<LoadInst>(IC->getOperand(0));
+                if(!LI || (LI->getPointerOperand() != inject_bb_var && LI->getPointerOperand() != armed_bb_var)){
+                    continue;
+                }
+                ConstantInt *index = cast<ConstantInt>(IC->getOperand(1));
+                if(LI->getPointerOperand() == armed_bb_var && index->isZero()){
+                    /* edfi_onfdp_armed_bb == 0 matches any block, not an index */
+                    continue;
+                }
+                IC->setOperand(1, ConstantInt::get(index->getType(), index->getSExtValue() + delta));
+            }
+        }
+    }
+
     void initRegexMap(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, cl::list<std::string> &stringList)
     {
         for (std::vector<std::string>::iterator it = stringList.begin(); it != stringList.end(); ++it) {
@@ -1236,9 +1483,9 @@ PASS_COMMON_INIT_ONCE();
     }
 
 #ifdef EDFI_FORBID_SWITCH_FLAGS
-    void switchFlag(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, Function *F, GlobalVariable *enabled_var, GlobalVariable *enabled_version_var){}
+    void switchFlag(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, Function *F, GlobalVariable *enabled_var, GlobalVariable *enabled_version_var, GlobalVariable *armed_var){}
 #else
-    void switchFlag(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, Function *F, GlobalVariable *enabled_var, GlobalVariable *enabled_version_var){
+    void switchFlag(std::map<std::pair<Regex*, Regex*>, int> &regexMap, std::vector<std::pair<Regex*, Regex*> > &regexList, Function *F, GlobalVariable *enabled_var, GlobalVariable *enabled_version_var, GlobalVariable *armed_var){
         for (std::vector<std::pair<Regex*, Regex*> >::iterator it = regexList.begin(); it != regexList.end(); ++it) {
             std::pair<Regex*, Regex*> regexes = *it;
             Regex *sectionRegex = regexes.first;
@@ -1256,12 +1503,20 @@ PASS_COMMON_INIT_ONCE();
                     LoadInst *saved_flag = new LoadInst(enabled_var, "edfi_saved_flag", false, firstNonAlloca);
                     LoadInst *saved_flag_version = new LoadInst(enabled_version_var, "edfi_saved_flag_version", true, firstNonAlloca);
                     new StoreInst(constValue, enabled_var, false, firstNonAlloca);
+                    LoadInst *saved_armed = NULL;
+                    if(armed_var && value != 0){
+                        saved_armed = new LoadInst(armed_var, "edfi_saved_armed", false, firstNonAlloca);
+                        new StoreInst(ConstantInt::get(F->getParent()->getContext(), APInt(32, 1)), armed_var, false, firstNonAlloca);
+                    }
 
                     Instruction *returnInst = F->back().getTerminator();
                     LoadInst *version_at_end = new LoadInst(enabled_version_var, "edfi_flag_version_end", true, returnInst);
                     ICmpInst* cmp_versions = new ICmpInst(returnInst, ICmpInst::ICMP_EQ, saved_flag_version, version_at_end, "cmp_versions");
                     Instruction *ifTrueTerminator = Backports::SplitBlockAndInsertIfThen(cmp_versions);
                     new StoreInst(saved_flag, enabled_var, false, ifTrueTerminator);
+                    if(saved_armed){
+                        new StoreInst(saved_armed, armed_var, false, ifTrueTerminator);
+                    }
                 }
                 return;
             }
@@ -0,0 +1,418 @@
+#include "FunctionCache.h"
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include <fstream>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define FUNCTION_CACHE_MAGIC "edfi-function-cache"
+#define FUNCTION_CACHE_VERSION 1
+
+using namespace llvm;
+
+namespace llvm {
+
+/*
+ * Maps the types of a cached function back to the module's types. The
+ * bitcode reader renames the named structs that clash with the ones already
+ * in the context (struct.foo -> struct.foo.N), so look them up by dropping
+ * the numeric suffixes and check that the bodies match.
+ */
+class FunctionCacheTypeMapper : public ValueMapTypeRemapper {
+
+  public:
+      bool failed;
+
+      FunctionCacheTypeMapper(Module &M) : failed(false), M(M) {}
+
+      Type *remapType(Type *SrcTy) {
+          Type *DstTy = mapType(SrcTy);
+          if (!DstTy) {
+              failed = true;
+              return SrcTy;
+          }
+          return DstTy;
+      }
+
+      Type *mapType(Type *SrcTy);
+
+  private:
+      Module &M;
+      std::map<Type*, Type*> mappedTypes;
+
+      bool mapStructBody(StructType *SrcTy, StructType *DstTy);
+};
+
+Type *FunctionCacheTypeMapper::mapType(Type *SrcTy)
+{
+    std::map<Type*, Type*>::iterator it = mappedTypes.find(SrcTy);
+    if (it != mappedTypes.end())
+        return it->second;
+
+    Type *DstTy = NULL;
+    if (StructType *ST = dyn_cast<StructType>(SrcTy)) {
+        if (ST->isLiteral()) {
+            std::vector<Type*> elements;
+            for (unsigned i=0;i<ST->getNumElements();i++) {
+                Type *elementTy = mapType(ST->getElementType(i));
+                if (!elementTy)
+                    return NULL;
+                elements.push_back(elementTy);
+            }
+            DstTy = StructType::get(M.getContext(), elements, ST->isPacked());
+        }
+        else {
+            std::string name = ST->getName();
+            while (!DstTy) {
+                StructType *candidate = M.getTypeByName(name);
+                if (candidate && candidate != ST && mapStructBody(ST, candidate)) {
+                    DstTy = candidate;
+                    break;
+                }
+                size_t dot = name.rfind('.');
+                if (dot == std::string::npos || dot + 1 == name.size()
+                    || name.find_first_not_of("0123456789", dot + 1) != std::string::npos)
+                    return NULL;
+                name.resize(dot);
+            }
+        }
+    }
+    else if (PointerType *PT = dyn_cast<PointerType>(SrcTy)) {
+        Type *elementTy = mapType(PT->getElementType());
+        if (!elementTy)
+            return NULL;
+        DstTy = PointerType::get(elementTy, PT->getAddressSpace());
+    }
+    else if (ArrayType *AT = dyn_cast<ArrayType>(SrcTy)) {
+        Type *elementTy = mapType(AT->getElementType());
+        if (!elementTy)
+            return NULL;
+        DstTy = ArrayType::get(elementTy, AT->getNumElements());
+    }
+    else if (VectorType *VT = dyn_cast<VectorType>(SrcTy)) {
+        Type *elementTy = mapType(VT->getElementType());
+        if (!elementTy)
+            return NULL;
+        DstTy = VectorType::get(elementTy, VT->getNumElements());
+    }
+    else if (FunctionType *FT = dyn_cast<FunctionType>(SrcTy)) {
+        std::vector<Type*> params;
+        Type *returnTy = mapType(FT->getReturnType());
+        if (!returnTy)
+            return NULL;
+        for (unsigned i=0;i<FT->getNumParams();i++) {
+            Type *paramTy = mapType(FT->getParamType(i));
+            if (!paramTy)
+                return NULL;
+            params.push_back(paramTy);
+        }
+        DstTy = FunctionType::get(returnTy, params, FT->isVarArg());
+    }
+    else {
+        DstTy = SrcTy;
+    }
+
+    mappedTypes[SrcTy] = DstTy;
+    return DstTy;
+}
+
+bool FunctionCacheTypeMapper::mapStructBody(StructType *SrcTy, StructType *DstTy)
+{
+    if (SrcTy->isOpaque() || DstTy->isOpaque())
+        return SrcTy->isOpaque() && DstTy->isOpaque();
+    if (SrcTy->getNumElements() != DstTy->getNumElements() || SrcTy->isPacked() != DstTy->isPacked())
+        return false;
+
+    /* Map the struct first for recursive types, undo everything on mismatch. */
+    std::map<Type*, Type*> savedMappedTypes = mappedTypes;
+    mappedTypes[SrcTy] = DstTy;
+    for (unsigned i=0;i<SrcTy->getNumElements();i++) {
+        if (mapType(SrcTy->getElementType(i)) != DstTy->getElementType(i)) {
+            mappedTypes.swap(savedMappedTypes);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+FunctionCache::FunctionCache(Module &M, const std::string &dir, const std::string &config) : M(M), dir(dir), config(config)
+{
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+        errs() << "Warning: unable to create function cache directory " << dir << "\n";
+}
+
+/*
+ * Returns a standalone copy of F, with declarations for all the globals it
+ * references (which keep their names) and no debug metadata. NULL if some
+ * of them cannot be matched by name when loading the function back.
+ */
+Module *FunctionCache::extractFunction(Function *F)
+{
+    Module *CM = new Module(F->getName(), M.getContext());
+    CM->setDataLayout(M.getDataLayout());
+    CM->setTargetTriple(M.getTargetTriple());
+    ValueToValueMapTy VMap;
+    SmallVector<ReturnInst*, 8> Returns;
+    std::vector<Constant*> worklist;
+    std::set<Constant*> visited;
+
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        for (unsigned i=0;i<I->getNumOperands();i++) {
+            if (Constant *C = dyn_cast<Constant>(I->getOperand(i)))
+                worklist.push_back(C);
+        }
+    }
+    while (!worklist.empty()) {
+        Constant *C = worklist.back();
+        worklist.pop_back();
+        if (!visited.insert(C).second || C == F)
+            continue;
+        if (isa<BlockAddress>(C) || isa<GlobalAlias>(C)) {
+            delete CM;
+            return NULL;
+        }
+        if (GlobalValue *GV = dyn_cast<GlobalValue>(C)) {
+            GlobalValue *decl;
+            if (!GV->hasName()) {
+                delete CM;
+                return NULL;
+            }
+            if (Function *callee = dyn_cast<Function>(GV)) {
+                decl = Function::Create(callee->getFunctionType(), GlobalValue::ExternalLinkage, callee->getName(), CM);
+            }
+            else {
+                GlobalVariable *var = cast<GlobalVariable>(GV);
+                decl = new GlobalVariable(*CM, var->getType()->getElementType(), var->isConstant(),
+                    GlobalValue::ExternalLinkage, NULL, var->getName(), NULL,
+                    var->getThreadLocalMode(), var->getType()->getAddressSpace());
+            }
+            VMap[GV] = decl;
+            continue;
+        }
+        for (unsigned i=0;i<C->getNumOperands();i++)
+            worklist.push_back(cast<Constant>(C->getOperand(i)));
+    }
+
+    Function *CF = Function::Create(F->getFunctionType(), GlobalValue::ExternalLinkage, F->getName(), CM);
+    VMap[F] = CF;
+    Function::arg_iterator CA = CF->arg_begin();
+    for (Function::arg_iterator A = F->arg_begin(); A != F->arg_end(); ++A, ++CA) {
+        CA->setName(A->getName());
+        VMap[A] = CA;
+    }
+    CloneFunctionInto(CF, F, VMap, false, Returns);
+
+    /* The pass strips all the debug info from the module in the end anyway. */
+    for (inst_iterator I = inst_begin(CF), E = inst_end(CF); I != E;) {
+        Instruction *inst = &*I++;
+        if (isa<DbgInfoIntrinsic>(inst))
+            inst->eraseFromParent();
+        else
+            inst->setDebugLoc(DebugLoc());
+    }
+    for (Module::iterator it = CM->begin(); it != CM->end();) {
+        Function *decl = it++;
+        if (decl != CF && decl->use_empty())
+            decl->eraseFromParent();
+    }
+
+    return CM;
+}
+
+std::string FunctionCache::getKey(Function *F, const std::string &extra)
+{
+    Module *CM = extractFunction(F);
+    if (!CM)
+        return "";
+
+    std::string keyString;
+    raw_string_ostream os(keyString);
+    os << FUNCTION_CACHE_MAGIC << " " << FUNCTION_CACHE_VERSION << "\n" << config << "\n" << extra << "\n" << *CM;
+    delete CM;
+
+    /* The map file records the debug locations, which the copy lacks. */
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+        if (MDNode *N = I->getMetadata("dbg")) {
+            DILocation Loc(N);
+            os << Loc.getFilename() << ":" << Loc.getLineNumber() << "\n";
+        }
+        else {
+            os << "-\n";
+        }
+    }
+    os.flush();
+
+    MD5 hash;
+    MD5::MD5Result result;
+    SmallString<32> key;
+    hash.update(keyString);
+    hash.final(result);
+    MD5::stringifyResult(result, key);
+
+    return key.str();
+}
+
+bool FunctionCache::loadEntry(const std::string &path, FunctionCacheEntry &entry)
+{
+    std::ifstream in(path.c_str());
+    std::string magic, line;
+    int version;
+    unsigned long numBBs, numStats, numEvents;
+
+    if (!(in >> magic >> version) || magic.compare(FUNCTION_CACHE_MAGIC) || version != FUNCTION_CACHE_VERSION)
+        return false;
+    if (!(in >> entry.firstBBIndex >> numBBs >> numStats))
+        return false;
+    entry.bbStats.assign(numBBs, std::vector<unsigned long>(numStats));
+    for (unsigned long i=0;i<numBBs;i++) {
+        for (unsigned long j=0;j<numStats;j++) {
+            if (!(in >> entry.bbStats[i][j]))
+                return false;
+        }
+    }
+    if (!(in >> numEvents))
+        return false;
+    entry.mapEvents.resize(numEvents);
+    for (unsigned long i=0;i<numEvents;i++) {
+        mapfile_event_t &event = entry.mapEvents[i];
+        int type;
+        /* type, line number and the name on the rest of the line */
+        if (!(in >> type >> event.line) || in.get() != ' ' || !std::getline(in, event.name))
+            return false;
+        event.type = type;
+    }
+
+    return true;
+}
+
+bool FunctionCache::storeEntry(const std::string &path, const FunctionCacheEntry &entry)
+{
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::trunc);
+    unsigned long numStats = entry.bbStats.empty() ? 0 : entry.bbStats[0].size();
+
+    out << FUNCTION_CACHE_MAGIC << " " << FUNCTION_CACHE_VERSION << "\n";
+    out << entry.firstBBIndex << " " << entry.bbStats.size() << " " << numStats << "\n";
+    for (unsigned long i=0;i<entry.bbStats.size();i++) {
+        for (unsigned long j=0;j<numStats;j++)
+            out << (j ? " " : "") << entry.bbStats[i][j];
+        out << "\n";
+    }
+    out << entry.mapEvents.size() << "\n";
+    for (unsigned long i=0;i<entry.mapEvents.size();i++) {
+        const mapfile_event_t &event = entry.mapEvents[i];
+        out << (int) event.type << " " << event.line << " " << event.name << "\n";
+    }
+    out.close();
+
+    return !out.fail();
+}
+
+bool FunctionCache::load(Function *F, const std::string &key, FunctionCacheEntry &entry)
+{
+    std::string path = dir + "/" + key;
+    SMDiagnostic err;
+
+    /* One corrupted clone per original basic block. */
+    if (!loadEntry(path + ".meta", entry) || entry.bbStats.size() != F->size())
+        return false;
+#if LLVM_VERSION >= 36
+    Module *CM = parseIRFile(path + ".bc", err, M.getContext()).release();
+#else
+    Module *CM = ParseIRFile(path + ".bc", err, M.getContext());
+#endif
+    if (!CM)
+        return false;
+
+    FunctionCacheTypeMapper typeMapper(M);
+    ValueToValueMapTy VMap;
+    SmallVector<ReturnInst*, 8> Returns;
+    Function *CF = CM->getFunction(F->getName());
+    bool valid = CF && !CF->isDeclaration() && typeMapper.mapType(CF->getType()) == F->getType();
+
+    /* Everything the cached function references must still be there. */
+    for (Module::iterator it = CM->begin(); valid && it != CM->end(); ++it) {
+        Function *decl = it;
+        if (decl == CF)
+            continue;
+        GlobalValue *GV = M.getNamedValue(decl->getName());
+        valid = GV && isa<Function>(GV) && typeMapper.mapType(decl->getType()) == GV->getType();
+        VMap[decl] = GV;
+    }
+    for (Module::global_iterator it = CM->global_begin(); valid && it != CM->global_end(); ++it) {
+        GlobalVariable *decl = it;
+        GlobalValue *GV = M.getNamedValue(decl->getName());
+        valid = GV && isa<GlobalVariable>(GV) && typeMapper.mapType(decl->getType()) == GV->getType();
+        VMap[decl] = GV;
+    }
+    for (inst_iterator I = inst_begin(CF), E = inst_end(CF); valid && I != E; ++I) {
+        std::vector<Value*> values(1, &*I);
+        while (!values.empty()) {
+            Value *V = values.back();
+            values.pop_back();
+            typeMapper.remapType(V->getType());
+            if (isa<Instruction>(V) || (isa<Constant>(V) && !isa<GlobalValue>(V))) {
+                User *U = cast<User>(V);
+                for (unsigned i=0;i<U->getNumOperands();i++) {
+                    if (V == &*I || isa<Constant>(U->getOperand(i)))
+                        values.push_back(U->getOperand(i));
+                }
+            }
+        }
+        valid = !typeMapper.failed;
+    }
+
+    if (valid) {
+        GlobalValue::LinkageTypes linkage = F->getLinkage();
+        F->deleteBody();
+        F->setLinkage(linkage);
+        VMap[CF] = F;
+        Function::arg_iterator A = F->arg_begin();
+        for (Function::arg_iterator CA = CF->arg_begin(); CA != CF->arg_end(); ++CA, ++A)
+            VMap[CA] = A;
+        CloneFunctionInto(F, CF, VMap, true, Returns, "", NULL, &typeMapper);
+    }
+    delete CM;
+
+    return valid;
+}
+
+void FunctionCache::store(Function *F, const std::string &key, const FunctionCacheEntry &entry)
+{
+    std::string path = dir + "/" + key;
+    std::ostringstream suffix;
+    suffix << ".tmp." << getpid();
+
+    Module *CM = extractFunction(F);
+    if (!CM)
+        return;
+
+    /* Write to temporaries and rename, concurrent builds may share the cache. */
+    int fd = open((path + ".bc" + suffix.str()).c_str(), O_CREAT|O_WRONLY|O_TRUNC, 0644);
+    if (fd >= 0) {
+        raw_fd_ostream file(fd, true);
+        WriteBitcodeToFile(CM, file);
+        file.close();
+        if (!file.has_error() && storeEntry(path + ".meta" + suffix.str(), entry)) {
+            rename((path + ".bc" + suffix.str()).c_str(), (path + ".bc").c_str());
+            rename((path + ".meta" + suffix.str()).c_str(), (path + ".meta").c_str());
+        }
+        else {
+            file.clear_error();
+        }
+    }
+    unlink((path + ".bc" + suffix.str()).c_str());
+    unlink((path + ".meta" + suffix.str()).c_str());
+    delete CM;
+}
+
+}
@@ -0,0 +1,48 @@
+#ifndef FUNCTION_CACHE_H
+#define FUNCTION_CACHE_H
+
+#include <pass.h>
+
+#include "MapFile.h"
+
+using namespace llvm;
+
+namespace llvm {
+
+/* Results of instrumenting a function that live outside its body. */
+struct FunctionCacheEntry {
+    int firstBBIndex;
+    /* per basic block: total faults injected, then injected/candidates per fault type */
+    std::vector<std::vector<unsigned long> > bbStats;
+    std::vector<mapfile_event_t> mapEvents;
+};
+
+/*
+ * On-disk cache of instrumented functions, keyed on the function's IR
+ * (without debug metadata, but with the debug locations) and on the
+ * configuration of the pass. Each entry is a bitcode module holding the
+ * instrumented function and declarations of the globals it references,
+ * plus a text file with the FunctionCacheEntry.
+ */
+class FunctionCache {
+
+  public:
+      FunctionCache(Module &M, const std::string &dir, const std::string &config);
+
+      std::string getKey(Function *F, const std::string &extra);
+      bool load(Function *F, const std::string &key, FunctionCacheEntry &entry);
+      void store(Function *F, const std::string &key, const FunctionCacheEntry &entry);
+
+  private:
+      Module &M;
+      std::string dir;
+      std::string config;
+
+      Module *extractFunction(Function *F);
+      bool loadEntry(const std::string &path, FunctionCacheEntry &entry);
+      bool storeEntry(const std::string &path, const FunctionCacheEntry &entry);
+};
+
+}
+
+#endif
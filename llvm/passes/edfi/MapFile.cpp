@@ -12,6 +12,7 @@
 MapFile::MapFile(const std::string &path, const std::string &moduleName)
 {
 	stringRefNext = 0;
+	events = NULL;
 	file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
 	writeModuleName(moduleName);
 }
@@ -57,14 +58,46 @@ void MapFile::writeStringRef(mapfile_stringref_t stringRef)
 	writeInt(stringRef);
 }
 
+void MapFile::recordEvent(char type, const std::string &name, mapfile_lineno_t line)
+{
+	mapfile_event_t event;
+
+	if (!events) return;
+	event.type = type;
+	event.line = line;
+	event.name = name;
+	events->push_back(event);
+}
+
+void MapFile::record(std::vector<mapfile_event_t> *events)
+{
+	this->events = events;
+}
+
+void MapFile::replay(const std::vector<mapfile_event_t> &events)
+{
+	for (size_t i = 0; i < events.size(); i++) {
+		const mapfile_event_t &event = events[i];
+		switch (event.type) {
+		case MAPFILE_BASIC_BLOCK: writeBasicBlock(); break;
+		case MAPFILE_INSTRUCTION: writeInstruction(); break;
+		case MAPFILE_DINSTRUCTION: writeDInstruction(event.name, event.line); break;
+		case MAPFILE_FAULT_CANDIDATE: writeFaultCandidate(event.name); break;
+		case MAPFILE_FAULT_INJECTED: writeFaultInjected(event.name); break;
+		}
+	}
+}
+
 void MapFile::writeBasicBlock(void)
 {
+	recordEvent(MAPFILE_BASIC_BLOCK, "", 0);
 	file.put(MAPFILE_BASIC_BLOCK);
 }
 
 void MapFile::writeDInstruction(const std::string &path, mapfile_lineno_t line)
 {
 	mapfile_stringref_t stringRef = getStringRef(path);
+	recordEvent(MAPFILE_DINSTRUCTION, path, line);
 	file.put(MAPFILE_DINSTRUCTION);
 	writeStringRef(stringRef);
 	writeInt(line);
@@ -73,6 +106,7 @@ void MapFile::writeDInstruction(const std::string &path, mapfile_lineno_t line)
 void MapFile::writeFaultCandidate(const std::string &name)
 {
 	mapfile_stringref_t stringRef = getStringRef(name);
+	recordEvent(MAPFILE_FAULT_CANDIDATE, name, 0);
 	file.put(MAPFILE_FAULT_CANDIDATE);
 	writeStringRef(stringRef);
 }
@@ -80,6 +114,7 @@ void MapFile::writeFaultCandidate(const std::string &name)
 void MapFile::writeFaultInjected(const std::string &name)
 {
 	mapfile_stringref_t stringRef = getStringRef(name);
+	recordEvent(MAPFILE_FAULT_INJECTED, name, 0);
 	file.put(MAPFILE_FAULT_INJECTED);
 	writeStringRef(stringRef);
 }
@@ -95,5 +130,6 @@ void MapFile::writeFunction(const std::string &name, const std::string &relPath)
 
 void MapFile::writeInstruction(void)
 {
+	recordEvent(MAPFILE_INSTRUCTION, "", 0);
 	file.put(MAPFILE_INSTRUCTION);
 }
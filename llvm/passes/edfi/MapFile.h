@@ -2,17 +2,27 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <vector>
 
 #include <stdint.h>
 
 typedef unsigned mapfile_lineno_t;
 typedef unsigned mapfile_stringref_t;
 
+/* A per-function record of the entries written, to replay cached functions. */
+struct mapfile_event_t {
+	char type;
+	mapfile_lineno_t line;
+	std::string name;
+};
+
 class MapFile {
 	private:
 		std::ofstream file;
 		std::map<std::string, mapfile_stringref_t> strings;
 		mapfile_stringref_t stringRefNext;
+		std::vector<mapfile_event_t> *events;
+		void recordEvent(char type, const std::string &name, mapfile_lineno_t line);
 		mapfile_stringref_t getStringRef(const std::string &s);
 		void writeInt(unsigned long value);
 		void writeModuleName(const std::string &name);
@@ -26,5 +36,7 @@ class MapFile {
 		void writeFaultInjected(const std::string &name);
 		void writeFunction(const std::string &name, const std::string &relPath);
 		void writeInstruction(void);
+		void record(std::vector<mapfile_event_t> *events);
+		void replay(const std::vector<mapfile_event_t> &events);
 };
 
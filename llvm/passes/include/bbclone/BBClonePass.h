@@ -6,6 +6,8 @@
 #include <pass.h>
 
 #include <common/dsa_common.h>
+#include <algorithm>
+#include <fstream>
 
 #define BBCLONE_CLONE1_HOOK      "inc_counter_inwindow"
 #define BBCLONE_CLONE2_HOOK      "inc_counter_outsidewindow"
@@ -37,11 +39,22 @@ class BBClonePass : public ModulePass {
       std::vector<std::pair<Regex*, Regex*> > regexList;
 
       Function *hookClone1, *hookClone2;
+      std::map<Function*, std::pair<Function*, Function*> > cloneMap;
+      std::vector<Function*> clonedFunctions;   /* cloneMap keys, in module order */
+      std::set<const Function*> flagChangingFunctions;
+      bool flagChangedByUnknownCalls, flagChangedByExternalCalls;
 
       void moduleInit(Module &M);
       void getSkipFunctions();
       void cloneFunctions();
+      void loadProfile(std::map<std::string, uint64_t> &profile);
+      uint64_t getFunctionSize(Function *F);
+      void applySizeBudget(std::vector<Function*> &functions, std::vector<std::pair<std::string, std::string> > &sections);
+      void layoutClones();
       void inlineLoops();
+      void getFlagChangingFunctions();
+      bool mayChangeFlag(Instruction *I);
+      void stickyCalls();
       bool isCloneCandidate(Function *F, std::string &clone1SectionName, std::string &clone2SectionName);
       bool isCloneCandidateFromRegexes(Function *F, std::pair<Regex*, Regex*> regexes);
       bool parseStringTwoKeyMapOpt(std::map<std::pair<std::string, std::string>, std::pair<std::string, std::string> > &map, std::vector<std::pair<std::string, std::string> > &keyList, std::vector<std::string> &stringList);
@@ -40,6 +40,10 @@ namespace llvm {
 			Function *memcpyHook;
 			Function *topOfTheLoopHook;
 			std::vector<GlobalVariable*> globalVariables;
+			/* Store profile: sites to count, sites to inline the hook at. */
+			bool profileSites;
+			std::vector<Instruction *> profiledSites;
+			std::set<Instruction *> inlineSites;
 			bool isInLtckptSection(Function *f);
 			void instrumentStore(Instruction *inst);
 			void instrumentMemIntrinsic(Instruction *inst);
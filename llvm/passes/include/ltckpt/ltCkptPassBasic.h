@@ -2,6 +2,8 @@
 #define LTCKPT_LTCKPT_PASS_BASIC 1
 #include "ltckpt/ltCkptPass.h"
 
+#include <llvm/ADT/StringSet.h>
+
 #if LLVM_HAS_DSA
 #include <dsa/DataStructure.h>
 #include <dsa/DSGraph.h>
@@ -9,6 +11,37 @@
 
 using namespace llvm;
 namespace llvm {
+		/* Per-function counters for -ltckpt_report. */
+		struct LtCkptFunctionReport {
+			unsigned stores;
+			unsigned storesInstrumented;
+			unsigned storesSkippedAlloca;
+			unsigned storesSkippedShortLived;
+			unsigned storesSkippedNonEscaping;
+			unsigned doubleStoresEliminated;
+			unsigned structStoresEliminated;
+			unsigned memIntrinsics;
+			unsigned memIntrinsicsInstrumented;
+			unsigned memIntrinsicsSkipped;
+			unsigned hotSites;
+			unsigned storesHoisted;
+			uint64_t cost;
+			LtCkptFunctionReport() : stores(0), storesInstrumented(0),
+				storesSkippedAlloca(0), storesSkippedShortLived(0),
+				storesSkippedNonEscaping(0), doubleStoresEliminated(0),
+				structStoresEliminated(0), memIntrinsics(0),
+				memIntrinsicsInstrumented(0), memIntrinsicsSkipped(0),
+				hotSites(0), storesHoisted(0), cost(0) {}
+		};
+
+		/* Stores to one object folded into a single instrumentRange(). */
+		struct LtCkptStoreRange {
+			Value *ptr;
+			APInt min;
+			APInt max;
+			Instruction *dominator;
+		};
+
 		class LtCkptPassBasic: public LtCkptPass
 		{
 			public:
@@ -24,11 +57,55 @@ namespace llvm {
 				bool doubleCheckStore(StoreInst *inst);
 				bool virtual storeToBeInstrumented(Instruction *inst);
 				virtual bool onFunction(Function &F);
+
+				/*
+				 * The per-function analysis (candidate selection, double and
+				 * struct store elimination, cost estimate) runs for all
+				 * functions up front, in parallel, on a dominator tree local
+				 * to each worker (storeToBeInstrumented() and
+				 * memIntrinsicToBeInstrumented() must only read the IR); IR
+				 * changes happen in onFunction().
+				 */
+				StringSet<> tolFunctions;
+				std::map<Function *, std::set<Instruction *> > candidates;
+				std::map<Function *, std::vector<LtCkptStoreRange> > storeRanges;
+				bool skipFunction(Function &F);
+				void selectCandidates(Function &F, std::set<Instruction *> *referencingInstructions);
+				void analyzeFunction(Function &F, DominatorTree *DT,
+				                     std::set<Instruction *> *referencingInstructions,
+				                     std::vector<LtCkptStoreRange> *ranges);
+				void analyzeAllFunctions(Module &M);
 				virtual bool memIntrinsicToBeInstrumented(Instruction *inst);
-				void eliminateDoubleStores(std::set<Instruction *> *il, Function *F);
+				void eliminateDoubleStores(std::set<Instruction *> *il, Function *F,
+				                           DominatorTree *DT);
 				void aggregateStores(std::set<Instruction *> *il,
-				                     std::set<Value *> *oMap,
-														 Function *F);
+				                     std::vector<LtCkptStoreRange> *ranges,
+				                     Function *F, DominatorTree *DT);
+
+				/* Short lived objects (see findShortLivedObjects()). */
+				std::set<Function *> liveAtCheckpoint;
+				std::set<const Value *> shortLivedObjects;
+				std::map<const Argument *, bool> capturedArguments;
+				std::map<Function *, LtCkptFunctionReport> functionReports;
+				void findLiveAtCheckpoint(Module &M);
+				void findShortLivedObjects(Module &M);
+				bool pointerCaptured(const Value *V, std::set<const Value *> *visited);
+				bool argumentCaptured(const Argument *A);
+				bool pointsToShortLivedObject(const Value *V);
+				void printShortLivedSavings();
+
+				/* Store profile (see ltckpt/storeprof.h). */
+				std::map<Instruction *, uint64_t> storeSites;
+				std::vector<uint64_t> storeSiteCounts;
+				uint64_t storeSitesHash;
+				void numberStoreSites(Module &M);
+				void loadStoreProfile();
+				void emitStoreProfile(Module &M);
+				void hoistLoopRanges(Function &F, std::set<Instruction *> *referencingInstructions);
+
+				uint64_t estimateCost(Function &F, std::set<Instruction *> *referencingInstructions,
+				                      DominatorTree *DT);
+				void writeReport();
 		};
 };
 
@@ -88,9 +88,11 @@ void LtCkptPass::instrumentStore(Instruction *inst)
 
 	CallInst *callInst = PassUtil::createCallInstruction(storeInstHook, args,"",inst);
 
+	if (profileSites)
+		profiledSites.push_back(inst);
 	callInst->setCallingConv(CallingConv::Fast);
 		callInst->setIsNoInline();
-	if(ltckpt_inline) {
+	if(ltckpt_inline || inlineSites.count(inst)) {
 #if LLVM_VERSION >= 37
 		InlineFunctionInfo inlineFunctionInfo = InlineFunctionInfo(NULL);
 #else
@@ -195,6 +197,8 @@ void LtCkptPass::instrumentMemIntrinsic(Instruction *inst)
 	ltckptPassLog(rso.str() << "\n");
 
 	CallInst *callInst = PassUtil::createCallInstruction(memcpyHook,args,"",inst);
+	if (profileSites)
+		profiledSites.push_back(inst);
 	callInst->setCallingConv(CallingConv::Fast);
 		callInst->setIsNoInline();
 #if 0
@@ -231,7 +235,7 @@ bool LtCkptPass::instrumentConfSetup(Function &F)
 	return true;
 }
 
-LtCkptPass::LtCkptPass() : ModulePass(ID) {}
+LtCkptPass::LtCkptPass() : ModulePass(ID), profileSites(false) {}
 
 
 void LtCkptPass::getAnalysisUsage(AnalysisUsage &AU) const
@@ -8,6 +8,15 @@
 #include <llvm/Analysis/Dominators.h>
 #endif
 #include <llvm/Analysis/MemoryBuiltins.h>
+#include <llvm/Analysis/ScalarEvolutionExpander.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/IR/TypeFinder.h>
+#include <llvm/Support/Timer.h>
+#include <ltckpt/storeprof.h>
+
+#include <atomic>
+#include <fstream>
+#include <thread>
 
 
 
@@ -28,6 +37,13 @@ STATISTIC(NumGlobalMemIntr,    "Number of MemIntrinsics to Globals");
 STATISTIC(NumSkippedNonEscapingStores,  "Number of stores to short lived objects");
 STATISTIC(numberofStructStoresInstrumented,  "Number of struct stores instrumentated");
 STATISTIC(NumStructStoresEliminated,  "Number of struct stores eliminated");
+STATISTIC(NumShortLivedObjects,  "Number of objects dead before the next checkpoint");
+STATISTIC(NumSkippedShortLivedStores,  "Number of Stores to short lived objects Skipped");
+STATISTIC(NumSkippedShortLivedMemIntr,  "Number of MemIntrinsics to short lived objects Skipped");
+STATISTIC(NumProfiledSites,  "Number of Stores and MemIntrinsics profiled");
+STATISTIC(NumHotSites,  "Number of hot Stores (hook inlined)");
+STATISTIC(NumColdSites,  "Number of Stores never executed in the profile");
+STATISTIC(NumHoistedStores,  "Number of Stores hoisted out of loops as a range");
 
 
 
@@ -82,7 +98,7 @@ public:
     dcl->push_back(dc);
   }
 
-  void dump(std::set<Instruction *> *toDelSet, LtCkptPass * p) {
+  void dump(std::set<Instruction *> *toDelSet, std::vector<LtCkptStoreRange> *ranges) {
     DominationChainListTy *dcl;
     DominationChainTy *dc;
     for (auto map_it = map->begin(); map_it!=map->end(); map_it++) {
@@ -90,7 +106,6 @@ public:
       for (auto it = dcl->begin(); it != dcl->end(); it++) {
         dc = *it;
         if (dc->size()>1) {
-            map_it->first->getType()->dump();
             auto dcit = dc->begin();
             APInt max,min;
             Instruction *dominator=dc->begin()->first;
@@ -101,8 +116,8 @@ public:
               min = min.getSExtValue() < dcit->second.getSExtValue() ? min : dcit->second;
               max = max.getSExtValue() > dcit->second.getSExtValue() ? max : dcit->second;
             }
-            numberofStructStoresInstrumented++;
-            p->instrumentRange(map_it->first, min, max, dominator);
+            LtCkptStoreRange range = { map_it->first, min, max, dominator };
+            ranges->push_back(range);
         }
       }
     }
@@ -119,6 +134,38 @@ cl::opt<bool> ltckptOptSkipAllocas("ltckpt_skip_alloca",
                                    cl::desc("Do not instrument stores to allocas"),
                                    cl::value_desc("Skip allocas"));
 
+cl::opt<bool> ltckptOptSkipShortLived("ltckpt_skip_short_lived",
+                                   cl::desc("Do not instrument stores to stack objects that die before the next checkpoint"),
+                                   cl::init(true));
+
+cl::opt<bool> ltckptOptShortLivedReport("ltckpt_short_lived_report",
+                                   cl::desc("Print the per-function short lived store savings"),
+                                   cl::value_desc("report"));
+
+cl::opt<bool> ltckptOptProfileGen("ltckpt_profile_gen",
+                                   cl::desc("Count the executions of every instrumented store (written to ltckpt.sprof.<pid>)"),
+                                   cl::value_desc("profile"));
+
+cl::opt<std::string> ltckptOptProfileUse("ltckpt_profile_use",
+                                   cl::desc("Colon-separated ltckpt.sprof files to guide store instrumentation"),
+                                   cl::value_desc("profiles"), cl::init(""));
+
+cl::opt<unsigned> ltckptOptProfileHotPercent("ltckpt_profile_hot_percent",
+                                   cl::desc("Inline the hooks of the hottest stores covering this percentage of the profiled stores"),
+                                   cl::init(90));
+
+cl::opt<bool> ltckptOptHoistRanges("ltckpt_hoist_ranges",
+                                   cl::desc("Replace the hooks of strided stores in loops by one range hook in the preheader"),
+                                   cl::value_desc("hoist"));
+
+cl::opt<unsigned> ltckptOptThreads("ltckpt_threads",
+                                   cl::desc("Number of threads selecting the stores to instrument (0: one per CPU)"),
+                                   cl::init(0));
+
+cl::opt<std::string> ltckptOptReport("ltckpt_report",
+                                   cl::desc("Write a per-function instrumentation report (CSV if the name ends in .csv, JSON otherwise)"),
+                                   cl::value_desc("file"), cl::init(""));
+
 cl::opt<bool> ltckptOptFullBUDS("ltckpt_use_fullBU",
                                    cl::desc("use full BUAnalysis"),
                                    cl::value_desc("BU"));
@@ -127,40 +174,30 @@ cl::opt<bool> ltckptOptAggrStrStr("ltckpt_aggregate_struct_stores",
                                    cl::desc("Aggregate Stores to Structs"),
                                    cl::value_desc("ASS"));
 
-bool LtCkptPassBasic::onFunction(Function &F) {
-
-	std::vector<std::string> tol_functions;
-
-	std::stringstream ss(TopOfLoopNames);
-	std::string item;
-	if (F.getName().equals(confSetupInitHook->getName())) {
-		instrumentConfSetup(F);
-	}
-
-	while(std::getline(ss, item, ':')) {
-		tol_functions.push_back(item);
-    }
+bool LtCkptPassBasic::skipFunction(Function &F) {
 	if (isInLtckptSection(&F)) {
-		return false;
+		return true;
 	}
 
 	if (F.getName().startswith("__libc"))
-		return false;
+		return true;
 
 	if (F.getName().startswith("dl"))
-		return false;
+		return true;
 
 	if (F.getName().equals("hypermem_read_impl") ||
 		F.getName().equals("hypermem_write_impl"))
-		return false;
+		return true;
 
-	for (unsigned int i = 0; i< tol_functions.size(); i++) {
-		if (F.getName().equals(tol_functions[i])) {
-			instrumentTopOfTheLoop(F);
-		}
-	}
-  std::set<Value *> oMap;
-	std::set<Instruction*> referencingInstructions;
+	return false;
+}
+
+/*
+ * Pick the stores and memory intrinsics to instrument. Only reads the IR,
+ * so it can run for many functions in parallel (see analyzeAllFunctions()).
+ */
+void LtCkptPassBasic::selectCandidates(Function &F, std::set<Instruction *> *referencingInstructions) {
+	LtCkptFunctionReport &report = functionReports[&F];
 
 	for (Function::iterator it = F.begin(); it != F.end(); ++it) {
 	  BasicBlock *bb = it;
@@ -173,26 +210,155 @@ bool LtCkptPassBasic::onFunction(Function &F) {
 
 			if (isa<StoreInst>(inst)) {
 				++NumStores;
+				++report.stores;
 				if (storeToBeInstrumented(inst)) {
-					referencingInstructions.insert(inst);
+					referencingInstructions->insert(inst);
 				}
 			} /* if... */
 
 			if (isa<MemIntrinsic>(inst)) {
 				++NumMemIntr;
+				++report.memIntrinsics;
 				if (memIntrinsicToBeInstrumented(inst)) {
 
-					referencingInstructions.insert(inst);
+					referencingInstructions->insert(inst);
+				} else {
+					++report.memIntrinsicsSkipped;
 				}
 			}
     } /* end for eachInst */
 	} /* end for each BB */
+}
 
+static void recalculateDomTree(DominatorTree *DT, Function &F)
+{
+#if LLVM_VERSION >= 37
+  DT->recalculate(F);
+#else
+  DT->getBase().recalculate(F);
+#endif
+}
 
-  eliminateDoubleStores(&referencingInstructions, &F);
+/*
+ * Everything onFunction() needs to know before touching the IR. DT must be
+ * private to the caller, getAnalysis() is not safe from the workers.
+ */
+void LtCkptPassBasic::analyzeFunction(Function &F, DominatorTree *DT,
+	std::set<Instruction *> *referencingInstructions,
+	std::vector<LtCkptStoreRange> *ranges) {
+  LtCkptFunctionReport &report = functionReports[&F];
+  size_t numCandidates;
+
+  selectCandidates(F, referencingInstructions);
+#if !LLVM_HAS_DSA
+  /* Nothing below needs DT (or does anything) then. */
+  if (!ltckptOptAggrStrStr && ltckptOptReport.empty())
+    return;
+#endif
+  recalculateDomTree(DT, F);
+  numCandidates = referencingInstructions->size();
+  eliminateDoubleStores(referencingInstructions, &F, DT);
+  report.doubleStoresEliminated += numCandidates - referencingInstructions->size();
+  numCandidates = referencingInstructions->size();
   /* this functions counts the number of objects we double store to */
   if(ltckptOptAggrStrStr)
-    aggregateStores(&referencingInstructions,&oMap, &F);
+    aggregateStores(referencingInstructions, ranges, &F, DT);
+  report.structStoresEliminated += numCandidates - referencingInstructions->size();
+  if (!ltckptOptReport.empty())
+    report.cost += estimateCost(F, referencingInstructions, DT);
+}
+
+void LtCkptPassBasic::analyzeAllFunctions(Module &M) {
+	std::vector<Function *> funcs;
+	std::vector<std::set<Instruction *> > results;
+	std::vector<std::vector<LtCkptStoreRange> > resultRanges;
+	std::vector<std::thread> workers;
+	std::atomic<unsigned> next(0);
+	unsigned numThreads = ltckptOptThreads;
+
+	for (Module::iterator it = M.begin(); it != M.end(); ++it) {
+		Function *F = it;
+		if (F->isDeclaration() || skipFunction(*F))
+			continue;
+		funcs.push_back(F);
+		/* No insertions into the map from the workers. */
+		functionReports[F];
+	}
+	results.resize(funcs.size());
+	resultRanges.resize(funcs.size());
+
+	if (!numThreads)
+		numThreads = std::thread::hardware_concurrency();
+#if LLVM_HAS_DSA
+	/* DSGraph lookups populate the graph's scalar map. */
+	numThreads = 1;
+#endif
+	/*
+	 * aggregateStores() folds GEP offsets, which fills DataLayout's struct
+	 * layout cache (and the types' sized flag) without locking. Fill both
+	 * for every struct in the module before the workers start.
+	 */
+	if (numThreads > 1 && ltckptOptAggrStrStr) {
+		TypeFinder structTypes;
+		structTypes.run(M, false);
+		for (TypeFinder::iterator it = structTypes.begin(); it != structTypes.end(); ++it) {
+			StructType *ST = *it;
+			if (!ST->isOpaque() && ST->isSized())
+				DL->getStructLayout(ST);
+		}
+	}
+	auto worker = [&]() {
+		DominatorTree DT;
+		unsigned i;
+		while ((i = next++) < funcs.size())
+			analyzeFunction(*funcs[i], &DT, &results[i], &resultRanges[i]);
+	};
+	for (unsigned i = 1; i < numThreads && i < funcs.size(); i++)
+		workers.push_back(std::thread(worker));
+	worker();
+	for (unsigned i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	for (unsigned i = 0; i < funcs.size(); i++) {
+		candidates[funcs[i]].swap(results[i]);
+		storeRanges[funcs[i]].swap(resultRanges[i]);
+	}
+}
+
+bool LtCkptPassBasic::onFunction(Function &F) {
+	if (F.getName().equals(confSetupInitHook->getName())) {
+		instrumentConfSetup(F);
+	}
+
+	if (skipFunction(F))
+		return false;
+
+	if (tolFunctions.count(F.getName())) {
+		instrumentTopOfTheLoop(F);
+	}
+	std::set<Instruction*> referencingInstructions;
+	std::vector<LtCkptStoreRange> ranges;
+	std::map<Function *, std::set<Instruction *> >::iterator cit = candidates.find(&F);
+
+	if (cit != candidates.end()) {
+		referencingInstructions.swap(cit->second);
+		candidates.erase(cit);
+		ranges.swap(storeRanges[&F]);
+		storeRanges.erase(&F);
+	} else {
+		DominatorTree DT;
+		analyzeFunction(F, &DT, &referencingInstructions, &ranges);
+	}
+
+  LtCkptFunctionReport &report = functionReports[&F];
+
+	for (auto it = ranges.begin(); it != ranges.end(); it++) {
+		numberofStructStoresInstrumented++;
+		instrumentRange(it->ptr, it->min, it->max, it->dominator);
+	}
+	/* Counting needs a hook at every site. */
+	if (ltckptOptHoistRanges && !profileSites)
+		hoistLoopRanges(F, &referencingInstructions);
 
 	for (auto it = referencingInstructions.begin();
 			it!=referencingInstructions.end();
@@ -203,10 +369,14 @@ bool LtCkptPassBasic::onFunction(Function &F) {
 		if (inst) {
 			if (isa<MemIntrinsic>(inst)) {
         ++NumInstMemIntr;
+        ++report.memIntrinsicsInstrumented;
 				instrumentMemIntrinsic(inst);
 			}
 			if (isa<StoreInst>(inst)) {
         ++NumInstStores;
+        ++report.storesInstrumented;
+        if (inlineSites.count(inst))
+          ++report.hotSites;
         instrumentStore(inst);
 			}
 		}
@@ -219,15 +389,11 @@ bool LtCkptPassBasic::onFunction(Function &F) {
 
 
 
-void LtCkptPassBasic::aggregateStores(std::set<Instruction *> *IL, std::set<Value *> *oMap, Function *F)
+void LtCkptPassBasic::aggregateStores(std::set<Instruction *> *IL,
+  std::vector<LtCkptStoreRange> *ranges, Function *F, DominatorTree *DT)
 {
   if (F->isDeclaration())
     return;
-#if LLVM_VERSION >= 37
-  DominatorTree *DT = &getAnalysis<DominatorTreeWrapperPass>(*F).getDomTree();
-#else
-  DominatorTree *DT = &getAnalysis<DominatorTree>(*F);
-#endif
   ObjectStoreDomationMap map(DT);
   for (std::set<Instruction*>::iterator it = IL->begin(); it!=IL->end(); it++)
   {
@@ -273,7 +439,7 @@ void LtCkptPassBasic::aggregateStores(std::set<Instruction *> *IL, std::set<Valu
     map.addStore(V, S, Offset);
   }
   std::set<Instruction *> toDelSet;
-  map.dump(&toDelSet, this);
+  map.dump(&toDelSet, ranges);
   for (auto it = toDelSet.begin(); it != toDelSet.end() ; it++) {
     if ((IL->find(const_cast<Instruction *>(*it)))!= IL->end()) {
       NumStructStoresEliminated++;
@@ -302,12 +468,12 @@ static void recusercheck(const StoreInst *S, const Value *V, std::set<const Inst
   }
 }
 
-void LtCkptPassBasic::eliminateDoubleStores(std::set<Instruction *> *IL, Function *F)
+void LtCkptPassBasic::eliminateDoubleStores(std::set<Instruction *> *IL, Function *F,
+  DominatorTree *DT)
 {
 #if LLVM_HAS_DSA
   if (F->isDeclaration())
     return;
-  DominatorTree *DT = &getAnalysis<DominatorTree>(*F);
 
   std::set<const Instruction *> DS;
 
@@ -354,6 +520,18 @@ void LtCkptPassBasic::getAnalysisUsage(AnalysisUsage &AU) const
     AU.addRequired<EquivBUDataStructures>();
 #endif
   LtCkptPass::getAnalysisUsage(AU);
+  if (ltckptOptHoistRanges) {
+#if LLVM_VERSION >= 38
+    AU.addRequired<ScalarEvolutionWrapperPass>();
+#else
+    AU.addRequired<ScalarEvolution>();
+#endif
+#if LLVM_VERSION >= 37
+    AU.addRequired<LoopInfoWrapperPass>();
+#else
+    AU.addRequired<LoopInfo>();
+#endif
+  }
 #if LLVM_VERSION >= 37
   AU.addPreserved<DominatorTreeWrapperPass>();
 #else
@@ -391,6 +569,11 @@ bool LtCkptPassBasic::memIntrinsicToBeInstrumented(Instruction *inst)
     }
   }
 
+  if (ltckptOptSkipShortLived && pointsToShortLivedObject(MI->getDest())) {
+    NumSkippedShortLivedMemIntr++;
+    return false;
+  }
+
 	/* so far we have to instrument every memintrinsic */
 	return true;
 }
@@ -418,7 +601,269 @@ bool LtCkptPassBasic::runOnModule(Module &M)
   else
     EQDS = &getAnalysis<EquivBUDataStructures>();
 #endif
-  return LtCkptPass::runOnModule(M);
+  std::stringstream ss(TopOfLoopNames);
+  std::string item;
+  bool mod;
+
+  while (std::getline(ss, item, ':'))
+    tolFunctions.insert(item);
+
+  if (ltckptOptSkipShortLived) {
+    findLiveAtCheckpoint(M);
+    findShortLivedObjects(M);
+  }
+  if (ltckptOptProfileGen || !ltckptOptProfileUse.empty()) {
+    numberStoreSites(M);
+    profileSites = ltckptOptProfileGen;
+    loadStoreProfile();
+  }
+  {
+    NamedRegionTimer T("Function analysis", "ltckpt", TimePassesIsEnabled);
+    analyzeAllFunctions(M);
+  }
+  {
+    NamedRegionTimer T("Instrumentation", "ltckpt", TimePassesIsEnabled);
+    mod = LtCkptPass::runOnModule(M);
+  }
+  if (ltckptOptProfileGen)
+    emitStoreProfile(M);
+  if (ltckptOptSkipShortLived && ltckptOptShortLivedReport)
+    printShortLivedSavings();
+  if (!ltckptOptReport.empty())
+    writeReport();
+
+  return mod;
+}
+
+/*
+ * Short lived objects.
+ *
+ * A checkpoint is taken at the entry of a top of the loop function, so the
+ * only frames live at a checkpoint are those of the functions that
+ * (transitively) call one. Any other function returns before the next
+ * checkpoint, and so do its allocas that never escape: after a rollback no
+ * code can reach them, and stores to them need no logging. Heap objects do
+ * not qualify even if they never escape: the allocator keeps its free-list
+ * metadata inside the freed chunk, and a rollback must restore it.
+ * Callbacks are accounted for conservatively: when a function live at a
+ * checkpoint has its address taken, any indirect call or call into external
+ * code may reach it.
+ */
+void LtCkptPassBasic::findLiveAtCheckpoint(Module &M)
+{
+  std::map<Function *, std::set<Function *> > callers;
+  std::set<Function *> unknownCallers;
+  std::vector<Function *> worklist;
+  bool addressTaken = false;
+
+  for (Module::iterator it = M.begin(); it != M.end(); ++it) {
+    Function *F = it;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+      CallSite CS = PassUtil::getCallSiteFromInstruction(&*I);
+      if (!CS.getInstruction() || isa<IntrinsicInst>(&*I))
+        continue;
+      Function *callee = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+      if (callee)
+        callers[callee].insert(F);
+      if ((!callee || callee->isDeclaration()) && !isa<InlineAsm>(CS.getCalledValue()))
+        unknownCallers.insert(F);
+    }
+  }
+
+  for (StringSet<>::iterator it = tolFunctions.begin(); it != tolFunctions.end(); ++it) {
+    Function *F = M.getFunction(it->getKey());
+    if (!F)
+      continue;
+    addressTaken |= F->hasAddressTaken();
+    worklist.insert(worklist.end(), callers[F].begin(), callers[F].end());
+  }
+  if (addressTaken)
+    worklist.insert(worklist.end(), unknownCallers.begin(), unknownCallers.end());
+
+  while (!worklist.empty()) {
+    Function *F = worklist.back();
+    worklist.pop_back();
+    if (!liveAtCheckpoint.insert(F).second)
+      continue;
+    worklist.insert(worklist.end(), callers[F].begin(), callers[F].end());
+    if (!addressTaken && F->hasAddressTaken()) {
+      addressTaken = true;
+      worklist.insert(worklist.end(), unknownCallers.begin(), unknownCallers.end());
+    }
+  }
+}
+
+/*
+ * Whether V (a pointer to an object) may outlive the current call: stored
+ * to memory, returned, converted to an integer or passed to a callee that
+ * may capture it. Loads, stores to the object, comparisons, memory
+ * intrinsics and free() do not capture the pointer.
+ */
+bool LtCkptPassBasic::pointerCaptured(const Value *V, std::set<const Value *> *visited)
+{
+  if (!visited->insert(V).second)
+    return false;
+
+#if LLVM_VERSION >= 37
+  for (Value::const_user_iterator ui = V->user_begin(); ui != V->user_end(); ui++) {
+#else
+  for (Value::const_use_iterator ui = V->use_begin(); ui != V->use_end(); ui++) {
+#endif
+    const User *U = *ui;
+
+    if (isa<LoadInst>(U) || isa<ICmpInst>(U) || isa<MemIntrinsic>(U))
+      continue;
+    if (const StoreInst *SI = dyn_cast<StoreInst>(U)) {
+      if (SI->getValueOperand() == V)
+        return true;
+      continue;
+    }
+    if (isa<GetElementPtrInst>(U) || isa<BitCastInst>(U)
+        || isa<PHINode>(U) || isa<SelectInst>(U)) {
+      if (pointerCaptured(U, visited))
+        return true;
+      continue;
+    }
+    if (const IntrinsicInst *II = dyn_cast<IntrinsicInst>(U)) {
+      if (II->getIntrinsicID() == Intrinsic::lifetime_start
+          || II->getIntrinsicID() == Intrinsic::lifetime_end
+          || II->getIntrinsicID() == Intrinsic::dbg_declare)
+        continue;
+      return true;
+    }
+    ImmutableCallSite CS(U);
+    if (CS.getInstruction()) {
+      const Function *callee = dyn_cast<Function>(CS.getCalledValue()->stripPointerCasts());
+      if (!callee || CS.getCalledValue() == V)
+        return true;
+      if (callee->getName().equals("free"))
+        continue;
+      if (callee->isDeclaration() || callee->isVarArg())
+        return true;
+      Function::const_arg_iterator AI = callee->arg_begin();
+      for (unsigned i = 0; i < CS.arg_size(); i++, AI++) {
+        if (CS.getArgument(i) == V && argumentCaptured(&*AI))
+          return true;
+      }
+      continue;
+    }
+    return true;
+  }
+
+  return false;
+}
+
+bool LtCkptPassBasic::argumentCaptured(const Argument *A)
+{
+  std::map<const Argument *, bool>::iterator it = capturedArguments.find(A);
+  std::set<const Value *> visited;
+  bool captured;
+
+  if (it != capturedArguments.end())
+    return it->second;
+  /* Assume the worst for recursive calls. */
+  capturedArguments[A] = true;
+  captured = pointerCaptured(A, &visited);
+  capturedArguments[A] = captured;
+
+  return captured;
+}
+
+/*
+ * V points into a short lived object if all the objects it may be derived
+ * from (through GEPs, casts, PHIs and selects) are.
+ */
+bool LtCkptPassBasic::pointsToShortLivedObject(const Value *V)
+{
+  std::set<const Value *> visited;
+  std::vector<const Value *> worklist(1, V);
+
+  while (!worklist.empty()) {
+    V = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(V).second)
+      continue;
+    V = V->stripPointerCasts();
+    if (const GEPOperator *GEP = dyn_cast<GEPOperator>(V)) {
+      worklist.push_back(GEP->getPointerOperand());
+    } else if (const PHINode *P = dyn_cast<PHINode>(V)) {
+      for (unsigned i = 0; i < P->getNumIncomingValues(); i++)
+        worklist.push_back(P->getIncomingValue(i));
+    } else if (const SelectInst *SI = dyn_cast<SelectInst>(V)) {
+      worklist.push_back(SI->getTrueValue());
+      worklist.push_back(SI->getFalseValue());
+    } else if (!shortLivedObjects.count(V)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void LtCkptPassBasic::findShortLivedObjects(Module &M)
+{
+  std::vector<const Argument *> arguments;
+  bool changed = true;
+
+  for (Module::iterator it = M.begin(); it != M.end(); ++it) {
+    Function *F = it;
+    if (liveAtCheckpoint.count(F))
+      continue;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+      std::set<const Value *> visited;
+      if (!isa<AllocaInst>(&*I))
+        continue;
+      if (!pointerCaptured(&*I, &visited)) {
+        shortLivedObjects.insert(&*I);
+        NumShortLivedObjects++;
+      }
+    }
+    /*
+     * Pointer arguments of functions only called directly, to be resolved
+     * once their callers are known.
+     */
+    if (F->isDeclaration() || !F->hasLocalLinkage() || F->hasAddressTaken())
+      continue;
+    for (Function::arg_iterator AI = F->arg_begin(); AI != F->arg_end(); ++AI) {
+      if (AI->getType()->isPointerTy())
+        arguments.push_back(&*AI);
+    }
+  }
+
+  /* An argument points into a short lived object if it does at all call sites. */
+  while (changed) {
+    changed = false;
+    for (unsigned i = 0; i < arguments.size(); i++) {
+      const Argument *A = arguments[i];
+      const Function *F = A->getParent();
+      bool shortLived = true;
+      if (shortLivedObjects.count(A))
+        continue;
+#if LLVM_VERSION >= 37
+      for (Value::const_user_iterator ui = F->user_begin(); ui != F->user_end() && shortLived; ui++) {
+#else
+      for (Value::const_use_iterator ui = F->use_begin(); ui != F->use_end() && shortLived; ui++) {
+#endif
+        ImmutableCallSite CS(*ui);
+        shortLived = CS.getInstruction()
+          && pointsToShortLivedObject(CS.getArgument(A->getArgNo()));
+      }
+      if (shortLived) {
+        shortLivedObjects.insert(A);
+        changed = true;
+      }
+    }
+  }
+}
+
+void LtCkptPassBasic::printShortLivedSavings()
+{
+  for (auto it = functionReports.begin(); it != functionReports.end(); it++) {
+    if (!it->second.storesSkippedShortLived)
+      continue;
+    errs() << "ltckpt: short lived stores: " << it->first->getName() << ": "
+           << it->second.storesSkippedShortLived << " of " << it->second.stores << " skipped\n";
+  }
 }
 
 bool LtCkptPassBasic::storeToBeInstrumented(Instruction *inst)
@@ -466,6 +911,7 @@ bool LtCkptPassBasic::storeToBeInstrumented(Instruction *inst)
       if (ltckptOptSkipAllocas) {
         NumSkippedAllocaStores++;
         NumSkippedAllocaPhiStores++;
+        ++functionReports[inst->getParent()->getParent()].storesSkippedAlloca;
         return false;
       }
     }
@@ -477,10 +923,17 @@ bool LtCkptPassBasic::storeToBeInstrumented(Instruction *inst)
   if (ltckptOptSkipAllocas) {
       if (isa<AllocaInst>(V)) {
         NumSkippedAllocaStores++;
+        ++functionReports[inst->getParent()->getParent()].storesSkippedAlloca;
         return false;
       }
   }
 
+  if (ltckptOptSkipShortLived && pointsToShortLivedObject(S->getPointerOperand())) {
+    NumSkippedShortLivedStores++;
+    ++functionReports[inst->getParent()->getParent()].storesSkippedShortLived;
+    return false;
+  }
+
 #if LLVM_HAS_DSA
   if (true) {
     DSGraph *dsg = EQDS->getDSGraph(*inst->getParent()->getParent());
@@ -495,6 +948,7 @@ bool LtCkptPassBasic::storeToBeInstrumented(Instruction *inst)
        && !dsn->isExternalNode()
        &&  dsn->isCompleteNode() ) {
       NumSkippedNonEscapingStores++;
+      ++functionReports[inst->getParent()->getParent()].storesSkippedNonEscaping;
       return false;
     }
   }
@@ -502,6 +956,387 @@ bool LtCkptPassBasic::storeToBeInstrumented(Instruction *inst)
   return true;
 }
 
+/*
+ * Store profile.
+ *
+ * Sites are numbered in module order before any instrumentation, so the
+ * profiling build and the final build agree as long as they start from the
+ * same bitcode (checked with a hash of the function names and site counts).
+ * The hottest sites get the store hook inlined, the others keep the
+ * out-of-line call.
+ */
+void LtCkptPassBasic::numberStoreSites(Module &M)
+{
+  uint64_t n = 0;
+
+  storeSitesHash = 14695981039346656037ULL;
+  for (Module::iterator it = M.begin(); it != M.end(); ++it) {
+    Function *F = it;
+    uint64_t first = n;
+    if (F->isDeclaration())
+      continue;
+    for (inst_iterator I = inst_begin(F), E = inst_end(F); I != E; ++I) {
+      if (isa<StoreInst>(&*I) || isa<MemIntrinsic>(&*I))
+        storeSites[&*I] = n++;
+    }
+    StringRef name = F->getName();
+    for (unsigned i = 0; i < name.size(); i++)
+      storeSitesHash = (storeSitesHash ^ (unsigned char) name[i]) * 1099511628211ULL;
+    storeSitesHash = (storeSitesHash ^ (n - first)) * 1099511628211ULL;
+  }
+}
+
+/* Hottest first, equally hot sites in site order (not pointer order). */
+static bool siteCountGreater(const std::pair<uint64_t, uint64_t> &a,
+  const std::pair<uint64_t, uint64_t> &b)
+{
+  if (a.first != b.first)
+    return a.first > b.first;
+  return a.second < b.second;
+}
+
+void LtCkptPassBasic::loadStoreProfile()
+{
+  std::vector<uint64_t> counts(storeSites.size(), 0);
+  std::vector<std::pair<uint64_t, uint64_t> > sites;
+  std::vector<Instruction *> siteInsts(storeSites.size());
+  std::stringstream ss(ltckptOptProfileUse);
+  std::string path;
+  uint64_t total = 0, acc = 0;
+  unsigned loaded = 0;
+
+  while (std::getline(ss, path, ':')) {
+    struct ltckpt_storeprof_header header;
+    std::vector<uint64_t> fileCounts(storeSites.size());
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) {
+      errs() << "ltckpt: cannot open store profile " << path << "\n";
+      continue;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1
+        || header.magic != LTCKPT_STOREPROF_MAGIC
+        || header.version != LTCKPT_STOREPROF_VERSION
+        || header.hash != storeSitesHash
+        || header.num_sites != storeSites.size()
+        || fread(fileCounts.data(), sizeof(uint64_t), fileCounts.size(), fp) != fileCounts.size()) {
+      errs() << "ltckpt: ignoring store profile " << path << " (not collected on this module)\n";
+      fclose(fp);
+      continue;
+    }
+    fclose(fp);
+    for (unsigned i = 0; i < counts.size(); i++)
+      counts[i] += fileCounts[i];
+    loaded++;
+  }
+  if (loaded)
+    storeSiteCounts = counts;
+
+  for (auto it = storeSites.begin(); it != storeSites.end(); it++) {
+    uint64_t count = counts[it->second];
+    siteInsts[it->second] = it->first;
+    if (!count) {
+      NumColdSites++;
+      continue;
+    }
+    sites.push_back(std::make_pair(count, it->second));
+    total += count;
+  }
+  if (!total)
+    return;
+  std::sort(sites.begin(), sites.end(), siteCountGreater);
+  for (unsigned i = 0; i < sites.size() && acc*100 < total*ltckptOptProfileHotPercent; i++) {
+    inlineSites.insert(siteInsts[sites[i].second]);
+    acc += sites[i].first;
+    NumHotSites++;
+  }
+}
+
+void LtCkptPassBasic::emitStoreProfile(Module &M)
+{
+  Type *I64 = Type::getInt64Ty(M.getContext());
+  ArrayType *AT = ArrayType::get(I64, storeSites.size());
+  Function *registerFunc = M.getFunction("ltckpt_storeprof_register");
+  std::vector<Value*> args(3);
+
+  if (!registerFunc) {
+    errs() << "ltckpt: ltckpt_storeprof_register not found, store profiling disabled\n";
+    return;
+  }
+  GlobalVariable *counts = new GlobalVariable(M, AT, false,
+    GlobalValue::InternalLinkage, ConstantAggregateZero::get(AT),
+    "ltckpt_storeprof_counts");
+
+  for (unsigned i = 0; i < profiledSites.size(); i++) {
+    Instruction *inst = profiledSites[i];
+    IRBuilder<> IRB(inst);
+    Value *ptr = IRB.CreateConstGEP2_64(counts, 0, storeSites[inst]);
+    Value *count = IRB.CreateLoad(ptr);
+    IRB.CreateStore(IRB.CreateAdd(count, ConstantInt::get(I64, 1)), ptr);
+    NumProfiledSites++;
+  }
+
+  /* Register the counters first thing in ltckpt_conf_setup(). */
+  BasicBlock *BB = confSetupInitHook->begin();
+  Instruction *I = BB->getFirstNonPHI();
+  args[0] = new BitCastInst(counts, PointerType::getUnqual(I64), "", I);
+  args[1] = ConstantInt::get(I64, storeSites.size());
+  args[2] = ConstantInt::get(I64, storeSitesHash);
+  PassUtil::createCallInstruction(registerFunc, args, "", I);
+}
+
+/*
+ * Range hoisting.
+ *
+ * A store whose address advances by a constant stride every iteration of
+ * its innermost loop writes a range that is known in the preheader:
+ * start + [0, trip count * stride + store size). One memcpy hook there
+ * then replaces a store hook per iteration. This only holds if:
+ *  - the latch is the loop's only exiting block and the store dominates
+ *    it, so the store runs once per iteration (a store that may run less
+ *    often could make the hook read memory the loop never touches);
+ *  - the loop calls nothing but memory and debug intrinsics, so no
+ *    checkpoint can happen between the hook and the stores;
+ *  - the trip count and the range are computable in the preheader.
+ * With a profile, stores never executed keep their (free) out-of-line
+ * hook. Hoisted stores still count in the report's cost.
+ */
+void LtCkptPassBasic::hoistLoopRanges(Function &F, std::set<Instruction *> *IL)
+{
+#if LLVM_VERSION >= 38
+  ScalarEvolution *SE = &getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+#else
+  ScalarEvolution *SE = &getAnalysis<ScalarEvolution>(F);
+#endif
+#if LLVM_VERSION >= 37
+  LoopInfo *LI = &getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+  DominatorTree *DT = &getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+  SCEVExpander expander(*SE, *DL, "ltckpt.range");
+#else
+  LoopInfo *LI = &getAnalysis<LoopInfo>(F);
+  DominatorTree *DT = &getAnalysis<DominatorTree>(F);
+  SCEVExpander expander(*SE, "ltckpt.range");
+#endif
+  Type *I8Ptr = Type::getInt8PtrTy(F.getContext());
+  Type *IntPtr = DL->getIntPtrType(F.getContext());
+  std::map<Loop *, bool> callFree;
+  std::vector<Instruction *> hoisted;
+  LtCkptFunctionReport &report = functionReports[&F];
+
+  for (auto it = IL->begin(); it != IL->end(); it++) {
+    if (!isa<StoreInst>(*it))
+      continue;
+    StoreInst *S = cast<StoreInst>(*it);
+    Loop *L = LI->getLoopFor(S->getParent());
+    if (!S->isSimple() || !L || !L->getLoopPreheader()
+        || L->getExitingBlock() != L->getLoopLatch()
+        || !DT->dominates(S->getParent(), L->getLoopLatch()))
+      continue;
+    if (!storeSiteCounts.empty()) {
+      std::map<Instruction *, uint64_t>::iterator sit = storeSites.find(S);
+      if (sit != storeSites.end() && !storeSiteCounts[sit->second])
+        continue;
+    }
+    if (!callFree.count(L)) {
+      bool noCalls = true;
+      for (Loop::block_iterator bi = L->block_begin(); bi != L->block_end() && noCalls; bi++) {
+        for (BasicBlock::iterator ii = (*bi)->begin(); ii != (*bi)->end(); ii++) {
+          Instruction *inst = ii;
+          if ((isa<CallInst>(inst) || isa<InvokeInst>(inst))
+              && !isa<MemIntrinsic>(inst) && !isa<DbgInfoIntrinsic>(inst)) {
+            noCalls = false;
+            break;
+          }
+        }
+      }
+      callFree[L] = noCalls;
+    }
+    if (!callFree[L])
+      continue;
+
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(S->getPointerOperand()));
+    if (!AR || AR->getLoop() != L || !AR->isAffine())
+      continue;
+    const SCEVConstant *step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(*SE));
+    const SCEV *backedges = SE->getBackedgeTakenCount(L);
+    uint64_t storeSize = DL->getTypeStoreSize(S->getValueOperand()->getType());
+    if (!step || isa<SCEVCouldNotCompute>(backedges))
+      continue;
+    int64_t stride = step->getValue()->getSExtValue();
+    uint64_t absStride = stride < 0 ? -(uint64_t) stride : stride;
+    /* Keep the range contiguous. */
+    if (!absStride || absStride > storeSize)
+      continue;
+
+    const SCEV *iterations = SE->getTruncateOrZeroExtend(backedges, IntPtr);
+    const SCEV *low = AR->getStart();
+    if (stride < 0)
+      low = SE->getAddExpr(low, SE->getMulExpr(iterations, step));
+    const SCEV *size = SE->getAddExpr(
+      SE->getMulExpr(iterations, SE->getConstant(IntPtr, absStride)),
+      SE->getConstant(IntPtr, storeSize));
+    if (!isSafeToExpand(low, *SE) || !isSafeToExpand(size, *SE))
+      continue;
+
+    Instruction *IP = L->getLoopPreheader()->getTerminator();
+    std::vector<Value*> args(2);
+    args[0] = expander.expandCodeFor(low, I8Ptr, IP);
+    args[1] = expander.expandCodeFor(size, IntPtr, IP);
+    CallInst *callInst = PassUtil::createCallInstruction(memcpyHook, args, "", IP);
+    callInst->setCallingConv(CallingConv::Fast);
+    callInst->setIsNoInline();
+    hoisted.push_back(S);
+  }
+
+  for (unsigned i = 0; i < hoisted.size(); i++) {
+    IL->erase(hoisted[i]);
+    NumHoistedStores++;
+    ++report.storesHoisted;
+  }
+}
+
+/*
+ * Instrumentation report.
+ *
+ * The cost of a function is the estimated number of hook invocations: the
+ * profiled execution count of each instrumented site with -ltckpt_profile_use,
+ * or 10^(loop depth) per site otherwise.
+ */
+uint64_t LtCkptPassBasic::estimateCost(Function &F, std::set<Instruction *> *referencingInstructions,
+  DominatorTree *DT)
+{
+  uint64_t cost = 0;
+
+  if (F.isDeclaration())
+    return 0;
+  if (!storeSiteCounts.empty()) {
+    for (auto it = referencingInstructions->begin(); it != referencingInstructions->end(); it++) {
+      std::map<Instruction *, uint64_t>::iterator sit = storeSites.find(*it);
+      if (sit != storeSites.end())
+        cost += storeSiteCounts[sit->second];
+    }
+    return cost;
+  }
+
+  /* Built on DT rather than requested, this runs from the workers. */
+  LoopInfoBase<BasicBlock, Loop> LI;
+#if LLVM_VERSION >= 38
+  LI.analyze(*DT);
+#elif LLVM_VERSION >= 37
+  LI.Analyze(*DT);
+#else
+  LI.Analyze(DT->getBase());
+#endif
+  for (auto it = referencingInstructions->begin(); it != referencingInstructions->end(); it++) {
+    uint64_t freq = 1;
+    for (unsigned depth = LI.getLoopDepth((*it)->getParent()); depth > 0; depth--)
+      freq *= 10;
+    cost += freq;
+  }
+
+  return cost;
+}
+
+static std::string jsonEscape(StringRef str)
+{
+  static const char hex[] = "0123456789abcdef";
+  std::string out;
+
+  for (unsigned i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if (c < 0x20) {
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+      continue;
+    }
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+/* A CSV field per RFC 4180: quoted, with embedded quotes doubled. */
+static std::string csvQuote(StringRef str)
+{
+  std::string out = "\"";
+
+  for (unsigned i = 0; i < str.size(); i++) {
+    if (str[i] == '"')
+      out += '"';
+    out += str[i];
+  }
+  return out + "\"";
+}
+
+static bool reportCostGreater(const std::pair<Function *, LtCkptFunctionReport> &a,
+  const std::pair<Function *, LtCkptFunctionReport> &b)
+{
+  if (a.second.cost != b.second.cost)
+    return a.second.cost > b.second.cost;
+  return a.first->getName() < b.first->getName();
+}
+
+/* Functions are listed from the most to the least expensive. */
+void LtCkptPassBasic::writeReport()
+{
+  std::ofstream out(ltckptOptReport.c_str());
+  bool csv = StringRef(ltckptOptReport).endswith(".csv");
+  const char *costSource = storeSiteCounts.empty() ? "static" : "profile";
+  std::vector<std::pair<Function *, LtCkptFunctionReport> > reports(
+    functionReports.begin(), functionReports.end());
+  bool first = true;
+
+  if (!out) {
+    errs() << "ltckpt: cannot write report " << ltckptOptReport << "\n";
+    return;
+  }
+  if (csv) {
+    out << "function,stores,stores_instrumented,stores_skipped_alloca,"
+        << "stores_skipped_short_lived,stores_skipped_non_escaping,"
+        << "double_stores_eliminated,struct_stores_eliminated,memintrinsics,"
+        << "memintrinsics_instrumented,memintrinsics_skipped,hot_sites,stores_hoisted,"
+        << "cost,cost_source\n";
+  } else {
+    out << "{\n  \"cost_source\": \"" << costSource << "\",\n  \"functions\": [";
+  }
+  std::sort(reports.begin(), reports.end(), reportCostGreater);
+  for (auto it = reports.begin(); it != reports.end(); it++) {
+    const LtCkptFunctionReport &r = it->second;
+    if (!r.stores && !r.memIntrinsics)
+      continue;
+    if (csv) {
+      out << csvQuote(it->first->getName()) << "," << r.stores << ","
+          << r.storesInstrumented << "," << r.storesSkippedAlloca << ","
+          << r.storesSkippedShortLived << "," << r.storesSkippedNonEscaping << ","
+          << r.doubleStoresEliminated << "," << r.structStoresEliminated << ","
+          << r.memIntrinsics << "," << r.memIntrinsicsInstrumented << ","
+          << r.memIntrinsicsSkipped << "," << r.hotSites << ","
+          << r.storesHoisted << "," << r.cost << ","
+          << costSource << "\n";
+      continue;
+    }
+    out << (first ? "\n" : ",\n") << "    { \"function\": \""
+        << jsonEscape(it->first->getName()) << "\""
+        << ", \"stores\": " << r.stores
+        << ", \"stores_instrumented\": " << r.storesInstrumented
+        << ", \"stores_skipped_alloca\": " << r.storesSkippedAlloca
+        << ", \"stores_skipped_short_lived\": " << r.storesSkippedShortLived
+        << ", \"stores_skipped_non_escaping\": " << r.storesSkippedNonEscaping
+        << ", \"double_stores_eliminated\": " << r.doubleStoresEliminated
+        << ", \"struct_stores_eliminated\": " << r.structStoresEliminated
+        << ", \"memintrinsics\": " << r.memIntrinsics
+        << ", \"memintrinsics_instrumented\": " << r.memIntrinsicsInstrumented
+        << ", \"memintrinsics_skipped\": " << r.memIntrinsicsSkipped
+        << ", \"hot_sites\": " << r.hotSites
+        << ", \"stores_hoisted\": " << r.storesHoisted
+        << ", \"cost\": " << r.cost << " }";
+    first = false;
+  }
+  if (!csv)
+    out << "\n  ]\n}\n";
+}
+
 LtCkptPassBasic::LtCkptPassBasic():LtCkptPass() {
 }
 
@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include <edfi/df/df.h>
@@ -25,6 +26,13 @@ int edfi_faultinjection_enabled = 1;
 int edfi_faultinjection_enabled;
 #endif
 int edfi_faultinjection_enabled_version;
+#if defined(EDFI_ENABLE_INJECTION_ON_START) || defined(EDFI_COUNT_ALL_BLOCKS)
+int edfi_onfdp_armed = 1;
+#else
+int edfi_onfdp_armed;
+#endif
+int edfi_onfdp_armed_bb;
+int edfi_onfdp_armed_fdp; /* set to 1 by the pass with -fault-armed-fdp */
 int edfi_inject_bb = -1;
 edfi_context_t edfi_context_buff = {
 	.canary_value1 = EDFI_CANARY_VALUE,
@@ -44,6 +52,108 @@ edfi_context_t *edfi_context = &edfi_context_buff;
 #define EDFI_ONFAULT_DEFAULT edfi_onfault_default
 #endif
 
+#ifdef EDFI_SHARDED_BB_COUNTERS
+/*
+ * Threads count basic block executions in private copies of
+ * bb_num_executions rather than in the shared array, which is only brought
+ * up to date by edfi_bb_counters_fold(). The first EDFI_BB_COUNTER_SHARDS
+ * threads to count get a shard each, which only they write, so counting
+ * needs no atomic operation. The fold adds what changed since the previous
+ * fold. Later threads count in the shared array directly, atomically. The
+ * shards are mapped up front (pages are only backed once a thread counts).
+ */
+#ifndef EDFI_BB_COUNTER_SHARDS
+#define EDFI_BB_COUNTER_SHARDS 16
+#endif
+#define EDFI_BB_COUNTER_ALIGN  64
+
+static exec_count *edfi_bb_counters[EDFI_BB_COUNTER_SHARDS];
+static exec_count *edfi_bb_counters_folded[EDFI_BB_COUNTER_SHARDS];
+static int edfi_bb_counters_next_shard;
+static volatile int edfi_bb_counters_folding;
+static __thread exec_count *edfi_bb_counters_shard;
+static __thread int edfi_bb_counters_claimed;
+
+static void __attribute__((constructor)) edfi_bb_counters_init()
+{
+    size_t size = ((edfi_context->num_bbs + 2) * sizeof(exec_count)
+        + EDFI_BB_COUNTER_ALIGN - 1) & ~(size_t) (EDFI_BB_COUNTER_ALIGN - 1);
+    char *area;
+    int shard;
+
+    if (!edfi_context->bb_num_executions || edfi_bb_counters[0]) {
+        return;
+    }
+    area = mmap(NULL, 2 * EDFI_BB_COUNTER_SHARDS * size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) {
+        return;
+    }
+    for (shard = 0; shard < EDFI_BB_COUNTER_SHARDS; shard++) {
+        edfi_bb_counters[shard] = (exec_count *) (area + shard * size);
+        edfi_bb_counters_folded[shard] = (exec_count *) (area + (EDFI_BB_COUNTER_SHARDS + shard) * size);
+    }
+}
+
+static exec_count *edfi_bb_counters_get_shard()
+{
+    int shard = __sync_fetch_and_add(&edfi_bb_counters_next_shard, 1);
+
+    if (shard >= EDFI_BB_COUNTER_SHARDS) {
+        return NULL;
+    }
+    return edfi_bb_counters[shard];
+}
+
+static inline void edfi_bb_count(int bb_index)
+{
+    exec_count *counters = edfi_bb_counters_shard;
+
+    if (!counters && !edfi_bb_counters_claimed) {
+        edfi_bb_counters_claimed = 1;
+        counters = edfi_bb_counters_shard = edfi_bb_counters_get_shard();
+    }
+    if (!counters) {
+        __sync_fetch_and_add(&edfi_context->bb_num_executions[bb_index], 1);
+        return;
+    }
+    /* A plain increment, the store is only atomic so the fold never reads it torn. */
+    __atomic_store_n(&counters[bb_index], counters[bb_index] + 1, __ATOMIC_RELAXED);
+}
+
+void edfi_bb_counters_fold()
+{
+    int shard, bb_index;
+    exec_count *counters, *folded, count;
+
+    if (!edfi_context->bb_num_executions) {
+        return;
+    }
+    while (__sync_lock_test_and_set(&edfi_bb_counters_folding, 1));
+    for (shard = 0; shard < EDFI_BB_COUNTER_SHARDS; shard++) {
+        counters = edfi_bb_counters[shard];
+        folded = edfi_bb_counters_folded[shard];
+        if (!counters) {
+            continue;
+        }
+        for (bb_index = 1; bb_index <= edfi_context->num_bbs; bb_index++) {
+            count = __atomic_load_n(&counters[bb_index], __ATOMIC_RELAXED);
+            if (count != folded[bb_index]) {
+                __sync_fetch_and_add(&edfi_context->bb_num_executions[bb_index], count - folded[bb_index]);
+                folded[bb_index] = count;
+            }
+        }
+    }
+    __sync_lock_release(&edfi_bb_counters_folding);
+}
+#else
+#define edfi_bb_count(bb_index) (edfi_context->bb_num_executions[bb_index]++)
+
+void edfi_bb_counters_fold()
+{
+}
+#endif
+
 /*TODO: must be volatile to ensure linkage? */
 edfi_onstart_t edfi_onstart_p = edfi_onstart_default;
 edfi_onfdp_t edfi_onfdp_p = EDFI_ONFDP_DEFAULT;
@@ -53,6 +163,47 @@ char* edfi_module_name = "NONE"; /* Set by the pass */
 
 /*TODO: cmdline swith fault injector: either test switch or callback */
 
+/*
+ * With -fault-armed-fdp, instrumented code skips the FDP callback while
+ * edfi_onfdp_armed is 0, skips it and decrements the word while it is
+ * greater than 1, and skips it for every basic block but
+ * edfi_onfdp_armed_bb if that is set. The cases in which the default
+ * callback is known to return 0 are folded into these words: injection
+ * disabled, max_faults exceeded, faulty_bb_index mismatches, no policy
+ * configured at all (e.g. fault_prob=0 with nothing else set) and the
+ * min_fdp_interval countdown. Other callbacks, or the default one counting
+ * block executions, are always called. Must be called whenever the context,
+ * edfi_faultinjection_enabled or edfi_onfdp_p changes.
+ */
+static int edfi_onfdp_armed_policy()
+{
+#ifdef EDFI_COUNT_ALL_BLOCKS
+    return 0;
+#else
+    return edfi_onfdp_p == edfi_onfdp_default;
+#endif
+}
+
+static int edfi_onfdp_max_faults_reached()
+{
+    return edfi_context->c.max_faults > 0 && edfi_context->total_faults > edfi_context->c.max_faults;
+}
+
+void edfi_onfdp_update_armed()
+{
+    if (!edfi_onfdp_armed_policy()) {
+        edfi_onfdp_armed_bb = 0;
+        edfi_onfdp_armed = 1;
+        return;
+    }
+    edfi_onfdp_armed_bb = edfi_context->c.faulty_bb_index > 0 ? edfi_context->c.faulty_bb_index : 0;
+    /* edfi_onfdp_default() needs at least one of these to return 1 */
+    edfi_onfdp_armed = edfi_faultinjection_enabled && !edfi_onfdp_max_faults_reached()
+        && (edfi_context->c.min_fdp_interval || edfi_context->c.min_fault_time_interval
+        || edfi_context->c.fault_prob_randmax || edfi_context->c.faulty_bb_index > 0
+        || edfi_context->c.max_time || edfi_context->c.max_faults);
+}
+
 void edfi_onstart_default(char *params){
     edfi_context->fault_fdp_count = edfi_context->c.min_fdp_interval;
     edfi_context->start_time = edfi_getcurrtime_ns();
@@ -117,6 +268,13 @@ int edfi_onfdp_bb_index(int bb_index)
 
 void edfi_onfdp_min_fdp_interval_update()
 {
+    if (edfi_onfdp_armed_fdp && edfi_onfdp_armed_policy() && edfi_onfdp_armed
+        && edfi_context->c.min_fdp_interval > 1) {
+        /* let the instrumented code count down the skipped FDPs */
+        edfi_context->fault_fdp_count = edfi_context->c.min_fdp_interval;
+        edfi_onfdp_armed = edfi_context->c.min_fdp_interval;
+        return;
+    }
     edfi_context->fault_fdp_count = 1;
 }
 
@@ -140,7 +298,7 @@ int edfi_onfdp_max_time()
 
 int edfi_onfdp_max_faults()
 {
-    if(edfi_context->c.max_faults > 0 && edfi_context->total_faults > edfi_context->c.max_faults){
+    if(edfi_onfdp_max_faults_reached()){
         return 0;
     }
     edfi_onfdp_count += edfi_context->c.max_faults;
@@ -151,7 +309,7 @@ int edfi_onfdp_default(int bb_index) {
 
 #ifdef EDFI_COUNT_ALL_BLOCKS
     /* first value is a canary, but bb_index is 1-based so no compensation needed */
-    edfi_context->bb_num_executions[bb_index]++;
+    edfi_bb_count(bb_index);
 #endif
 
     if(!edfi_faultinjection_enabled){
@@ -198,11 +356,14 @@ int edfi_onfdp_default(int bb_index) {
 void edfi_onfault_default(int bb_index){
 #ifndef EDFI_COUNT_ALL_BLOCKS
     /* first value is a canary, but bb_index is 1-based so no compensation needed */
-    edfi_context->bb_num_executions[bb_index]++;
+    edfi_bb_count(bb_index);
 #endif
 
     /* subtract 1 because bb_index is 1-based */
     edfi_context->total_faults += edfi_context->bb_num_faults[bb_index - 1];
+    if (edfi_onfdp_max_faults_reached()) {
+        edfi_onfdp_update_armed();
+    }
 }
 #else
 int bb_num_executions_fix=0;
@@ -225,6 +386,7 @@ int edfi_start(edfi_context_t *context, char *params) {
     }
     edfi_faultinjection_enabled = 1;
     edfi_faultinjection_enabled_version++;
+    edfi_onfdp_update_armed();
     (*edfi_onstart_p)(params);
     return 0;
 }
@@ -232,6 +394,8 @@ int edfi_start(edfi_context_t *context, char *params) {
 void edfi_stop() {
     edfi_faultinjection_enabled = 0;
     edfi_faultinjection_enabled_version++;
+    edfi_onfdp_update_armed();
+    edfi_bb_counters_fold();
     (*edfi_onstop_p)();
 }
 
@@ -461,6 +625,7 @@ void edfi_stats_per_bb_add(void) {
 	int fd;
 	const char *path;
 
+	edfi_bb_counters_fold();
 	if (!edfi_stats_available()) {
 		fprintf(stderr, "WARNING: no statistics collected\n");
 		return;
@@ -497,6 +662,7 @@ void edfi_print_stats(){
     unsigned int statistics_table_size, edfi_context_size, total_static_data_size;
     int i;
 
+    edfi_bb_counters_fold();
     statistics_table_size= edfi_context->num_bbs * sizeof(exec_count);
     for(i=0;i<edfi_context->num_fault_types;i++){
         statistics_table_size += strlen(edfi_context->fault_type_stats[i].name)+1
@@ -570,6 +736,7 @@ int edfi_update_context(edfi_context_t *new_context)
     }
 
     memcpy(&edfi_context->c, &new_context->c, sizeof(edfi_context_conf_t));
+    edfi_onfdp_update_armed();
     EDFI_PRINT_CONTEXT(edfi_printf, edfi_context);
 
     return 0;
@@ -132,6 +132,7 @@ static void edfi_ctl_context_init() {
 #else
     edfi_faultinjection_enabled = 0;
 #endif
+    edfi_onfdp_update_armed();
 }
 
 void edfi_ctl_init(){
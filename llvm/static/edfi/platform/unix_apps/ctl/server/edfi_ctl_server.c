@@ -20,6 +20,8 @@
 #include <signal.h>
 
 #include <edfi/ctl/server.h>
+#include <edfi/shmstats.h>
+#include <common/util/shmstats.h>
 
 #define EDFI_CONTEXT_RELOCATE_DEFAULT 1
 #ifndef EDFI_CONTEXT_RELOCATE
@@ -33,6 +35,12 @@ static volatile int edfi_ctl_num_completed_requests;
 static volatile int edfi_ctl_max_num_requests;
 static volatile int edfi_svr_thread_done;
 
+static util_shmem_seg_t edfi_shmstats_seg;
+static util_shmstats_hdr_t *edfi_shmstats_hdr = NULL;
+static pthread_t edfi_shmstats_thread;
+static volatile int edfi_shmstats_stop;
+static int edfi_shmstats_interval_ms;
+
 static void edfi_ctl_time_init(void);
 
 static void edfi_ctl_init();
@@ -187,6 +195,11 @@ static void edfi_fork_noop() {}
 static void edfi_fork_child()
 {
     EDFI_WRAPPER_BEGIN();
+    if (edfi_shmstats_hdr) {
+        /* The segment (and its thread) belong to the parent. */
+        util_shmstats_close(&edfi_shmstats_seg);
+        edfi_shmstats_hdr = NULL;
+    }
     edfi_ctl_close();
     edfi_ctl_init();
     EDFI_WRAPPER_END();
@@ -275,6 +288,83 @@ static char *parse_str_env_var(const char *env_name, char *default_value)
     return strdup(env_value_str);
 }
 
+static void edfi_shmstats_publish()
+{
+    extern int edfi_faultinjection_enabled;
+    edfi_shmstats_t *stats = UTIL_SHMSTATS_PAYLOAD(edfi_shmstats_hdr);
+    unsigned long long total = 0;
+    unsigned int i;
+
+    edfi_bb_counters_fold();
+    util_shmstats_write_begin(edfi_shmstats_hdr);
+    stats->total_faults = edfi_context->total_faults;
+    stats->fault_fdp_count = edfi_context->fault_fdp_count;
+    stats->faultinjection_enabled = edfi_faultinjection_enabled;
+    stats->num_fault_types = edfi_context->num_fault_types;
+    if (edfi_context->bb_num_executions) {
+        for (i = 0; i < stats->num_bbs; i++) {
+            stats->bb_num_executions[i] = edfi_context->bb_num_executions[i+1];
+            total += stats->bb_num_executions[i];
+        }
+    }
+    stats->total_bb_executions = total;
+    stats->num_updates++;
+    util_shmstats_write_end(edfi_shmstats_hdr);
+}
+
+static void *edfi_shmstats_srv(void *args)
+{
+    sigset_t set;
+
+    assert(sigfillset(&set) == 0);
+    assert(pthread_sigmask(SIG_SETMASK, &set, NULL) == 0);
+
+    while (!edfi_shmstats_stop) {
+        edfi_shmstats_publish();
+        usleep(edfi_shmstats_interval_ms*1000);
+    }
+
+    return NULL;
+}
+
+static void edfi_shmstats_init()
+{
+    edfi_shmstats_t *stats;
+
+    if (!parse_int_env_var("EDFI_SHMSTATS", 0)) {
+        return;
+    }
+    edfi_shmstats_interval_ms = parse_int_env_var("EDFI_SHMSTATS_INTERVAL_MS",
+        EDFI_SHMSTATS_INTERVAL_MS_DEFAULT);
+    edfi_shmstats_hdr = util_shmstats_create(&edfi_shmstats_seg,
+        EDFI_SHMSTATS_PREFIX, EDFI_SHMSTATS_SIZE(edfi_context->num_bbs),
+        EDFI_SHMSTATS_VERSION);
+    if (!edfi_shmstats_hdr) {
+        edfi_printf("edfi_shmstats_init: warning: unable to create %s: %s\n",
+            edfi_shmstats_seg.name, strerror(errno));
+        return;
+    }
+    stats = UTIL_SHMSTATS_PAYLOAD(edfi_shmstats_hdr);
+    stats->num_bbs = edfi_context->num_bbs;
+    edfi_shmstats_stop = 0;
+    if (pthread_create(&edfi_shmstats_thread, NULL, edfi_shmstats_srv, NULL)) {
+        util_shmstats_destroy(&edfi_shmstats_seg);
+        edfi_shmstats_hdr = NULL;
+    }
+}
+
+static void edfi_shmstats_close()
+{
+    if (!edfi_shmstats_hdr) {
+        return;
+    }
+    edfi_shmstats_stop = 1;
+    pthread_join(edfi_shmstats_thread, NULL);
+    edfi_shmstats_publish();
+    util_shmstats_destroy(&edfi_shmstats_seg);
+    edfi_shmstats_hdr = NULL;
+}
+
 static void edfi_ctl_context_init() {
     extern int edfi_faultinjection_enabled;
 #ifdef EDFI_DISABLE_CTL_SRV
@@ -295,6 +385,7 @@ static void edfi_ctl_context_init() {
 #else
     edfi_faultinjection_enabled = parse_int_env_var("EDFI_FI_ENABLED", 0);
 #endif
+    edfi_onfdp_update_armed();
     edfi_context->output_dir = parse_str_env_var("LOGDIR", EDFI_OUTPUT_DIR);
 
     if (edfi_context->verbosity > 0) {
@@ -338,6 +429,8 @@ static void edfi_ctl_init(){
 	edfi_context->bb_num_executions[edfi_context->num_bbs + 1] = EDFI_CANARY_VALUE;
     }
 
+    edfi_shmstats_init();
+
 #ifndef EDFI_DISABLE_CTL_SRV
     if(!edfi_context->no_svr_thread || edfi_context->num_requests_on_start > 0) {
         edfi_ctl_num_completed_requests = 0;
@@ -368,6 +461,7 @@ static void edfi_ctl_init(){
 }
 
 static void edfi_ctl_close(){
+    edfi_shmstats_close();
     close(edfi_server_fd);
     fclose(edfi_fp);
 }
@@ -4,17 +4,6 @@
 #include "ltckpt_debug.h"
 #include "ltckpt_recover.h"
 
-// #define uthash_malloc(sz) lt_malloc(sz)
-// #define uthash_free(ptr,sz) lt_free(ptr)
-
-#include <common/ut/uthash.h>
-
-/* sanity check of hash indexing of the stats entries.
- * makes it very slow. a check against internal bugs and
- * outside interference (e.g. proxfs writing on our indexing data).
- */
-#define HASH_SANITY 0
-
 /*
  * Hook used for aopify-style instrumentation. Sample instrumentation (instruments 50% function entries deterministically):
  * LLVMGOLD_OPTFLAGS_EXTRA="-aopify-prob=0.5 -aopify-rand-seed=1 -aopify-start-hook-map=(^\$)|(^[^l].*\$)|(^l[^t].*\$)/^.*$/ltckpt_aop_hook -tol=main -inline -dse" ./build.llvm basicaa ltckpt ltckptbasic ltckpt_inline aopify
@@ -81,121 +70,163 @@ static const char *lt_n2d(unsigned long long n)
 	return p + 1;
 }
 
-static const char *lt_n2h(unsigned long long n)
+static void resummarize(const char *name, wprof_set_t *where, char *summary,
+	size_t size)
 {
-#define LEN 20
-	static char s[LEN];
-	char *p = s + LEN - 2;
-	p[1] = '\0';
-
-	do {
-		int r = n % 16;
-		if(r < 10)
-			p[0] = '0' + r;
-		else
-			p[0] = 'a' + r - 10;
-		n -= r;
-		n /= 16;
-		p--;
-	} while(n > 0 && p >= s);
-
-	return p + 1;
+	/* sprintf() recurses, we do our own formatting */
+	memset(summary, 0, size);
+	strlcat(summary, name, size);
+	strlcat(summary, ",", size); strlcat(summary, lt_n2d(where->pes.bb_in), size);
+	strlcat(summary, ",", size); strlcat(summary, lt_n2d(where->pes.bb_out), size);
+	strlcat(summary, ",", size); strlcat(summary, lt_n2d(where->dfa.bb_in), size);
+	strlcat(summary, ",", size); strlcat(summary, lt_n2d(where->dfa.bb_out), size);
+	strlcat(summary, ",", size); strlcat(summary, lt_n2d(where->opt.bb_in), size);
+	strlcat(summary, ",", size); strlcat(summary, lt_n2d(where->opt.bb_out), size);
+	strlcat(summary, "\n", size);
 }
 
-__attribute__((always_inline))
-static void resummarize(const char *name, wprof_set_t *where)
+static inline unsigned long lt_wprof_hash(unsigned long caller2,
+	unsigned long caller1, unsigned long caller0, const char *func_name)
 {
-	/* sprintf() recurses, we do our own formatting */
-	memset(where->summary, 0, sizeof(where->summary));
-	strcat(where->summary, name);
-	strcat(where->summary, ","); strcat(where->summary, lt_n2d(where->pes.bb_in));
-	strcat(where->summary, ","); strcat(where->summary, lt_n2d(where->pes.bb_out));
-	strcat(where->summary, ","); strcat(where->summary, lt_n2d(where->dfa.bb_in));
-	strcat(where->summary, ","); strcat(where->summary, lt_n2d(where->dfa.bb_out));
-	strcat(where->summary, ","); strcat(where->summary, lt_n2d(where->opt.bb_in));
-	strcat(where->summary, ","); strcat(where->summary, lt_n2d(where->opt.bb_out));
-	strcat(where->summary, "\n");
-}
+	unsigned long long h = (unsigned long) func_name;
 
-#define RECURSIVE_OFF 0xc0ffee
-#define RECURSIVE_ON 0xbadda7e
-static int recursive = RECURSIVE_OFF;
+	h = (h ^ caller0) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ caller1) * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ caller2) * 0x9e3779b97f4a7c15ULL;
+	return (unsigned long) (h ^ (h >> 29));
+}
 
-wprof_set_t *lt_wprof_func_stats(void *caller2, void *caller1, void *caller0, const char *func_name_final, wprof_t *where)
+/*
+ * Find (or add) the stats of the given callsite triple + function. System
+ * servers are single-threaded, so the table needs no locking; there is
+ * nothing in here that could re-enter the hook either.
+ */
+__attribute__((always_inline))
+wprof_set_t *lt_wprof_func_stats(void *caller2, void *caller1, void *caller0, const char *func_name, wprof_t *where)
 {
-	int i;
-	struct wprof_scope *wprof_lookup = NULL, *new_node;
-	char func_name[FUNCNAME];
-
-	/* recursion check */
-        lt_assert(recursive == RECURSIVE_ON || recursive == RECURSIVE_OFF);
-        lt_assert(recursive == RECURSIVE_OFF);
-	recursive = RECURSIVE_ON;
-
-	/* parameters check */
-	lt_assert(where);
-	lt_assert(func_name_final);
-
-	/* construct name + caller */
-	memset(func_name, 0, sizeof(func_name));
-	strcat(func_name, "0x");
-	strcat(func_name, lt_n2h((unsigned long long) caller2));
-	strcat(func_name, ",0x");
-	strcat(func_name, lt_n2h((unsigned long long) caller1));
-	strcat(func_name, ",0x");
-	strcat(func_name, lt_n2h((unsigned long long) caller0));
-	strcat(func_name, ",");
-	strcat(func_name, func_name_final);
-	lt_assert(strlen(func_name) < sizeof(func_name));
-
-	HASH_FIND_STR(where->index, func_name, wprof_lookup);
-	if(wprof_lookup) { recursive = RECURSIVE_OFF; return &wprof_lookup->stats; }
-
-#if HASH_SANITY
-	/* quick (?) sanity check of our data structure */
-	for(i = 0; i < where->wprof_next_free; i++) {
-		/* all these must be in use. */
-		lt_assert(where->funcs[i].funcname[0] != '\0');
-
-		/* sanity check - this item must be found as this particular object */
-		HASH_FIND_STR(where->index, where->funcs[i].funcname, wprof_lookup);
-		lt_assert(wprof_lookup == &where->funcs[i]);
+	struct wprof_scope *scope;
+	unsigned long c2 = (unsigned long) caller2;
+	unsigned long c1 = (unsigned long) caller1;
+	unsigned long c0 = (unsigned long) caller0;
+	unsigned long i;
+
+	i = lt_wprof_hash(c2, c1, c0, func_name) & WPROF_TABLE_MASK;
+	for (;;) {
+		scope = &where->funcs[i];
+		if (scope->func_name == func_name && scope->caller0 == c0
+			&& scope->caller1 == c1 && scope->caller2 == c2) {
+			return &scope->stats;
+		}
+		if (!scope->func_name) {
+			break;
+		}
+		i = (i + 1) & WPROF_TABLE_MASK;
 	}
-#endif
 
-	/* check for more space */
+	/* keep the load factor low, account new sites together when full */
+	if (where->wprof_num_used >= MAXFUNCS) {
+		where->wprof_num_dropped++;
+		return &where->dropped;
+	}
+	where->wprof_num_used++;
+	scope->caller2 = c2;
+	scope->caller1 = c1;
+	scope->caller0 = c0;
+	scope->func_name = func_name;
 
-	i = where->wprof_next_free++;
-	assert(i < MAXFUNCS);	/* insta-fail if out of slots */
+	return &scope->stats;
+}
 
-	/* add entry at i */
+static void lt_wprof_export_pol(struct ltckpt_wprof_pol *dst, wprof_pol_t *src)
+{
+	dst->bb_in = src->bb_in;
+	dst->bb_out = src->bb_out;
+	dst->end = src->end;
+	dst->end_k = src->end_k;
+	dst->end_s = src->end_s;
+	dst->end_n = src->end_n;
+	dst->ended_cumulative = src->ended_cumulative;
+}
 
-	lt_assert(i >= 0 && i < MAXFUNCS);
-	new_node = &where->funcs[i];
-	lt_assert(new_node->funcname[0] == '\0');
+static void lt_wprof_export_set(struct ltckpt_wprof_record *dst, wprof_set_t *src)
+{
+	lt_wprof_export_pol(&dst->pes, &src->pes);
+	lt_wprof_export_pol(&dst->dfa, &src->dfa);
+	lt_wprof_export_pol(&dst->opt, &src->opt);
+	lt_wprof_export_pol(&dst->rwindow, &src->rwindow);
+}
 
-	/* create one for our func. */
-	strlcpy(new_node->funcname, func_name, sizeof(new_node->funcname));
+/*
+ * Serialize the profile (see include/ltckpt/wprof.h) into buff. Returns the
+ * number of bytes needed, nothing is written if size is too small.
+ */
+size_t ltckpt_wprof_export(void *buff, size_t size)
+{
+	struct ltckpt_wprof_header *header = buff;
+	struct ltckpt_wprof_record *record;
+	size_t needed;
+	int i;
 
-#if HASH_SANITY
-	lt_assert(new_node->funcname[0] != '\0');
+	needed = sizeof(*header) + (wprof.wprof_num_used + 2)*sizeof(*record);
+	if (!buff || size < needed) {
+		return needed;
+	}
+	memset(buff, 0, needed);
+	header->magic = LTCKPT_WPROF_MAGIC;
+	header->version = LTCKPT_WPROF_VERSION;
+	header->record_size = sizeof(*record);
+	header->num_records = wprof.wprof_num_used + 2;
+	header->num_dropped = wprof.wprof_num_dropped;
+
+	record = (struct ltckpt_wprof_record *) (header + 1);
+	lt_wprof_export_set(record++, &wprof.glo);
+	for (i = 0; i < WPROF_TABLE_SIZE; i++) {
+		struct wprof_scope *scope = &wprof.funcs[i];
+		if (!scope->func_name) {
+			continue;
+		}
+		record->caller2 = scope->caller2;
+		record->caller1 = scope->caller1;
+		record->caller0 = scope->caller0;
+		record->func_name = (unsigned long) scope->func_name;
+		lt_wprof_export_set(record++, &scope->stats);
+	}
+	record->caller2 = record->caller1 = record->caller0 = LTCKPT_WPROF_DROPPED;
+	record->func_name = LTCKPT_WPROF_DROPPED;
+	lt_wprof_export_set(record, &wprof.dropped);
 
-	/* this item must be missing before we add it */
-	HASH_FIND_STR(where->index, func_name, wprof_lookup);
-	lt_assert(wprof_lookup == NULL);
-#endif
+	return needed;
+}
 
-	HASH_ADD_STR(where->index, funcname, new_node);
+/* last binary dump, for the debugger or a memory dump to pick up */
+static char wprof_export_buff[WPROF_EXPORT_SIZE] __attribute__((aligned(8)));
+size_t wprof_export_size;
 
-#if HASH_SANITY
-	/* this item must be found as this particular object after we add it */
-	HASH_FIND_STR(where->index, func_name, wprof_lookup);
-	lt_assert(wprof_lookup == &where->funcs[i]);
-	lt_assert(new_node->funcname[0] != '\0');
-#endif
+/*
+ * Refresh the per-site, dropped and global summaries and export the whole
+ * profile into wprof_export_buff.
+ */
+void ltckpt_wprof_dump(void)
+{
+	int i;
 
-	recursive = RECURSIVE_OFF; 
-	return &new_node->stats;
+	for (i = 0; i < WPROF_TABLE_SIZE; i++) {
+		struct wprof_scope *scope = &wprof.funcs[i];
+		if (!scope->func_name) {
+			continue;
+		}
+		resummarize(scope->func_name, &scope->stats, scope->summary,
+			sizeof(scope->summary));
+	}
+	resummarize("DROPPED$", &wprof.dropped, wprof.dropped_summary,
+		sizeof(wprof.dropped_summary));
+	resummarize("GLOBAL$", &wprof.glo, wprof.summary, sizeof(wprof.summary));
+
+	wprof_export_size = ltckpt_wprof_export(wprof_export_buff,
+		sizeof(wprof_export_buff));
+	printf("wprof: %d sites (%lu dropped lookups), %lu bytes exported at %p\n",
+		wprof.wprof_num_used, wprof.wprof_num_dropped,
+		(unsigned long) wprof_export_size, (void *) wprof_export_buff);
 }
 
 /*
@@ -325,11 +356,6 @@ int ltckpt_aop_hook_wprof(int hook_type, int block_offset, int argc, void** argv
 	{
 		wprof.glo.rwindow.bb_out += num_insts;
 	}
-	if(hook_type == 0) {
-	        resummarize(func_name, funcprof);
-		resummarize("GLOBAL$", &wprof.glo);
-	}
-
 	/* if we're outside the window, keep blaming the cause */
 	if(opt_closer) opt_closer->ended_cumulative += num_insts;
 	if(pes_closer) pes_closer->ended_cumulative += num_insts;
@@ -373,6 +399,7 @@ void sef_signal_handle_default_hook(int signum)
     ltckpt_wprof_pol_print("DFA", &wprof.glo.dfa);
     ltckpt_wprof_pol_print("OPT", &wprof.glo.opt);
     ltckpt_wprof_pol_print("RWINDOW", &wprof.glo.rwindow);
+    ltckpt_wprof_dump();
     }
 }
 #endif
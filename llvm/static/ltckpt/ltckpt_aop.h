@@ -1,10 +1,8 @@
 #ifndef LTCKPT_AOP_H
 #define LTCKPT_AOP_H
 
-#define uthash_malloc(sz) lt_malloc(sz)
-#define uthash_free(ptr,sz) lt_free(ptr)
-
-#include <common/ut/uthash.h>
+#include <stddef.h>
+#include <ltckpt/wprof.h>
 
 typedef unsigned long long wstat_t;
 typedef struct {
@@ -24,22 +22,42 @@ typedef struct {
     wprof_pol_t dfa;
     wprof_pol_t opt;
     wprof_pol_t rwindow;  // recovery window based accounting
-    char summary[200];
 } wprof_set_t;
 
 #define MAXFUNCS (10*800)       /* combinations of callers + functions so it can add up */
-#define FUNCNAME 100
+#define WPROF_TABLE_SIZE 16384  /* open addressing slots, power of two > 2*MAXFUNCS */
+#define WPROF_TABLE_MASK (WPROF_TABLE_SIZE-1)
+#define WPROF_SUMMARY 200
+
+/*
+ * Per-site stats, keyed on the callsite triple plus the (constant) function
+ * name pointer passed in by the instrumentation. An empty slot has a NULL
+ * func_name. The summary is only refreshed on dump, not on every hit.
+ */
+struct wprof_scope {
+    unsigned long caller2;
+    unsigned long caller1;
+    unsigned long caller0;
+    const char *func_name;
+    wprof_set_t stats;
+    char summary[WPROF_SUMMARY];
+};
 
 typedef struct {
     wprof_set_t glo;
-    struct wprof_scope {
-       char funcname[FUNCNAME];
-       wprof_set_t stats;
-       UT_hash_handle hh;
-    } funcs[MAXFUNCS];
-    struct wprof_scope *index;  /* hash table of funcs[] */
-    int wprof_next_free;        /* first unused entry in funcs[] */
+    char summary[WPROF_SUMMARY]; /* glo summary, refreshed on dump */
+    struct wprof_scope funcs[WPROF_TABLE_SIZE];
+    int wprof_num_used;         /* used slots in funcs[] */
+    wprof_set_t dropped;        /* stats of sites beyond MAXFUNCS */
+    unsigned long wprof_num_dropped; /* lookups that fell back to dropped */
+    char dropped_summary[WPROF_SUMMARY];
 } wprof_t;
 
+/* room for the glo and dropped records plus every site in funcs[] */
+#define WPROF_EXPORT_SIZE (sizeof(struct ltckpt_wprof_header) \
+    + (MAXFUNCS + 2)*sizeof(struct ltckpt_wprof_record))
+
 void ltckpt_wprof_pol_print(const char* name, wprof_pol_t *pol);
+size_t ltckpt_wprof_export(void *buff, size_t size);
+void ltckpt_wprof_dump(void);
 #endif 
@@ -56,6 +56,7 @@ void LTCKPT_NOINLINE LTCKPT_INSTFUNCT ltckpt_conf_setup_from_hook(const char *na
 #ifndef __MINIX
 
 #include <pthread.h>
+#include <sys/sysmacros.h>
 
 static void ltckpt_output_atfork_child();
 
@@ -77,9 +78,302 @@ static void ltckpt_output_atfork_child()
 
         util_output_close_child(output_conf);
         ltckpt_output_init();
+        ltckpt_ctx_shm_init();
+}
+
+/*
+ * VMA tracking functions. The tracked entries live in a raw mapping of
+ * their own, which the wrappers never see and the checkpointing code skips
+ * (see ltcpt_is_checkpointed_vma()), between two PROT_NONE guard pages so
+ * that the kernel never merges it with an application VMA. The wrappers
+ * run with arbitrary locks held, so nothing allocates with ltckpt_vmas_lock
+ * held: the storage is grown and /proc is parsed beforehand.
+ */
+util_proc_maps_tracker_t ltckpt_vmas;
+static volatile int ltckpt_vmas_lock;
+static volatile unsigned long ltckpt_vmas_updates;
+static util_proc_maps_entry_t *ltckpt_vmas_storage;
+static int ltckpt_vmas_capacity;
+
+#define LTCKPT_VMAS_LOCK() \
+	while (__sync_lock_test_and_set(&ltckpt_vmas_lock, 1))
+#define LTCKPT_VMAS_UNLOCK() \
+	__sync_lock_release(&ltckpt_vmas_lock)
+
+#define LTCKPT_VMAS_GUARD_SIZE   4096
+#define LTCKPT_VMAS_MIN_CAPACITY 256
+/* Upper bound on the entries a single update adds (two splits, one map). */
+#define LTCKPT_VMAS_HEADROOM     3
+#define LTCKPT_VMAS_STORAGE_SIZE(C) \
+	UTIL_PROC_MAPS_PAGE_ALIGN((C)*sizeof(util_proc_maps_entry_t))
+
+static util_proc_maps_entry_t *ltckpt_vmas_storage_alloc(int capacity)
+{
+	size_t size = LTCKPT_VMAS_STORAGE_SIZE(capacity);
+	char *area;
+
+	area = (char *) syscall(SYS_mmap, NULL, size + 2*LTCKPT_VMAS_GUARD_SIZE,
+		PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (area == MAP_FAILED) {
+		return NULL;
+	}
+	if (syscall(SYS_mprotect, area + LTCKPT_VMAS_GUARD_SIZE, size,
+		PROT_READ | PROT_WRITE)) {
+		syscall(SYS_munmap, area, size + 2*LTCKPT_VMAS_GUARD_SIZE);
+		return NULL;
+	}
+	return (util_proc_maps_entry_t *) (area + LTCKPT_VMAS_GUARD_SIZE);
+}
+
+static void ltckpt_vmas_storage_free(util_proc_maps_entry_t *entries,
+	int capacity)
+{
+	if (entries) {
+		syscall(SYS_munmap, (char *) entries - LTCKPT_VMAS_GUARD_SIZE,
+			LTCKPT_VMAS_STORAGE_SIZE(capacity) + 2*LTCKPT_VMAS_GUARD_SIZE);
+	}
+}
+
+int ltckpt_vmas_storage_overlaps(unsigned long start, unsigned long end)
+{
+	unsigned long storage = (unsigned long) ltckpt_vmas_storage;
+
+	return storage && start < storage
+		+ LTCKPT_VMAS_STORAGE_SIZE(ltckpt_vmas_capacity) && storage < end;
+}
+
+/* Grow the storage to at least capacity entries. Call without the lock. */
+static int ltckpt_vmas_reserve(int capacity)
+{
+	util_proc_maps_entry_t *entries, *old;
+	int new_capacity, old_capacity;
+
+	while (ltckpt_vmas_capacity < capacity) {
+		new_capacity = MAX(capacity, MAX(2*ltckpt_vmas_capacity,
+			LTCKPT_VMAS_MIN_CAPACITY));
+		entries = ltckpt_vmas_storage_alloc(new_capacity);
+		if (!entries) {
+			return -ENOMEM;
+		}
+		LTCKPT_VMAS_LOCK();
+		if (ltckpt_vmas_capacity < new_capacity) {
+			if (UTIL_PROC_MAPS_TRACKER_ACTIVE(&ltckpt_vmas)) {
+				util_proc_maps_tracker_adopt(&ltckpt_vmas, &ltckpt_vmas.maps,
+					entries, new_capacity);
+			}
+			old = ltckpt_vmas_storage;
+			old_capacity = ltckpt_vmas_capacity;
+			ltckpt_vmas_storage = entries;
+			ltckpt_vmas_capacity = new_capacity;
+			entries = old;
+			new_capacity = old_capacity;
+		}
+		LTCKPT_VMAS_UNLOCK();
+		ltckpt_vmas_storage_free(entries, new_capacity);
+	}
+	return 0;
+}
+
+/*
+ * Replace the tracked entries with a fresh parse of /proc. Retried if a
+ * wrapper reported an update in the meantime, as it may be missing from
+ * the new snapshot.
+ */
+static int ltckpt_vmas_refresh()
+{
+	util_proc_maps_t maps;
+	unsigned long updates;
+	int ret = -EAGAIN, retries;
+
+	for (retries = 0; ret == -EAGAIN && retries < 3; retries++) {
+		updates = ltckpt_vmas_updates;
+		ret = util_proc_maps_parse(getpid(), &maps);
+		if (ret) {
+			return ret;
+		}
+		ret = ltckpt_vmas_reserve(maps.num_entries + LTCKPT_VMAS_HEADROOM);
+		if (!ret) {
+			LTCKPT_VMAS_LOCK();
+			ret = updates != ltckpt_vmas_updates ? -EAGAIN
+				: util_proc_maps_tracker_adopt(&ltckpt_vmas, &maps,
+				ltckpt_vmas_storage, ltckpt_vmas_capacity);
+			LTCKPT_VMAS_UNLOCK();
+		}
+		util_proc_maps_destroy(&maps);
+	}
+	return ret;
+}
+
+/*
+ * Called by the wrappers before updating the tracker. Returns with the lock
+ * held and enough room for the update, or 0 if the tracker is not active.
+ */
+static int ltckpt_vmas_update_begin()
+{
+	__sync_fetch_and_add(&ltckpt_vmas_updates, 1);
+	if (!UTIL_PROC_MAPS_TRACKER_ACTIVE(&ltckpt_vmas)) {
+		return 0;
+	}
+	/* On failure, the update itself marks the tracker stale. */
+	ltckpt_vmas_reserve(ltckpt_vmas.maps.num_entries + LTCKPT_VMAS_HEADROOM);
+	LTCKPT_VMAS_LOCK();
+	return 1;
+}
+
+static void ltckpt_vmas_init()
+{
+	int ret;
+
+	if (!CTX(vma_track)) {
+		return;
+	}
+	ret = ltckpt_vmas_refresh();
+	if (ret) {
+		ltckpt_printf_error("ERROR: ltckpt_vmas_refresh failed: %d\n", ret);
+	}
+}
+
+void ltckpt_vmas_mmap(void *addr, size_t len, int prot, int flags, int fd,
+	off_t offset)
+{
+	char path[32], name[128];
+	ssize_t name_len = 0;
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	if (!(flags & MAP_ANONYMOUS) && fd >= 0
+		&& UTIL_PROC_MAPS_TRACKER_ACTIVE(&ltckpt_vmas)) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		name_len = readlink(path, name, sizeof(name)-1);
+		if (name_len < 0 || fstat(fd, &st)) {
+			ltckpt_vmas_invalidate();
+			return;
+		}
+	}
+	name[name_len] = '\0';
+	if (!ltckpt_vmas_update_begin()) {
+		return;
+	}
+	util_proc_maps_tracker_map(&ltckpt_vmas, (unsigned long) addr,
+		(unsigned long) addr + len, prot, flags & MAP_SHARED,
+		name_len ? offset : 0, major(st.st_dev), minor(st.st_dev),
+		st.st_ino, name);
+	LTCKPT_VMAS_UNLOCK();
+}
+
+void ltckpt_vmas_munmap(void *addr, size_t len)
+{
+	if (!ltckpt_vmas_update_begin()) {
+		return;
+	}
+	util_proc_maps_tracker_unmap(&ltckpt_vmas, (unsigned long) addr,
+		(unsigned long) addr + len);
+	LTCKPT_VMAS_UNLOCK();
+}
+
+void ltckpt_vmas_mprotect(void *addr, size_t len, int prot)
+{
+	if (!ltckpt_vmas_update_begin()) {
+		return;
+	}
+	util_proc_maps_tracker_protect(&ltckpt_vmas, (unsigned long) addr,
+		(unsigned long) addr + len, prot);
+	LTCKPT_VMAS_UNLOCK();
+}
+
+void ltckpt_vmas_brk()
+{
+	if (!ltckpt_vmas_update_begin()) {
+		return;
+	}
+	util_proc_maps_tracker_brk(&ltckpt_vmas, UTIL_PROC_MAPS_CURBRK());
+	LTCKPT_VMAS_UNLOCK();
+}
+
+void ltckpt_vmas_invalidate()
+{
+	__sync_fetch_and_add(&ltckpt_vmas_updates, 1);
+	util_proc_maps_tracker_invalidate(&ltckpt_vmas);
+}
+
+static int ltckpt_vmas_diff_cb(util_proc_maps_entry_t *entry,
+	util_proc_maps_entry_t *entry2, int diffresult, void *cb_args)
+{
+	if (!diffresult) {
+		return 0;
+	}
+	ltckpt_printf("ltckpt: VMA tracker mismatch (%d): ", diffresult);
+	if (entry) {
+		util_proc_maps_entry_print(entry);
+	}
+	ltckpt_printf(" -> ");
+	if (entry2) {
+		util_proc_maps_entry_print(entry2);
+	}
+	ltckpt_printf("\n");
+	return 1;
+}
+
+/* Report the differences with /proc and refresh the tracker if any. */
+static void ltckpt_vmas_check()
+{
+	util_proc_maps_t maps;
+	int ret = 0;
+
+	if (util_proc_maps_parse(getpid(), &maps)) {
+		return;
+	}
+	LTCKPT_VMAS_LOCK();
+	if (!ltckpt_vmas.stale) {
+		ret = util_proc_maps_layout_diff(&ltckpt_vmas.maps, &maps, 0,
+			ltckpt_vmas_diff_cb, NULL);
+	}
+	LTCKPT_VMAS_UNLOCK();
+	util_proc_maps_destroy(&maps);
+	if (ret) {
+		ltckpt_vmas_invalidate();
+	}
+}
+
+/*
+ * Drop-in replacement for util_proc_maps_parse_filter() on the current
+ * process. Mappings created inside libc bypass the wrappers, so the tracker
+ * is only used when only the program data and the heap are checkpointed.
+ */
+int ltckpt_vmas_parse_filter(util_proc_maps_t *maps,
+	util_proc_maps_parse_cb_t cb, void *cb_args)
+{
+	int ret = -ENOMEM, capacity;
+
+	if (!CTX(skip_mmap) || !CTX(vma_track)) {
+		return util_proc_maps_parse_filter(getpid(), maps, cb, cb_args);
+	}
+	if (ltckpt_vmas.stale || !UTIL_PROC_MAPS_TRACKER_ACTIVE(&ltckpt_vmas)) {
+		ltckpt_vmas_refresh();
+	}
+	capacity = ltckpt_vmas_capacity;
+	memset(maps, 0, sizeof(util_proc_maps_t));
+	maps->entries = malloc(sizeof(util_proc_maps_entry_t)*(capacity+1));
+	if (maps->entries) {
+		LTCKPT_VMAS_LOCK();
+		ret = util_proc_maps_tracker_filter(&ltckpt_vmas, maps, capacity,
+			cb, cb_args);
+		LTCKPT_VMAS_UNLOCK();
+	}
+	if (ret) {
+		/* Stale and not refreshable, or grown in the meantime. */
+		util_proc_maps_destroy(maps);
+		return util_proc_maps_parse_filter(getpid(), maps, cb, cb_args);
+	}
+	if (LTCKPT_IS_VERBOSE()) {
+		ltckpt_vmas_check();
+	}
+
+	return 0;
 }
 #else
 #define ltckpt_output_init()
+#define ltckpt_vmas_init()
 #endif
 
 /*
@@ -103,6 +397,10 @@ void __attribute__((constructor)) ltckpt_common_late_init()
 
 	ltckpt_common_early_init();
 	ltckpt_output_init();
+	ltckpt_log_init();
+	ltckpt_ctx_shm_init();
+	ltckpt_vmas_init();
+	ltckpt_snapshot_init();
 
 	if (CONF(late_init_hook)) {
 		ltckpt_debug_print("calling mechanisms init_hook\n");
@@ -116,10 +414,16 @@ extern int inside_trusted_compute_base;
 
 int ltckpt_restart(void *arg)
 {
+	int ret;
+	unsigned long long tsc;
+
 	inside_trusted_compute_base = 1;
 	if (CONF(restart_hook)) {
 		ltckpt_debug_print("calling mechanism-specific restart hook\n");
-		return CONF(restart_hook)(arg);
+		tsc = CTX(hist_enabled) ? ltckpt_hist_tsc_read() : 0;
+		ret = CONF(restart_hook)(arg);
+		CTX_HIST_ADD(hist_restart_cycles, ltckpt_hist_tsc_read() - tsc);
+		return ret;
 	}
 
 	ltckpt_debug_print("no mechanism-specific restart hook defined\n");
@@ -150,6 +454,8 @@ int ltckpt_is_mapped(void *addr)
 /*
  * Memory management functions.
  */
+unsigned long ltckpt_hugetlb_fallbacks;
+
 /* mmap_wrapper */
 ltckpt_va_t ltckpt_mmap(ltckpt_va_t addr, size_t size, int prot, unsigned int flags)
 {
@@ -197,8 +503,35 @@ ltckpt_va_t ltckpt_mmap(ltckpt_va_t addr, size_t size, int prot, unsigned int fl
 		mmap_prot |= PROT_EXEC;
 	}
 
-	mmap_ret = mmap(LTCKPT_VA_TO_PTR(addr), size, mmap_prot,
-		mmap_flags, -1,0);
+	mmap_ret = MAP_FAILED;
+#if !defined(__MINIX) && defined(MAP_HUGETLB)
+	if ((flags & LTCKPT_MAP_HUGETLB) && !(addr % LTCKPT_HUGE_PAGE_SIZE)
+		&& !(size % LTCKPT_HUGE_PAGE_SIZE)) {
+		/*
+		 * Always reserve the huge pages up front: with MAP_NORESERVE
+		 * the mapping succeeds on an empty pool and the first fault
+		 * past the pool gets SIGBUS instead of falling back here.
+		 */
+		mmap_ret = mmap(LTCKPT_VA_TO_PTR(addr), size, mmap_prot,
+			(mmap_flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+		if (mmap_ret != MAP_FAILED) {
+			flags &= ~LTCKPT_MAP_HUGE;
+		}
+		else {
+			flags |= LTCKPT_MAP_HUGE;
+			ltckpt_hugetlb_fallbacks++;
+		}
+	}
+#endif
+	if (mmap_ret == MAP_FAILED) {
+		mmap_ret = mmap(LTCKPT_VA_TO_PTR(addr), size, mmap_prot,
+			mmap_flags, -1,0);
+	}
+#if !defined(__MINIX) && defined(MADV_HUGEPAGE)
+	if ((flags & LTCKPT_MAP_HUGE) && mmap_ret != MAP_FAILED) {
+		madvise(mmap_ret, size, MADV_HUGEPAGE);
+	}
+#endif
 
 	ltckpt_debug_print("mmap(%p, 0x%lx, 0x%x, 0x%x, 0, 0) = %p\n",
 		LTCKPT_VA_TO_PTR(addr), (unsigned long) size, mmap_prot,
@@ -237,6 +570,100 @@ int ltckpt_mprotect(ltckpt_va_t start, size_t size, int prot)
 	return mprotect(LTCKPT_VA_TO_PTR(start), size, mp_prot);
 }
 
+#define LTCKPT_MPOL_PREFERRED   1
+#define LTCKPT_NUMA_MAX_NODES   (sizeof(unsigned long)*8)
+
+int ltckpt_numa_bind_local(ltckpt_va_t addr, size_t size)
+{
+	unsigned cpu, node;
+	unsigned long nodemask;
+
+	if (!CTX(numa)) {
+		return -1;
+	}
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0 || node >= LTCKPT_NUMA_MAX_NODES) {
+		return -1;
+	}
+	nodemask = 1UL << node;
+	if (syscall(SYS_mbind, LTCKPT_VA_TO_PTR(addr), size, LTCKPT_MPOL_PREFERRED,
+		&nodemask, LTCKPT_NUMA_MAX_NODES, 0) < 0) {
+		/* ENOSYS or EINVAL without NUMA support. */
+		return -1;
+	}
+	__sync_fetch_and_add(&CTX(numa_binds), 1);
+	__sync_fetch_and_or(&CTX(numa_nodes), nodemask);
+
+	return (int) node;
+}
+
+/*
+ * Slots are claimed with an atomic increment and published by setting end
+ * last, readers skip the ones still being filled in. Per-thread writelogs
+ * take one slot per thread.
+ */
+#define LTCKPT_OWNED_MAX 1024
+
+static struct {
+	unsigned long start;
+	volatile unsigned long end;
+} ltckpt_owned[LTCKPT_OWNED_MAX];
+static volatile int ltckpt_owned_num;
+
+void ltckpt_owned_add(ltckpt_va_t start, size_t size)
+{
+	int i, num = ltckpt_owned_num;
+
+	/* Remapping a range in place must not use up another slot. */
+	for (i = 0; i < num && i < LTCKPT_OWNED_MAX; i++) {
+		if (ltckpt_owned[i].end == start + size
+			&& ltckpt_owned[i].start == start) {
+			return;
+		}
+	}
+	i = __sync_fetch_and_add(&ltckpt_owned_num, 1);
+	if (i >= LTCKPT_OWNED_MAX) {
+		ltckpt_owned_num = LTCKPT_OWNED_MAX;
+		ltckpt_printf_error("ERROR: too many ltckpt ranges, snapshots will include %p\n",
+			LTCKPT_VA_TO_PTR(start));
+		return;
+	}
+	ltckpt_owned[i].start = start;
+	__sync_synchronize();
+	ltckpt_owned[i].end = start + size;
+}
+
+int ltckpt_owned_next(unsigned long start, unsigned long end,
+	unsigned long *ostart, unsigned long *oend)
+{
+	int i, num = ltckpt_owned_num, found = 0;
+
+	for (i = 0; i < num && i < LTCKPT_OWNED_MAX; i++) {
+		unsigned long s = ltckpt_owned[i].start, e = ltckpt_owned[i].end;
+		if (!e || s >= end || e <= start) {
+			continue;
+		}
+		if (!found || s < *ostart) {
+			*ostart = s;
+			*oend = e;
+			found = 1;
+		}
+	}
+
+	return found;
+}
+
+int ltckpt_owned_covers(unsigned long start, unsigned long end)
+{
+	unsigned long ostart, oend;
+
+	while (start < end && ltckpt_owned_next(start, end, &ostart, &oend)
+		&& ostart <= start) {
+		start = oend;
+	}
+
+	return start >= end;
+}
+
 int ltcpt_is_checkpointed_vma(util_proc_maps_entry_t *entry)
 {
 	if (UTIL_PROC_MAPS_ENTRY_IS_STACK(entry)
@@ -244,7 +671,16 @@ int ltcpt_is_checkpointed_vma(util_proc_maps_entry_t *entry)
 		|| entry->w != 'w') {
 		return 0;
 	}
-	if (UTIL_PROC_MAPS_ENTRY_NAME_CONTAINS(entry, "libltckpt")) {
+	if (UTIL_PROC_MAPS_ENTRY_NAME_CONTAINS(entry, "libltckpt")
+		|| UTIL_PROC_MAPS_ENTRY_NAME_CONTAINS(entry, LTCKPT_SHM_STATS_PREFIX)) {
+		return 0;
+	}
+#if LTCKPT_CFG_LOG_RING
+	if (ltckpt_log_ring_overlaps(entry->vm_start, entry->vm_end)) {
+		return 0;
+	}
+#endif
+	if (ltckpt_vmas_storage_overlaps(entry->vm_start, entry->vm_end)) {
 		return 0;
 	}
 	if (CTX(skip_mmap)) {
@@ -34,6 +34,10 @@
 #define LTCKPT_MAP_NORESERVE (1<<2)
 #define LTCKPT_MAP_STACK     (1<<3)
 #define LTCKPT_MAP_POPULATE  (1<<4)
+#define LTCKPT_MAP_HUGE      (1<<5) /* advise transparent huge pages */
+#define LTCKPT_MAP_HUGETLB   (1<<6) /* hugetlbfs pages, LTCKPT_MAP_HUGE if unavailable */
+
+#define LTCKPT_HUGE_PAGE_SIZE (2*1024*1024)
 
 #define LTCKPT_PROT_N  (0)
 #define LTCKPT_PROT_R  (1<<0)
@@ -100,6 +104,7 @@
 #include <common/util/output.h>
 
 #include "ltckpt_ctx.h"
+#include "ltckpt_log.h"
 
 #ifndef __MINIX
 #include <common/util/proc_maps.h>
@@ -153,9 +158,27 @@
 		LTCKPT_WREAL(F)(_ARGS); \
 		__builtin_unreachable(); \
 	}
+/* BODY runs after the real call, with its return value in ret. */
+#define LTCKPT_POST_WRAPPER(RET, F, ARGS, _ARGS, BODY) \
+	RET (*LTCKPT_WREAL(F))(ARGS); \
+	void __attribute__((constructor)) LTCKPT_WINIT(F)() { \
+		LTCKPT_WREAL(F) = dlsym(RTLD_NEXT, #F); \
+		assert(LTCKPT_WREAL(F)); \
+	} \
+	RET LTCKPT_WSYM(F)(ARGS) \
+	{ \
+		RET ret; \
+		if (!LTCKPT_WREAL(F)) { \
+			LTCKPT_WINIT(F)(); \
+		} \
+		ret = LTCKPT_WREAL(F)(_ARGS); \
+		BODY \
+		return ret; \
+	}
 #else
 #define LTCKPT_WRAPPER(RET, F, ARGS, _ARGS, BODY)
 #define LTCKPT_NORET_WRAPPER(RET, F, ARGS, _ARGS, BODY)
+#define LTCKPT_POST_WRAPPER(RET, F, ARGS, _ARGS, BODY)
 #endif
 
 /**
@@ -164,11 +187,45 @@
  * LTCKPT_MAP_PRIVATE and LTCKPT_MAP_NORESERVE, which should
  * have the same effect as there Linux counterpart, if supported
  * by the underlying OS.
+ * LTCKPT_MAP_HUGETLB needs addr and size aligned to LTCKPT_HUGE_PAGE_SIZE
+ * and reserves the whole range from the hugetlbfs pool (LTCKPT_MAP_NORESERVE
+ * is ignored for it). If that fails, the range is mapped with regular pages
+ * and LTCKPT_MAP_HUGE instead, counted in ltckpt_hugetlb_fallbacks.
+ * Both huge page flags are ignored on MINIX.
  */
 ltckpt_va_t ltckpt_mmap(ltckpt_va_t addr, size_t size, int proto, unsigned int flags);
+extern unsigned long ltckpt_hugetlb_fallbacks;
 int ltckpt_munmap(ltckpt_va_t start, size_t size);
 int ltckpt_mprotect(ltckpt_va_t start, size_t size, int prot);
 
+/**
+ * Prefer the NUMA node the calling thread runs on for the pages of
+ * [addr, addr+size) not faulted in yet (CP_NUMA). Meant for per-thread
+ * metadata, which may be mapped by another thread. Returns the node,
+ * or -1 if disabled or unsupported.
+ */
+#ifndef __MINIX
+int ltckpt_numa_bind_local(ltckpt_va_t addr, size_t size);
+#else
+#define ltckpt_numa_bind_local(A, S) (-1)
+#endif
+
+/**
+ * Address ranges of ltckpt's own metadata and buffers (bitmap, shadow
+ * space, writelog, snapshot buffer). Snapshots leave them out by address,
+ * also when the kernel merged them with an application VMA.
+ * ltckpt_owned_next() returns the lowest range overlapping [start, end)
+ * in *ostart and *oend, or 0 if there is none.
+ */
+#ifndef __MINIX
+void ltckpt_owned_add(ltckpt_va_t start, size_t size);
+int ltckpt_owned_next(unsigned long start, unsigned long end,
+	unsigned long *ostart, unsigned long *oend);
+int ltckpt_owned_covers(unsigned long start, unsigned long end);
+#else
+#define ltckpt_owned_add(S, L)
+#endif
+
 
 /****************************************************************************
 *     Init helper functions                                                 *
@@ -185,6 +242,22 @@ void ltckpt_common_late_init();
  **/
 #ifndef __MINIX
 int ltcpt_is_checkpointed_vma(util_proc_maps_entry_t *entry);
+
+/**
+ * Tracked VMAs (see util_proc_maps_tracker_t), kept current by the
+ * mmap()/munmap()/mprotect()/mremap()/brk()/sbrk() wrappers.
+ **/
+extern util_proc_maps_tracker_t ltckpt_vmas;
+int ltckpt_vmas_parse_filter(util_proc_maps_t *maps,
+	util_proc_maps_parse_cb_t cb, void *cb_args);
+void ltckpt_vmas_mmap(void *addr, size_t len, int prot, int flags, int fd,
+	off_t offset);
+void ltckpt_vmas_munmap(void *addr, size_t len);
+void ltckpt_vmas_mprotect(void *addr, size_t len, int prot);
+void ltckpt_vmas_brk();
+void ltckpt_vmas_invalidate();
+/* Whether [start, end) overlaps the tracker's own storage. */
+int ltckpt_vmas_storage_overlaps(unsigned long start, unsigned long end);
 #endif
 int ltckpt_restart(void *arg);
 int ltckpt_mechanism_enabled(void);
@@ -0,0 +1,151 @@
+#ifndef LTCKPT_COMPRESS_H
+#define LTCKPT_COMPRESS_H 1
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Page codecs for mechanisms that save full page copies (softdirty,
+ * mprotect). Pages are appended to the mechanism's memory pool using the
+ * returned length, so untouched pool pages are never faulted in and the
+ * resident size of the checkpoint follows the compressed size.
+ *
+ * LTCKPT_COMPRESS_ZERO: all-zero pages are elided (length 0).
+ * LTCKPT_COMPRESS_ZRLE: zero-page elision plus run-length encoding of
+ *   zero words. The page is a sequence of 16-bit tokens, each followed by
+ *   (token & LTCKPT_ZRLE_LEN_MASK) literal words, unless the token has the
+ *   LTCKPT_ZRLE_ZERO bit set (a run of zero words).
+ *
+ * A length of PAGE_SIZE always means the page is stored raw.
+ */
+#define LTCKPT_COMPRESS_NONE 0
+#define LTCKPT_COMPRESS_ZERO 1
+#define LTCKPT_COMPRESS_ZRLE 2
+
+#define LTCKPT_COMPRESS_NAME(C) \
+	((C) == LTCKPT_COMPRESS_ZERO ? "zero" : (C) == LTCKPT_COMPRESS_ZRLE ? "zrle" : "none")
+
+#define LTCKPT_ZRLE_ZERO     0x8000
+#define LTCKPT_ZRLE_LEN_MASK 0x7fff
+#define LTCKPT_ZRLE_WORDS    (PAGE_SIZE/sizeof(uint64_t))
+
+static inline int ltckpt_page_is_zero(const void *page)
+{
+	const uint64_t *w = (const uint64_t*) page;
+	unsigned i;
+
+	for (i = 0; i < LTCKPT_ZRLE_WORDS; i++) {
+		if (w[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static inline size_t ltckpt_zrle_encode(const void *page, void *out)
+{
+	const uint64_t *w = (const uint64_t*) page;
+	char *o = (char*) out;
+	size_t pos = 0;
+	unsigned i = 0, start;
+	uint16_t token;
+
+	while (i < LTCKPT_ZRLE_WORDS) {
+		start = i;
+		if (!w[i]) {
+			while (i < LTCKPT_ZRLE_WORDS && !w[i]) {
+				i++;
+			}
+			if (pos + sizeof(token) >= PAGE_SIZE) {
+				return PAGE_SIZE;
+			}
+			token = LTCKPT_ZRLE_ZERO | (i - start);
+			memcpy(o + pos, &token, sizeof(token));
+			pos += sizeof(token);
+			continue;
+		}
+		/* Literal run, a single zero word does not pay for a token. */
+		while (i < LTCKPT_ZRLE_WORDS && (w[i]
+			|| (i + 1 < LTCKPT_ZRLE_WORDS && w[i + 1]))) {
+			i++;
+		}
+		if (pos + sizeof(token) + (i - start)*sizeof(uint64_t) >= PAGE_SIZE) {
+			return PAGE_SIZE;
+		}
+		token = i - start;
+		memcpy(o + pos, &token, sizeof(token));
+		pos += sizeof(token);
+		memcpy(o + pos, &w[start], (i - start)*sizeof(uint64_t));
+		pos += (i - start)*sizeof(uint64_t);
+	}
+
+	return pos;
+}
+
+static inline void ltckpt_zrle_decode(const void *in, size_t len, void *page)
+{
+	const char *p = (const char*) in;
+	uint64_t *w = (uint64_t*) page;
+	size_t pos = 0;
+	unsigned n;
+	uint16_t token;
+
+	while (pos < len) {
+		memcpy(&token, p + pos, sizeof(token));
+		pos += sizeof(token);
+		n = token & LTCKPT_ZRLE_LEN_MASK;
+		if (token & LTCKPT_ZRLE_ZERO) {
+			memset(w, 0, n*sizeof(uint64_t));
+		}
+		else {
+			memcpy(w, p + pos, n*sizeof(uint64_t));
+			pos += n*sizeof(uint64_t);
+		}
+		w += n;
+	}
+}
+
+/*
+ * Save a page into out (at least PAGE_SIZE bytes available).
+ * Returns the number of bytes used.
+ */
+static inline size_t ltckpt_compress_page(int codec, const void *page, void *out)
+{
+	size_t len;
+
+	switch (codec) {
+	case LTCKPT_COMPRESS_ZERO:
+		if (ltckpt_page_is_zero(page)) {
+			return 0;
+		}
+		break;
+	case LTCKPT_COMPRESS_ZRLE:
+		if (ltckpt_page_is_zero(page)) {
+			return 0;
+		}
+		len = ltckpt_zrle_encode(page, out);
+		if (len < PAGE_SIZE) {
+			return len;
+		}
+		break;
+	default:
+		break;
+	}
+	memcpy(out, page, PAGE_SIZE);
+	return PAGE_SIZE;
+}
+
+static inline void ltckpt_decompress_page(const void *in, size_t len, void *page)
+{
+	if (len == 0) {
+		memset(page, 0, PAGE_SIZE);
+	}
+	else if (len == PAGE_SIZE) {
+		memcpy(page, in, PAGE_SIZE);
+	}
+	else {
+		ltckpt_zrle_decode(in, len, page);
+	}
+}
+
+#endif /* LTCKPT_COMPRESS_H */
@@ -12,9 +12,12 @@
 
 
 /**
- * Enable debugging output
+ * Enable debugging output (ltckpt_debug_print). With LTCKPT_CFG_LOG_RING,
+ * debug output goes through the ring-buffer logger (see ltckpt_log.h).
  **/
+#ifndef LTCKPT_CFG_DEBUG
 #define LTCKPT_CFG_DEBUG 0
+#endif
 
 /**
  * Enable statistics
@@ -25,10 +28,14 @@
 
 #if LTCKPT_CFG_DEBUG == 1
 #define DEBUG(x) x
+#if LTCKPT_CFG_LOG_RING
+#define ltckpt_debug_print(...) ltckpt_log(__VA_ARGS__)
+#else
 #define ltckpt_debug_print(...) do { \
 	ltckpt_printf("%s: ", __func__); \
 	ltckpt_printf(__VA_ARGS__);     \
 } while(0)
+#endif
 
 #ifndef __MINIX
 #define ltckpt_debug_func() do { \
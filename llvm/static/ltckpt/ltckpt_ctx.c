@@ -1,4 +1,11 @@
 #include "ltckpt_local.h"
+#include "ltckpt_compress.h"
+
+#ifndef __MINIX
+#include <common/util/shmstats.h>
+
+static util_shmem_seg_t ltckpt_shm_stats_seg;
+#endif
 
 ltckpt_ctx_t ltckpt_ctx_buff;
 ltckpt_ctx_t *ltckpt_ctx = &ltckpt_ctx_buff;
@@ -10,11 +17,62 @@ void ltckpt_ctx_clear_default()
 	CTX_CLEAR(num_checkpoints);
 	CTX_CLEAR(num_aop_funcs);
 	CTX_CLEAR(num_aop_tols);
+	CTX_CLEAR(compress_in_bytes);
+	CTX_CLEAR(compress_out_bytes);
+	memset(&CTX(hist_checkpoint_cycles), 0, sizeof(ltckpt_hist_t));
+	memset(&CTX(hist_restart_cycles), 0, sizeof(ltckpt_hist_t));
+	memset(&CTX(hist_bytes_saved), 0, sizeof(ltckpt_hist_t));
+	memset(&CTX(hist_log_size), 0, sizeof(ltckpt_hist_t));
+}
+
+void ltckpt_ctx_hist_print(const char *name, ltckpt_hist_t *hist)
+{
+	ltckpt_printf_force("CTX: HIST: %s: { count=%llu, min=%llu, p50=%llu, p99=%llu, p999=%llu, max=%llu }\n",
+		name, hist->count, hist->min,
+		ltckpt_hist_percentile(hist, 500),
+		ltckpt_hist_percentile(hist, 990),
+		ltckpt_hist_percentile(hist, 999),
+		hist->max);
+}
+
+void ltckpt_ctx_hist_print_all()
+{
+	ltckpt_ctx_hist_print("checkpoint_cycles", &CTX(hist_checkpoint_cycles));
+	ltckpt_ctx_hist_print("restart_cycles", &CTX(hist_restart_cycles));
+	ltckpt_ctx_hist_print("bytes_saved", &CTX(hist_bytes_saved));
+	ltckpt_ctx_hist_print("log_size", &CTX(hist_log_size));
 }
 
 void ltckpt_ctx_print_default()
 {
 	ltckpt_printf_force(CTX_LOG_FMT, CTX_LOG_ARGS);
+	if (CTX(compress)) {
+		unsigned long ratio = CTX(compress_out_bytes) ?
+			CTX(compress_in_bytes)*100/CTX(compress_out_bytes) : 0;
+		ltckpt_printf_force("CTX: COMPRESS: { codec=%s, in_bytes=%lu, out_bytes=%lu, ratio=%lu.%02lu }\n",
+			LTCKPT_COMPRESS_NAME(CTX(compress)), CTX(compress_in_bytes),
+			CTX(compress_out_bytes), ratio/100, ratio%100);
+	}
+	if (CTX(snapshot_interval)) {
+		ltckpt_printf_force("CTX: SNAPSHOT: { taken=%lu, skipped=%lu, failed=%lu }\n",
+			CTX(snapshots), CTX(snapshots_skipped), CTX(snapshots_failed));
+	}
+	if (CTX(huge_pages)) {
+		ltckpt_printf_force("CTX: HUGE_PAGES: { mode=%d, hugetlb_fallbacks=%lu }\n",
+			CTX(huge_pages), ltckpt_hugetlb_fallbacks);
+	}
+	if (CTX(numa_binds)) {
+		ltckpt_printf_force("CTX: NUMA: { binds=%lu, nodes=0x%lx }\n",
+			CTX(numa_binds), CTX(numa_nodes));
+	}
+#if LTCKPT_CFG_LOG_RING
+	if (ltckpt_log_ring && ltckpt_log_ring->dropped) {
+		ltckpt_printf_force("CTX: LOG: { dropped=%lu }\n", ltckpt_log_ring->dropped);
+	}
+#endif
+	if (CTX(hist_enabled)) {
+		ltckpt_ctx_hist_print_all();
+	}
 }
 
 void ltckpt_ctx_clear()
@@ -37,6 +95,61 @@ void ltckpt_ctx_print()
 	ltckpt_ctx_print_default();
 }
 
+#ifndef __MINIX
+void ltckpt_ctx_shm_init()
+{
+	util_shmstats_hdr_t *hdr;
+
+	if (CTX(shm_stats)) {
+		/* Inherited from the parent after fork(), leave it to the parent. */
+		util_shmstats_close(&ltckpt_shm_stats_seg);
+		CTX(shm_stats) = NULL;
+	}
+	if (!util_env_parse_int("CP_SHMSTATS", 0)) {
+		return;
+	}
+	hdr = util_shmstats_create(&ltckpt_shm_stats_seg, LTCKPT_SHM_STATS_PREFIX,
+		sizeof(ltckpt_shm_stats_t), LTCKPT_SHM_STATS_VERSION);
+	if (!hdr) {
+		ltckpt_printf_error("ERROR: unable to create shared stats segment %s: %s\n",
+			ltckpt_shm_stats_seg.name, strerror(errno));
+		return;
+	}
+	CTX(shm_stats) = hdr;
+	ltckpt_ctx_shm_publish();
+}
+
+void ltckpt_ctx_shm_publish()
+{
+	util_shmstats_hdr_t *hdr = CTX(shm_stats);
+	ltckpt_shm_stats_t *stats = UTIL_SHMSTATS_PAYLOAD(hdr);
+
+	util_shmstats_write_begin(hdr);
+	stats->errors = CTX(errors);
+	stats->num_cows = CTX(num_cows);
+	stats->num_tols = CTX(num_tols);
+	stats->num_checkpoints = CTX(num_checkpoints);
+	stats->max_log_size = CTX(max_log_size);
+	stats->num_aop_funcs = CTX(num_aop_funcs);
+	stats->num_aop_tols = CTX(num_aop_tols);
+	util_shmstats_write_end(hdr);
+}
+
+void ltckpt_ctx_shm_close()
+{
+	if (!CTX(shm_stats)) {
+		return;
+	}
+	ltckpt_ctx_shm_publish();
+	CTX(shm_stats) = NULL;
+	util_shmstats_destroy(&ltckpt_shm_stats_seg);
+}
+#else
+void ltckpt_ctx_shm_init() {}
+void ltckpt_ctx_shm_publish() {}
+void ltckpt_ctx_shm_close() {}
+#endif
+
 void ltckpt_ctx_set(ltckpt_ctx_t *ctx)
 {
 	memcpy(ctx, ltckpt_ctx, sizeof(ltckpt_ctx_t));
@@ -56,6 +169,9 @@ void ltckpt_ctx_init()
 #endif
 	CTX(checkpoint_interval) = util_env_parse_int("CP_INTERVAL", 1); /* 0 disables checkpointing. */
 	CTX(page_statistic_enabled) = util_env_parse_int("PAGESTAT", 0);
+	CTX(hist_enabled) = util_env_parse_int("CP_HIST", 0);
+	CTX(vma_track) = util_env_parse_int("CP_VMA_TRACK", 1);
+	CTX(numa) = util_env_parse_int("CP_NUMA", 1);
 
 	CTX(approach) = CONF(name);
 }
@@ -4,6 +4,26 @@
 #include <syslog.h>
 #include <unistd.h>
 
+#include "ltckpt_hist.h"
+#include "ltckpt_snapshot.h"
+
+/*
+ * Live statistics exported in /dev/shm/ltckpt.stats.<pid> (CP_SHMSTATS=1)
+ * at every checkpoint. See common/util/shmstats.h for the reader side.
+ */
+#define LTCKPT_SHM_STATS_PREFIX  "ltckpt.stats"
+#define LTCKPT_SHM_STATS_VERSION 1
+
+typedef struct ltckpt_shm_stats_s {
+	unsigned long errors;
+	unsigned long num_cows;
+	unsigned long num_tols;
+	unsigned long num_checkpoints;
+	unsigned long max_log_size;
+	unsigned long num_aop_funcs;
+	unsigned long num_aop_tols;
+} ltckpt_shm_stats_t;
+
 typedef struct ltckpt_ctx_s {
 	int lazy_init;
 	int skip_mmap;
@@ -14,6 +34,18 @@ typedef struct ltckpt_ctx_s {
 	int checkpoint_interval;
 	int pgfault_nesting_level;
 	int page_statistic_enabled;
+	int hist_enabled;
+	int compress;
+	int vma_track;
+	int huge_pages;
+	int numa;
+	unsigned long numa_binds;
+	unsigned long numa_nodes;  /* mask of the nodes metadata was bound to */
+	int snapshot_interval;
+	unsigned long snapshots;
+	unsigned long snapshots_skipped;
+	unsigned long snapshots_failed;
+	void *shm_stats;
 	util_output_conf_t output_conf;
 	const char *approach;
 	unsigned long errors;
@@ -23,6 +55,13 @@ typedef struct ltckpt_ctx_s {
 	unsigned long max_log_size;
 	unsigned long num_aop_funcs;
 	unsigned long num_aop_tols;
+	unsigned long compress_in_bytes;
+	unsigned long compress_out_bytes;
+	unsigned long long tol_tsc;
+	ltckpt_hist_t hist_checkpoint_cycles;
+	ltckpt_hist_t hist_restart_cycles;
+	ltckpt_hist_t hist_bytes_saved;
+	ltckpt_hist_t hist_log_size;
 } ltckpt_ctx_t;
 
 extern ltckpt_ctx_t *ltckpt_ctx;
@@ -39,22 +78,48 @@ extern ltckpt_ctx_t *ltckpt_ctx;
 	CTX(num_checkpoints), CTX(max_log_size), CTX(num_aop_funcs), \
 	CTX(num_aop_tols)
 
+#define CTX_HIST_ADD(H, V) do { \
+	if (CTX(hist_enabled)) { \
+		ltckpt_hist_add(&CTX(H), V); \
+	} \
+} while(0)
+
 #define CTX_NEW_TOL_OR_RETURN() do { \
 	if (!CTX(checkpoint_interval) || (CTX(num_tols) % CTX(checkpoint_interval) > 0)) { \
 		CTX_INC(num_tols); \
 		return; \
 	} \
 	CTX_INC(num_tols); \
+	if (CTX(hist_enabled)) { \
+		CTX(tol_tsc) = ltckpt_hist_tsc_read(); \
+	} \
 } while(0)
 
 #define CTX_NEW_CHECKPOINT() do { \
 	CTX_INC(num_checkpoints); \
+	CTX_HIST_ADD(hist_checkpoint_cycles, ltckpt_hist_tsc_read() - CTX(tol_tsc)); \
+	if (CTX(shm_stats)) { \
+		ltckpt_ctx_shm_publish(); \
+	} \
+	if (CTX(snapshot_interval)) { \
+		ltckpt_snapshot_checkpoint(); \
+	} \
 } while(0)
 
 #define CTX_NEW_LOG_SIZE(LS) do { \
 	if (LS > CTX(max_log_size)) { \
 		CTX(max_log_size) = LS; \
 	} \
+	CTX_HIST_ADD(hist_log_size, LS); \
+} while(0)
+
+#define CTX_NEW_COMPRESSED(IN, OUT) do { \
+	CTX(compress_in_bytes) += IN; \
+	CTX(compress_out_bytes) += OUT; \
+} while(0)
+
+#define CTX_NEW_BYTES_SAVED(B) do { \
+	CTX_HIST_ADD(hist_bytes_saved, B); \
 } while(0)
 
 /*
@@ -62,11 +127,20 @@ extern ltckpt_ctx_t *ltckpt_ctx;
  * ./clientctl dumpcp pids
  * ./clientctl bench
  * ./clientctl dumpcp pids
+ *
+ * With CP_HIST=1, the dump also reports p50/p99/p999 for checkpoint and
+ * restart latency (in cycles), bytes saved and log size per checkpoint.
  */
 void ltckpt_ctx_clear() __attribute__((used));
 void ltckpt_ctx_print() __attribute__((used));
 void ltckpt_ctx_clear_default();
 void ltckpt_ctx_print_default();
+void ltckpt_ctx_hist_print(const char *name, ltckpt_hist_t *hist);
+void ltckpt_ctx_hist_print_all() __attribute__((used));
+
+void ltckpt_ctx_shm_init();
+void ltckpt_ctx_shm_publish();
+void ltckpt_ctx_shm_close();
 
 void ltckpt_ctx_set(ltckpt_ctx_t *ctx);
 void* ltkcpt_ctx_get_buff(void *addr, size_t len);
@@ -0,0 +1,109 @@
+#ifndef LTCKPT_HIST_H
+#define LTCKPT_HIST_H
+
+/*
+ * HDR-style log-bucketed histograms. Each power-of-two range is split in
+ * 2^LTCKPT_HIST_SUB_BITS linear sub-buckets, so the relative error of a
+ * reported value is bounded by 1/2^LTCKPT_HIST_SUB_BITS. Values are clamped
+ * to the last bucket. Histograms live in the checkpointing context, so they
+ * must stay small (see the PAGE_SIZE assertions on ltckpt_ctx_t).
+ */
+#ifndef LTCKPT_HIST_SUB_BITS
+#define LTCKPT_HIST_SUB_BITS     2
+#endif
+
+#ifndef LTCKPT_HIST_MAX_LOG2
+#define LTCKPT_HIST_MAX_LOG2     40
+#endif
+
+#define LTCKPT_HIST_SUB_BUCKETS  (1 << LTCKPT_HIST_SUB_BITS)
+#define LTCKPT_HIST_NUM_BUCKETS  \
+	((LTCKPT_HIST_MAX_LOG2 - LTCKPT_HIST_SUB_BITS + 2) * LTCKPT_HIST_SUB_BUCKETS)
+
+typedef struct ltckpt_hist_s {
+	unsigned long long count;
+	unsigned long long min;
+	unsigned long long max;
+	unsigned int buckets[LTCKPT_HIST_NUM_BUCKETS];
+} ltckpt_hist_t;
+
+static inline unsigned long long ltckpt_hist_tsc_read()
+{
+#if defined(__x86_64__)
+	unsigned long long hi, lo;
+	__asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return lo | (hi << 32);
+#else
+	unsigned long long x;
+	__asm__ volatile ("rdtsc" : "=A" (x));
+	return x;
+#endif
+}
+
+static inline int ltckpt_hist_bucket(unsigned long long value)
+{
+	int msb, index;
+
+	if (value < LTCKPT_HIST_SUB_BUCKETS) {
+		return (int) value;
+	}
+	msb = 63 - __builtin_clzll(value);
+	index = ((msb - LTCKPT_HIST_SUB_BITS + 1) << LTCKPT_HIST_SUB_BITS)
+		| (int) ((value >> (msb - LTCKPT_HIST_SUB_BITS)) & (LTCKPT_HIST_SUB_BUCKETS - 1));
+	if (index >= LTCKPT_HIST_NUM_BUCKETS) {
+		index = LTCKPT_HIST_NUM_BUCKETS - 1;
+	}
+	return index;
+}
+
+/* Highest value that falls in the given bucket. */
+static inline unsigned long long ltckpt_hist_bucket_value(int index)
+{
+	int shift;
+	unsigned long long base;
+
+	if (index < LTCKPT_HIST_SUB_BUCKETS) {
+		return index;
+	}
+	shift = (index >> LTCKPT_HIST_SUB_BITS) - 1;
+	base = (unsigned long long) (LTCKPT_HIST_SUB_BUCKETS | (index & (LTCKPT_HIST_SUB_BUCKETS - 1))) << shift;
+	return base + (1ULL << shift) - 1;
+}
+
+static inline void ltckpt_hist_add(ltckpt_hist_t *hist, unsigned long long value)
+{
+	if (!hist->count || value < hist->min) {
+		hist->min = value;
+	}
+	if (value > hist->max) {
+		hist->max = value;
+	}
+	hist->count++;
+	hist->buckets[ltckpt_hist_bucket(value)]++;
+}
+
+/* Percentile expressed in tenths of a percent (e.g., 999 for p99.9). */
+static inline unsigned long long ltckpt_hist_percentile(ltckpt_hist_t *hist,
+	unsigned permille)
+{
+	int i;
+	unsigned long long target, seen = 0, value;
+
+	if (!hist->count) {
+		return 0;
+	}
+	target = (hist->count * permille + 999) / 1000;
+	if (!target) {
+		target = 1;
+	}
+	for (i = 0; i < LTCKPT_HIST_NUM_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			break;
+		}
+	}
+	value = ltckpt_hist_bucket_value(i < LTCKPT_HIST_NUM_BUCKETS ? i : LTCKPT_HIST_NUM_BUCKETS - 1);
+	return value > hist->max ? hist->max : value;
+}
+
+#endif /* LTCKPT_HIST_H */
@@ -0,0 +1,168 @@
+#include "ltckpt_local.h"
+#include "ltckpt_log.h"
+
+#if LTCKPT_CFG_LOG_RING
+
+#include <pthread.h>
+#include <signal.h>
+
+#define LTCKPT_LOG_LINE_SIZE 512
+#define LTCKPT_LOG_GUARD_SIZE LTCKPT_LOG_PAGE_SIZE
+
+ltckpt_log_ring_t *ltckpt_log_ring;
+
+static pthread_t ltckpt_log_flusher;
+
+static void ltckpt_log_write(const char *buff, size_t len)
+{
+	FILE *fp = CTX(output_conf).fp ? CTX(output_conf).fp : stderr;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fileno(fp), buff, len);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		buff += ret;
+		len -= ret;
+	}
+}
+
+/* Single consumer, callers serialize on ring->flushing. */
+static void ltckpt_log_drain(ltckpt_log_ring_t *ring)
+{
+	ltckpt_log_entry_t *entry;
+	uint64_t *a;
+	char *line;
+	size_t len = 0;
+	int ret, verbose = LTCKPT_IS_VERBOSE();
+
+	while (1) {
+		entry = &ring->entries[ring->tail & (LTCKPT_LOG_RING_ENTRIES-1)];
+		if (entry->seq != ring->tail + 1) {
+			break;
+		}
+		__sync_synchronize();
+		if (verbose) {
+			if (len + LTCKPT_LOG_LINE_SIZE > LTCKPT_LOG_BUFF_SIZE) {
+				ltckpt_log_write(ring->buff, len);
+				len = 0;
+			}
+			a = entry->args;
+			line = ring->buff + len;
+			ret = snprintf(line, LTCKPT_LOG_LINE_SIZE, "%s: ", entry->func);
+			ret += snprintf(line + ret, LTCKPT_LOG_LINE_SIZE - ret, entry->fmt,
+				a[0], a[1], a[2], a[3], a[4], a[5]);
+			len += ret < LTCKPT_LOG_LINE_SIZE ? ret : LTCKPT_LOG_LINE_SIZE - 1;
+		}
+		entry->seq = ring->tail + LTCKPT_LOG_RING_ENTRIES;
+		ring->tail++;
+	}
+	if (len) {
+		ltckpt_log_write(ring->buff, len);
+	}
+}
+
+void ltckpt_log_flush()
+{
+	ltckpt_log_ring_t *ring = ltckpt_log_ring;
+
+	if (!ring) {
+		return;
+	}
+	while (__sync_lock_test_and_set(&ring->flushing, 1));
+	ltckpt_log_drain(ring);
+	__sync_lock_release(&ring->flushing);
+}
+
+static void *ltckpt_log_flusher_main(void *arg)
+{
+	sigset_t sigset;
+
+	/*
+	 * Leave the application's signals to the application's threads, but
+	 * not the synchronous faults: a blocked SIGSEGV/SIGBUS kills the
+	 * process instead of reaching the checkpointer's handler.
+	 */
+	sigfillset(&sigset);
+	sigdelset(&sigset, SIGSEGV);
+	sigdelset(&sigset, SIGBUS);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+	while (1) {
+		ltckpt_log_flush();
+		usleep(LTCKPT_LOG_FLUSH_US);
+	}
+
+	return NULL;
+}
+
+static void ltckpt_log_ring_reset(ltckpt_log_ring_t *ring)
+{
+	uint64_t i;
+
+	for (i = 0; i < LTCKPT_LOG_RING_ENTRIES; i++) {
+		ring->entries[i].seq = i;
+	}
+	ring->head = ring->tail = 0;
+	ring->dropped = 0;
+}
+
+static void ltckpt_log_atfork_child()
+{
+	/* The flusher did not survive the fork, and may have held the lock. */
+	__sync_lock_release(&ltckpt_log_ring->flushing);
+	/*
+	 * The parent flushes the entries it had not drained yet, and slots
+	 * claimed by threads that did not survive the fork would never be
+	 * published, so start over with an empty ring.
+	 */
+	ltckpt_log_ring_reset(ltckpt_log_ring);
+	if (pthread_create(&ltckpt_log_flusher, NULL, ltckpt_log_flusher_main, NULL)) {
+		ltckpt_printf_error("ERROR: unable to start the log flusher\n");
+	}
+}
+
+int ltckpt_log_ring_overlaps(unsigned long start, unsigned long end)
+{
+	unsigned long ring = (unsigned long) ltckpt_log_ring;
+
+	return ring && start < ring + LTCKPT_LOG_RING_SIZE && ring < end;
+}
+
+void ltckpt_log_init()
+{
+	ltckpt_log_ring_t *ring;
+	ltckpt_va_t area;
+
+	if (ltckpt_log_ring) {
+		return;
+	}
+	/*
+	 * Keep the ring in a VMA of its own between two PROT_NONE guard
+	 * pages, so that the kernel never merges it with an adjacent
+	 * application mapping the checkpointer must not skip.
+	 */
+	area = ltckpt_mmap(0, LTCKPT_LOG_RING_SIZE + 2*LTCKPT_LOG_GUARD_SIZE,
+		LTCKPT_PROT_N, LTCKPT_MAP_PRIVATE | LTCKPT_MAP_NORESERVE);
+	if (area == LTCKPT_MAP_FAILED
+		|| ltckpt_mprotect(area + LTCKPT_LOG_GUARD_SIZE, LTCKPT_LOG_RING_SIZE,
+		LTCKPT_PROT_R | LTCKPT_PROT_W)) {
+		ltckpt_printf_error("ERROR: unable to allocate the log ring: %s\n",
+			strerror(errno));
+		return;
+	}
+	ring = LTCKPT_VA_TO_PTR(area + LTCKPT_LOG_GUARD_SIZE);
+	ltckpt_log_ring_reset(ring);
+	__sync_synchronize();
+	ltckpt_log_ring = ring;
+
+	if (pthread_create(&ltckpt_log_flusher, NULL, ltckpt_log_flusher_main, NULL)) {
+		ltckpt_printf_error("ERROR: unable to start the log flusher, flushing at exit only\n");
+	}
+	pthread_atfork(NULL, NULL, ltckpt_log_atfork_child);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef LTCKPT_LOG_H
+#define LTCKPT_LOG_H 1
+
+#include <stdint.h>
+
+/*
+ * Ring-buffer logger for the hot paths (store hooks, top of the loop),
+ * enabled at build time with LTCKPT_LOG_RING=1. A log call only claims a
+ * slot with a CAS and stores the format string pointer (its ID) and up to
+ * LTCKPT_LOG_MAX_ARGS integer/pointer arguments; a background thread
+ * formats the entries into the ltckpt output file every
+ * LTCKPT_LOG_FLUSH_US. Entries are dropped (and counted) when the ring is
+ * full, the caller never blocks on stdio.
+ *
+ * Formats must be string literals and take integer or pointer arguments
+ * only, %s arguments must point to static strings.
+ */
+#ifndef LTCKPT_CFG_LOG_RING
+#define LTCKPT_CFG_LOG_RING 0
+#endif
+
+#ifdef __MINIX
+#undef LTCKPT_CFG_LOG_RING
+#define LTCKPT_CFG_LOG_RING 0
+#endif
+
+#ifndef LTCKPT_LOG_RING_ENTRIES
+#define LTCKPT_LOG_RING_ENTRIES (1<<16)
+#endif
+
+#ifndef LTCKPT_LOG_FLUSH_US
+#define LTCKPT_LOG_FLUSH_US 1000
+#endif
+
+#define LTCKPT_LOG_MAX_ARGS 6
+
+#if LTCKPT_CFG_LOG_RING
+
+typedef struct ltckpt_log_entry_s {
+	volatile uint64_t seq;
+	const char *func;
+	const char *fmt;
+	uint64_t args[LTCKPT_LOG_MAX_ARGS];
+} ltckpt_log_entry_t;
+
+#define LTCKPT_LOG_BUFF_SIZE (64*1024)
+#define LTCKPT_LOG_PAGE_SIZE 4096
+
+/*
+ * Everything the flusher writes (cursors, lock, format buffer) lives in
+ * the ring mapping, which the checkpointer skips. A store to .data/.bss
+ * from the flusher would fault on a write-protected page or dirty one.
+ */
+typedef struct ltckpt_log_ring_s {
+	volatile uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+	volatile unsigned long dropped;
+	volatile int flushing;
+	char buff[LTCKPT_LOG_BUFF_SIZE] __attribute__((aligned(64)));
+	ltckpt_log_entry_t entries[LTCKPT_LOG_RING_ENTRIES];
+} ltckpt_log_ring_t;
+
+/* Set once by ltckpt_log_init(), NULL while logging is off. */
+extern ltckpt_log_ring_t *ltckpt_log_ring;
+
+#define LTCKPT_LOG_RING_SIZE \
+	((sizeof(ltckpt_log_ring_t) + LTCKPT_LOG_PAGE_SIZE-1) \
+	& ~(LTCKPT_LOG_PAGE_SIZE-1))
+
+/* Whether [start, end) overlaps the log ring. */
+int ltckpt_log_ring_overlaps(unsigned long start, unsigned long end);
+
+/*
+ * Bounded MPSC queue: slot seq == pos when free for position pos and
+ * pos+1 once the entry is published to the flusher.
+ */
+static inline void ltckpt_log_append(const char *func, const char *fmt,
+	const uint64_t *args, unsigned nargs)
+{
+	ltckpt_log_ring_t *ring = ltckpt_log_ring;
+	ltckpt_log_entry_t *entry;
+	uint64_t pos;
+	unsigned i;
+
+	if (!ring) {
+		return;
+	}
+	for (;;) {
+		pos = ring->head;
+		entry = &ring->entries[pos & (LTCKPT_LOG_RING_ENTRIES-1)];
+		if ((int64_t) (entry->seq - pos) < 0) {
+			/* Full, the flusher did not get to this slot yet. */
+			__sync_fetch_and_add(&ring->dropped, 1);
+			return;
+		}
+		if (entry->seq == pos && __sync_bool_compare_and_swap(
+			&ring->head, pos, pos + 1)) {
+			break;
+		}
+	}
+
+	entry->func = func;
+	entry->fmt = fmt;
+	for (i = 0; i < nargs; i++) {
+		entry->args[i] = args[i];
+	}
+	__sync_synchronize();
+	entry->seq = pos + 1;
+}
+
+#define LTCKPT_LOG_ARG(A) ((uint64_t) (uintptr_t) (A))
+#define LTCKPT_LOG_ARGS_0()
+#define LTCKPT_LOG_ARGS_1(A) LTCKPT_LOG_ARG(A)
+#define LTCKPT_LOG_ARGS_2(A, ...) LTCKPT_LOG_ARG(A), LTCKPT_LOG_ARGS_1(__VA_ARGS__)
+#define LTCKPT_LOG_ARGS_3(A, ...) LTCKPT_LOG_ARG(A), LTCKPT_LOG_ARGS_2(__VA_ARGS__)
+#define LTCKPT_LOG_ARGS_4(A, ...) LTCKPT_LOG_ARG(A), LTCKPT_LOG_ARGS_3(__VA_ARGS__)
+#define LTCKPT_LOG_ARGS_5(A, ...) LTCKPT_LOG_ARG(A), LTCKPT_LOG_ARGS_4(__VA_ARGS__)
+#define LTCKPT_LOG_ARGS_6(A, ...) LTCKPT_LOG_ARG(A), LTCKPT_LOG_ARGS_5(__VA_ARGS__)
+#define LTCKPT_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+#define LTCKPT_LOG_NARGS(...) LTCKPT_LOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LTCKPT_LOG_CAT_(A, B) A ## B
+#define LTCKPT_LOG_CAT(A, B) LTCKPT_LOG_CAT_(A, B)
+
+#define ltckpt_log(fmt, ...) do { \
+	const uint64_t __ltckpt_log_args[LTCKPT_LOG_MAX_ARGS + 1] = { 0, \
+		LTCKPT_LOG_CAT(LTCKPT_LOG_ARGS_, LTCKPT_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__) }; \
+	ltckpt_log_append(__func__, fmt, __ltckpt_log_args + 1, \
+		LTCKPT_LOG_NARGS(__VA_ARGS__)); \
+} while(0)
+
+void ltckpt_log_init();
+void ltckpt_log_flush();
+
+#else
+#define ltckpt_log(fmt, ...)
+#define ltckpt_log_init()
+#define ltckpt_log_flush()
+#endif
+
+#endif
@@ -1,7 +1,9 @@
 #define _GNU_SOURCE
 #include "ltckpt_local.h"
+#include "ltckpt_storeprof.h"
 
 #include <stdlib.h>
+#include <stdarg.h>
 
 #define LTCKPT_EXIT_WRAPPER(E) \
 	void E(int status); \
@@ -16,11 +18,14 @@ void ltckpt_before_exit(int status)
 	if (CTX(exited))
 		return;
 
+	ltckpt_log_flush();
+	ltckpt_storeprof_dump();
 	if (CTX(atexit_dump))
 		ltckpt_ctx_print();
 
 	if (CONF(before_exit_hook))
 		CONF(before_exit_hook)(status);
+	ltckpt_ctx_shm_close();
 	CTX(exited)=1;
 }
 
@@ -33,6 +38,88 @@ LTCKPT_EXIT_WRAPPER(_exit)
 /* _Exit() */
 LTCKPT_EXIT_WRAPPER(_Exit)
 
+/*
+ * Address space changes, reported to the VMA tracker.
+ */
+LTCKPT_POST_WRAPPER(void*, mmap,
+	LTCKPT_CONCAT(void *addr, size_t length, int prot, int flags, int fd,
+		off_t offset),
+	LTCKPT_CONCAT(addr, length, prot, flags, fd, offset),
+
+	if (ret != MAP_FAILED) {
+		ltckpt_vmas_mmap(ret, length, prot, flags, fd, offset);
+	}
+)
+
+LTCKPT_POST_WRAPPER(int, munmap,
+	LTCKPT_CONCAT(void *addr, size_t length),
+	LTCKPT_CONCAT(addr, length),
+
+	if (ret == 0) {
+		ltckpt_vmas_munmap(addr, length);
+	}
+)
+
+LTCKPT_POST_WRAPPER(int, mprotect,
+	LTCKPT_CONCAT(void *addr, size_t len, int prot),
+	LTCKPT_CONCAT(addr, len, prot),
+
+	if (ret == 0) {
+		ltckpt_vmas_mprotect(addr, len, prot);
+	}
+)
+
+LTCKPT_POST_WRAPPER(int, brk,
+	LTCKPT_CONCAT(void *addr),
+	LTCKPT_CONCAT(addr),
+
+	if (ret == 0) {
+		ltckpt_vmas_brk();
+	}
+)
+
+LTCKPT_POST_WRAPPER(void*, sbrk,
+	LTCKPT_CONCAT(intptr_t increment),
+	LTCKPT_CONCAT(increment),
+
+	if (ret != (void*) -1 && increment) {
+		ltckpt_vmas_brk();
+	}
+)
+
+#if LTCKPT_ENABLE_WRAPPERS
+/* mremap() is variadic and cannot be modelled, just invalidate. */
+void *(*ltckpt_real_mremap)(void *old_address, size_t old_size,
+	size_t new_size, int flags, ...);
+void __attribute__((constructor)) ltckpt_init_mremap()
+{
+	ltckpt_real_mremap = dlsym(RTLD_NEXT, "mremap");
+	assert(ltckpt_real_mremap);
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size,
+	int flags, ...)
+{
+	va_list ap;
+	void *new_address = NULL, *ret;
+
+	if (!ltckpt_real_mremap) {
+		ltckpt_init_mremap();
+	}
+	if (flags & MREMAP_FIXED) {
+		va_start(ap, flags);
+		new_address = va_arg(ap, void*);
+		va_end(ap);
+	}
+	ret = ltckpt_real_mremap(old_address, old_size, new_size, flags,
+		new_address);
+	if (ret != MAP_FAILED) {
+		ltckpt_vmas_invalidate();
+	}
+	return ret;
+}
+#endif
+
 void __ltckpt_before_exit(void)
 {
 	ltckpt_before_exit(0);
@@ -11,6 +11,9 @@ window_shutter g_shutter_board[LTCKPT_MAX_WINDOW_SHUTTERS] = {};
 char g_module_name[LTCKPT_MODULE_NAME_SIZE] = "none";
 int wshutter_prof_curr_bb_in = 0;
 
+// runtime switch for window transition profiling (see LTCKPT_WINDOW_PROF)
+int wshutter_prof_enabled = LTCKPT_WINDOW_PROF;
+
 // dummy value. Will be initialized to a good value by recovery.so instrumentation.
 UINT64_T g_num_window_shutters = 0;
 UINT64_T g_num_kernelcall_shutters = 0;
@@ -42,6 +45,16 @@ uint64_t g_num_suicides = 0;
 
 int ltckpt_send_reply(message msg);
 
+/*
+ * Window transition counters. Kept out of g_shutter_board, which is only
+ * read on the transition path (suicide switches), and merged into
+ * g_shutter_board[].prof at dump time.
+ */
+#if LTCKPT_WINDOW_PROF
+static wshutter_prof_t wshutter_prof[LTCKPT_MAX_WINDOW_SHUTTERS]
+	__attribute__((aligned(64)));
+#endif
+
 void ltckpt_dump_glo_prof_data()
 {
   ltckpt_printf("Window profiling data for : %s\n", g_module_name);
@@ -51,8 +64,19 @@ void ltckpt_dump_glo_prof_data()
   ltckpt_printf("Num window opens: %llu\n\n", g_num_window_opens);
 }
 
+static void ltckpt_merge_shutter_prof()
+{
+#if LTCKPT_WINDOW_PROF
+	for (unsigned i=0; i < LTCKPT_MAX_WINDOW_SHUTTERS; i++)
+	{
+		g_shutter_board[i].prof = wshutter_prof[i];
+	}
+#endif
+}
+
 void ltckpt_dump_shutter_board()
 {
+	ltckpt_merge_shutter_prof();
 	ltckpt_printf("%s :=\tDeterministic Faults enabled? %d \n", g_module_name, suicide_on_window_close);
 	ltckpt_printf("Suicide switchboard status: \t (size: %llu)\n", g_num_window_shutters);
 
@@ -98,6 +122,7 @@ suicide_on_window_close = 1;
 		wprof_enable_stats = wprof_enable_stats ? 0 : 1;
 		if (!wprof_enable_stats) {
 		    ltckpt_dump_glo_prof_data();
+		    ltckpt_wprof_dump();
    		 }
 #endif
 	return 0;
@@ -159,10 +184,12 @@ int ltckpt_close_r_window(UINT64_T site_id)
 		// currently window is open, so we can close the window.
 		sa_window__is_open = 0;
 
+#if LTCKPT_WINDOW_PROF
 		if(wprof_enable_stats)
 		{
 			wprof.glo.rwindow.end++;
 		}
+#endif
 		return 1; // successfully closed the window.
 	}
 	return 0; // not closing the window.
@@ -171,16 +198,18 @@ int ltckpt_close_r_window(UINT64_T site_id)
 __attribute__((always_inline))
 int ltckpt_transit_window(UINT64_T site_id)
 {
-	CHECK_SHUTTER_BOARD_SIZE(site_id, 0)
-	g_shutter_board[(unsigned)site_id].prof.num_end++;
-	if (wprof_enable_stats)
+#if LTCKPT_WINDOW_PROF
+	wshutter_prof_t *p_prof;
+
+	if (!wshutter_prof_enabled)
 	{
-		if (0 == g_shutter_board[(unsigned)site_id].prof.bb_in)
-		{
-			g_shutter_board[(unsigned)site_id].prof.bb_in = wshutter_prof_curr_bb_in;
-		}
+		return 0;
 	}
+	CHECK_SHUTTER_BOARD_SIZE(site_id, 0)
+	p_prof = &wshutter_prof[(unsigned)site_id];
+	ltckpt_wshutter_prof_transit(p_prof, wprof_enable_stats, wshutter_prof_curr_bb_in);
 	// ltckpt_printf("Window transition @ site %llu \n", site_id);
+#endif
 	return 0;
 }
 
@@ -487,45 +516,39 @@ int ltckpt_recovery_dispatcher(void *info)
 		return LTCKPT_RECOVERY_SUCCESS;
 	}
 #endif
-	switch (g_recovery_naive_mode) {
-	case LTCKPT_RECOVERY_NAIVE_MODE_NEVER_REPLY: replyable = 0; break;
-	case LTCKPT_RECOVERY_NAIVE_MODE_ALWAYS_REPLY: replyable = 1; break;
-	}
-	switch(replyable)
+	switch (ltckpt_recovery_select_policy(g_recovery_bitmask, replyable,
+		g_recovery_naive_mode))
 	{
-		case 1:
-			if (g_recovery_bitmask & LTCKPT_RECOVERY_MASK_FAIL_STOP)
-			{
-				hypermem_log(g_recovery_bitmask_reason ? : "ltckpt recovery: window closed: reason unknown");
-				hypermem_log_callsites();
-				r = ltckpt_recovery_fail_stop(info);
-			}
-			else if (g_recovery_bitmask & LTCKPT_RECOVERY_MASK_PROCESS_SPECIFIC)
-			{
-				r = ltckpt_recovery_process_specific(info);
-			}
-			else if (g_recovery_bitmask & LTCKPT_RECOVERY_MASK_REQUEST_SPECIFIC)
-			{
-				r = ltckpt_recovery_request_specific(info);
-			}
-			else if (g_recovery_bitmask & LTCKPT_RECOVERY_MASK_IDEMPOTENT)
-			{
-				r = ltckpt_recovery_idempotent(info);
-			}
-			else
-			{
-				// we shouldn't ever get here.
-				hypermem_log("ltckpt recovery: failed: invalid g_recovery_bitmask bitmask");
-				ltckpt_printf("%s : Error!! Ran out of options in recovery_dispatcher.\n", "recovery dispatcher");
-			}
+		case LTCKPT_RECOVERY_POLICY_FAIL_STOP:
+			hypermem_log(g_recovery_bitmask_reason ? : "ltckpt recovery: window closed: reason unknown");
+			hypermem_log_callsites();
+			r = ltckpt_recovery_fail_stop(info);
+			break;
+
+		case LTCKPT_RECOVERY_POLICY_PROCESS_SPECIFIC:
+			r = ltckpt_recovery_process_specific(info);
+			break;
+
+		case LTCKPT_RECOVERY_POLICY_REQUEST_SPECIFIC:
+			r = ltckpt_recovery_request_specific(info);
+			break;
+
+		case LTCKPT_RECOVERY_POLICY_IDEMPOTENT:
+			r = ltckpt_recovery_idempotent(info);
+			break;
+
+		case LTCKPT_RECOVERY_POLICY_BAD_BITMASK:
+			// we shouldn't ever get here.
+			hypermem_log("ltckpt recovery: failed: invalid g_recovery_bitmask bitmask");
+			ltckpt_printf("%s : Error!! Ran out of options in recovery_dispatcher.\n", "recovery dispatcher");
 			break;
 
-		case 0:
+		case LTCKPT_RECOVERY_POLICY_NON_REPLYABLE:
 			hypermem_log_nonreplyable(msgtype, r);
 			ltckpt_printf("%s : non-replyable message\n", "recovery dispatcher");
 			break;
 
-		case -1:
+		case LTCKPT_RECOVERY_POLICY_NO_MESSAGE:
 			hypermem_log("ltckpt recovery: failed: havent handled message");
 			ltckpt_printf("%s : havent handled message \n", "recovery dispatcher");
 			break;
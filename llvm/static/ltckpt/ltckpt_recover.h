@@ -7,6 +7,15 @@
 #define LTCKPT_MAX_WINDOW_SHUTTERS		2560
 #define LTCKPT_MODULE_NAME_SIZE			10
 
+/*
+ * Window transition profiling (num transits and bb_in per site). When 0,
+ * ltckpt_transit_window() is a no-op and window transitions only flip
+ * sa_window__is_open.
+ */
+#ifndef LTCKPT_WINDOW_PROF
+#define LTCKPT_WINDOW_PROF				1
+#endif
+
 // Bitmasks indicating recovery policies
 
 #define LTCKPT_RECOVERY_MASK_IDEMPOTENT			0x1
@@ -24,6 +33,23 @@
 #define LTCKPT_RECOVERY_FAILURE					-1
 #define LTCKPT_RECOVERY_SUCCESS					 0
 
+// Recovery actions selected by ltckpt_recovery_select_policy()
+typedef enum ltckpt_recovery_policy_e {
+	LTCKPT_RECOVERY_POLICY_FAIL_STOP,
+	LTCKPT_RECOVERY_POLICY_PROCESS_SPECIFIC,
+	LTCKPT_RECOVERY_POLICY_REQUEST_SPECIFIC,
+	LTCKPT_RECOVERY_POLICY_IDEMPOTENT,
+	LTCKPT_RECOVERY_POLICY_BAD_BITMASK,		// no policy bit set
+	LTCKPT_RECOVERY_POLICY_NON_REPLYABLE,
+	LTCKPT_RECOVERY_POLICY_NO_MESSAGE,		// haven't handled message
+	LTCKPT_RECOVERY_POLICY_BAD_REPLYABLE,
+	__NUM_LTCKPT_RECOVERY_POLICIES
+} ltckpt_recovery_policy_t;
+
+#define LTCKPT_RECOVERY_POLICY_NAMES { "fail_stop", "process_specific", \
+	"request_specific", "idempotent", "bad_bitmask", "non_replyable", \
+	"no_message", "bad_replyable" }
+
 #define OK 0
 #define NOT_OK -1
 
@@ -55,8 +81,41 @@ extern int sa_window__is_open;
 extern int wshutter_prof_curr_bb_in;
 extern int wprof_enable_stats;
 extern wprof_t wprof;
-static int prior_have_handled_message = 0;
-static int wshutter_prof_enabled = 0;
+extern int wshutter_prof_enabled;
+static int prior_have_handled_message __attribute__((unused)) = 0;
+
+/*
+ * Pick the recovery action for the current window state. replyable is the
+ * result of ltckpt_is_message_replyable(), possibly overridden by the naive
+ * mode. Platform-independent, so it can also drive the Linux replay harness.
+ */
+static inline ltckpt_recovery_policy_t ltckpt_recovery_select_policy(
+	unsigned int bitmask, int replyable, unsigned int naive_mode)
+{
+	switch (naive_mode) {
+	case LTCKPT_RECOVERY_NAIVE_MODE_NEVER_REPLY: replyable = 0; break;
+	case LTCKPT_RECOVERY_NAIVE_MODE_ALWAYS_REPLY: replyable = 1; break;
+	}
+	switch (replyable)
+	{
+		case 1:
+			if (bitmask & LTCKPT_RECOVERY_MASK_FAIL_STOP)
+				return LTCKPT_RECOVERY_POLICY_FAIL_STOP;
+			if (bitmask & LTCKPT_RECOVERY_MASK_PROCESS_SPECIFIC)
+				return LTCKPT_RECOVERY_POLICY_PROCESS_SPECIFIC;
+			if (bitmask & LTCKPT_RECOVERY_MASK_REQUEST_SPECIFIC)
+				return LTCKPT_RECOVERY_POLICY_REQUEST_SPECIFIC;
+			if (bitmask & LTCKPT_RECOVERY_MASK_IDEMPOTENT)
+				return LTCKPT_RECOVERY_POLICY_IDEMPOTENT;
+			return LTCKPT_RECOVERY_POLICY_BAD_BITMASK;
+		case 0:
+			return LTCKPT_RECOVERY_POLICY_NON_REPLYABLE;
+		case -1:
+			return LTCKPT_RECOVERY_POLICY_NO_MESSAGE;
+		default:
+			return LTCKPT_RECOVERY_POLICY_BAD_REPLYABLE;
+	}
+}
 
 typedef unsigned long long wdata_t;
 
@@ -72,6 +131,21 @@ typedef struct window_shutter
 	wshutter_prof_t prof;
 } window_shutter;
 
+/*
+ * Account a window transition in the site's counters, which live off the
+ * shutter board (see ltckpt_transit_window()). bb_in is the basic block
+ * count at the first transition, if stats is set.
+ */
+static inline void ltckpt_wshutter_prof_transit(wshutter_prof_t *p_prof,
+	int stats, int curr_bb_in)
+{
+	p_prof->num_end++;
+	if (stats && 0 == p_prof->bb_in)
+	{
+		p_prof->bb_in = curr_bb_in;
+	}
+}
+
 char *hypermem_cat(char *p, char *pend, const char *s);
 char *hypermem_cat_num(char *p, char *pend, long long n);
 void hypermem_log(const char *msg);
@@ -0,0 +1,274 @@
+#include "ltckpt_local.h"
+#include "ltckpt_compress.h"
+
+#include <ltckpt/snapshot.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+typedef struct ltckpt_snapshot_s {
+	char *buff;
+	size_t buff_len;
+	off_t offset;
+	int fd;
+	pid_t child;
+	pid_t parent;
+	util_proc_maps_t maps;
+	char path[512];
+} ltckpt_snapshot_t;
+
+static ltckpt_snapshot_t ltckpt_snapshot = { NULL, 0, 0, -1 };
+
+/*
+ * VMAs made of ltckpt's own ranges only are dropped here, the ones the
+ * kernel merged with application memory are clipped when written.
+ */
+static int ltckpt_snapshot_filter_cb(util_proc_maps_entry_t *entry, void *cb_args)
+{
+	if (ltckpt_owned_covers(entry->vm_start, entry->vm_end)) {
+		return UTIL_PROC_MAPS_RET_CONTINUE;
+	}
+	if (!ltcpt_is_checkpointed_vma(entry)) {
+		return UTIL_PROC_MAPS_RET_CONTINUE;
+	}
+
+	return UTIL_PROC_MAPS_RET_SAVE;
+}
+
+/*
+ * The functions below run in the cloned child, which shares no locks
+ * with the parent's threads: only plain system calls, no stdio or malloc.
+ */
+static int ltckpt_snapshot_flush(size_t len)
+{
+	ssize_t ret;
+	size_t done = 0;
+
+	while (done < len) {
+		ret = pwrite(ltckpt_snapshot.fd, ltckpt_snapshot.buff + done,
+			len - done, ltckpt_snapshot.offset + done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		done += ret;
+	}
+	ltckpt_snapshot.offset += len;
+	ltckpt_snapshot.buff_len = 0;
+
+	return 0;
+}
+
+static int ltckpt_snapshot_append(const void *src, size_t len)
+{
+	const char *p = (const char*) src;
+	size_t n;
+
+	while (len > 0) {
+		n = LTCKPT_SNAPSHOT_BUFF_SIZE - ltckpt_snapshot.buff_len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(ltckpt_snapshot.buff + ltckpt_snapshot.buff_len, p, n);
+		ltckpt_snapshot.buff_len += n;
+		p += n;
+		len -= n;
+		if (ltckpt_snapshot.buff_len == LTCKPT_SNAPSHOT_BUFF_SIZE
+			&& ltckpt_snapshot_flush(LTCKPT_SNAPSHOT_BUFF_SIZE) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int ltckpt_snapshot_append_range(struct ltckpt_snapshot_header *header,
+	char *start, char *end)
+{
+	struct ltckpt_snapshot_range range;
+
+	if (start == end) {
+		return 0;
+	}
+	range.addr = (uint64_t) (unsigned long) start;
+	range.len = end - start;
+	header->num_ranges++;
+	header->num_bytes += range.len;
+
+	return ltckpt_snapshot_append(&range, sizeof(range))
+		|| ltckpt_snapshot_append(start, range.len) ? -1 : 0;
+}
+
+/* Append the nonzero pages of [start, end) as ranges. */
+static int ltckpt_snapshot_append_pages(struct ltckpt_snapshot_header *header,
+	char *start, char *end)
+{
+	char *page;
+
+	for (page = start; page < end; page += PAGE_SIZE) {
+		if (!ltckpt_page_is_zero(page)) {
+			continue;
+		}
+		if (ltckpt_snapshot_append_range(header, start, page) < 0) {
+			return -1;
+		}
+		start = page + PAGE_SIZE;
+	}
+
+	return ltckpt_snapshot_append_range(header, start, end);
+}
+
+static int ltckpt_snapshot_write(uint64_t checkpoint)
+{
+	struct ltckpt_snapshot_header header;
+	util_proc_maps_entry_t *entry;
+	unsigned long addr, ostart, oend;
+	off_t size;
+	size_t pad;
+	int i;
+
+	setpriority(PRIO_PROCESS, 0, 19);
+	ltckpt_snapshot.fd = open(ltckpt_snapshot.path,
+		O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC|O_DIRECT, 0644);
+	if (ltckpt_snapshot.fd < 0 && errno == EINVAL) {
+		/* No O_DIRECT support (e.g., tmpfs). */
+		ltckpt_snapshot.fd = open(ltckpt_snapshot.path,
+			O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC, 0644);
+	}
+	if (ltckpt_snapshot.fd < 0) {
+		return -1;
+	}
+
+	/* Header block placeholder, written for real at the end. */
+	memset(&header, 0, sizeof(header));
+	memset(ltckpt_snapshot.buff, 0, LTCKPT_SNAPSHOT_HEADER_SIZE);
+	ltckpt_snapshot.buff_len = LTCKPT_SNAPSHOT_HEADER_SIZE;
+	ltckpt_snapshot.offset = 0;
+
+	for (i = 0; i < ltckpt_snapshot.maps.num_entries; i++) {
+		entry = &ltckpt_snapshot.maps.entries[i];
+		addr = entry->vm_start;
+		while (addr < entry->vm_end) {
+			if (!ltckpt_owned_next(addr, entry->vm_end, &ostart, &oend)) {
+				ostart = oend = entry->vm_end;
+			}
+			if (ostart > addr && ltckpt_snapshot_append_pages(&header,
+				(char*) addr, (char*) ostart) < 0) {
+				return -1;
+			}
+			addr = oend;
+		}
+	}
+
+	/* O_DIRECT wants whole blocks, trim the padding afterwards. */
+	size = ltckpt_snapshot.offset + ltckpt_snapshot.buff_len;
+	pad = (PAGE_SIZE - ltckpt_snapshot.buff_len % PAGE_SIZE) % PAGE_SIZE;
+	memset(ltckpt_snapshot.buff + ltckpt_snapshot.buff_len, 0, pad);
+	if (ltckpt_snapshot_flush(ltckpt_snapshot.buff_len + pad) < 0
+		|| ftruncate(ltckpt_snapshot.fd, size) < 0) {
+		return -1;
+	}
+
+	header.magic = LTCKPT_SNAPSHOT_MAGIC;
+	header.version = LTCKPT_SNAPSHOT_VERSION;
+	header.page_size = PAGE_SIZE;
+	header.pid = ltckpt_snapshot.parent;
+	header.checkpoint = checkpoint;
+	strncpy(header.approach, CTX(approach) ? CTX(approach) : "", sizeof(header.approach) - 1);
+	memset(ltckpt_snapshot.buff, 0, LTCKPT_SNAPSHOT_HEADER_SIZE);
+	memcpy(ltckpt_snapshot.buff, &header, sizeof(header));
+	ltckpt_snapshot.offset = 0;
+	if (ltckpt_snapshot_flush(LTCKPT_SNAPSHOT_HEADER_SIZE) < 0) {
+		return -1;
+	}
+
+	return close(ltckpt_snapshot.fd);
+}
+
+/* Returns 1 if the previous snapshot is still being written. */
+static int ltckpt_snapshot_reap()
+{
+	int status;
+	pid_t pid;
+
+	if (!ltckpt_snapshot.child) {
+		return 0;
+	}
+	pid = waitpid(ltckpt_snapshot.child, &status, WNOHANG|__WCLONE);
+	if (pid == 0) {
+		return 1;
+	}
+	if (pid == ltckpt_snapshot.child
+		&& (!WIFEXITED(status) || WEXITSTATUS(status))) {
+		CTX(snapshots_failed)++;
+	}
+	/* pid < 0: forked after the clone, the snapshot is not ours. */
+	ltckpt_snapshot.child = 0;
+
+	return 0;
+}
+
+void ltckpt_snapshot_checkpoint()
+{
+	uint64_t checkpoint = CTX(num_checkpoints);
+	const char *dir = CTX(output_conf).dir ? CTX(output_conf).dir : "/tmp";
+	long pid;
+
+	if (checkpoint % CTX(snapshot_interval)) {
+		return;
+	}
+	if (ltckpt_snapshot_reap()) {
+		CTX(snapshots_skipped)++;
+		return;
+	}
+
+	util_proc_maps_destroy(&ltckpt_snapshot.maps);
+	if (ltckpt_vmas_parse_filter(&ltckpt_snapshot.maps,
+		ltckpt_snapshot_filter_cb, NULL)) {
+		CTX(snapshots_failed)++;
+		return;
+	}
+	ltckpt_snapshot.parent = getpid();
+	snprintf(ltckpt_snapshot.path, sizeof(ltckpt_snapshot.path), "%s/%s.%d.%llu",
+		dir, LTCKPT_SNAPSHOT_FILE, (int) ltckpt_snapshot.parent, (unsigned long long) checkpoint);
+
+	/*
+	 * No exit signal, so the child is invisible to the application's
+	 * wait()s and SIGCHLD handler, and no atfork handlers (some of them
+	 * drop checkpoint state in the parent).
+	 */
+	pid = syscall(SYS_clone, 0, NULL, NULL, NULL, NULL);
+	if (pid == 0) {
+		_exit(ltckpt_snapshot_write(checkpoint) < 0 ? 1 : 0);
+	}
+	if (pid < 0) {
+		CTX(snapshots_failed)++;
+		return;
+	}
+	ltckpt_snapshot.child = pid;
+	CTX(snapshots)++;
+}
+
+void ltckpt_snapshot_init()
+{
+	ltckpt_va_t buff;
+
+	CTX(snapshot_interval) = util_env_parse_int("CP_SNAPSHOT", 0);
+	if (CTX(snapshot_interval) <= 0) {
+		CTX(snapshot_interval) = 0;
+		return;
+	}
+	buff = ltckpt_mmap(0, LTCKPT_SNAPSHOT_BUFF_SIZE, LTCKPT_PROT_R | LTCKPT_PROT_W,
+		LTCKPT_MAP_PRIVATE | LTCKPT_MAP_NORESERVE);
+	if (buff == LTCKPT_MAP_FAILED) {
+		ltckpt_printf_error("ERROR: unable to allocate snapshot buffer: %s\n",
+			strerror(errno));
+		CTX(snapshot_interval) = 0;
+		return;
+	}
+	ltckpt_snapshot.buff = LTCKPT_VA_TO_PTR(buff);
+	ltckpt_owned_add(buff, LTCKPT_SNAPSHOT_BUFF_SIZE);
+}
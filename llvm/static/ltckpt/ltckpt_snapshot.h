@@ -0,0 +1,25 @@
+#ifndef LTCKPT_SNAPSHOT_H
+#define LTCKPT_SNAPSHOT_H 1
+
+/*
+ * Snapshot export (see include/ltckpt/snapshot.h), enabled with
+ * CP_SNAPSHOT=<n> to write every n-th checkpoint to
+ * $LOGDIR/ltckpt.snapshot.<pid>.<checkpoint>. The top of the loop only
+ * clones a copy-on-write child, which holds the memory as checkpointed and
+ * writes it out in LTCKPT_SNAPSHOT_BUFF_SIZE batches (O_DIRECT when the
+ * file system allows it). A snapshot is skipped while the previous one is
+ * still being written.
+ */
+#ifndef LTCKPT_SNAPSHOT_BUFF_SIZE
+#define LTCKPT_SNAPSHOT_BUFF_SIZE (1024*1024)
+#endif
+
+#ifndef __MINIX
+void ltckpt_snapshot_init();
+void ltckpt_snapshot_checkpoint();
+#else
+#define ltckpt_snapshot_init()
+#define ltckpt_snapshot_checkpoint()
+#endif
+
+#endif
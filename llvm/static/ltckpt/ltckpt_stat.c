@@ -3,6 +3,8 @@
 #include "ltckpt_config.h"
 #include "ltckpt_stat.h"
 #include "ltckpt_types.h"
+#include "ltckpt_statfile.h"
+#include <ltckpt/statfile.h>
 #if LTCKPT_CFG_STATS_ENABLED
 typedef struct ltckpt_stats {
 	ltckpt_va_t addr;
@@ -54,6 +56,15 @@ void __attribute__((used)) ltckpt_stat_dump()
 {
 	static int iteration = 0;
 	ltckpt_stat_t *stat = stats;
+	if (ltckpt_statfile_enabled()) {
+		for (; stat; stat = stat->next) {
+			ltckpt_statfile_add(LTCKPT_STATS_KIND_STORE_COUNT, iteration,
+				stat->addr, stat->count);
+		}
+		ltckpt_statfile_flush();
+		iteration++;
+		return;
+	}
 	while(stat) {
 		ltckpt_printf_force("%d 0x%p %d\n", iteration,
 			LTCKPT_VA_TO_PTR(stat->addr), stat->count);
@@ -0,0 +1,129 @@
+#include "ltckpt_local.h"
+#include "ltckpt_statfile.h"
+
+#include <ltckpt/statfile.h>
+#include <fcntl.h>
+#include <stddef.h>
+
+typedef struct ltckpt_statfile_s {
+	int enabled;
+	int fd;
+	int pid;
+	uint64_t num_records;
+	unsigned num_buffered;
+	struct ltckpt_stats_record buff[LTCKPT_STATFILE_BUFF_RECORDS];
+} ltckpt_statfile_t;
+
+static ltckpt_statfile_t ltckpt_statfile = { -1, -1 };
+
+static int ltckpt_statfile_open()
+{
+	char path[512];
+	struct ltckpt_stats_header header;
+
+	ltckpt_statfile.pid = getpid();
+	snprintf(path, sizeof(path), "%s/%s.%d",
+		CTX(output_conf).dir ? CTX(output_conf).dir : "/tmp",
+		LTCKPT_STATS_FILE, ltckpt_statfile.pid);
+	ltckpt_statfile.fd = open(path, O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC, 0644);
+	if (ltckpt_statfile.fd < 0) {
+		ltckpt_printf_error("ERROR: unable to open stat file %s: %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+	memset(&header, 0, sizeof(header));
+	header.magic = LTCKPT_STATS_MAGIC;
+	header.version = LTCKPT_STATS_VERSION;
+	header.record_size = sizeof(struct ltckpt_stats_record);
+	header.pid = ltckpt_statfile.pid;
+	if (write(ltckpt_statfile.fd, &header, sizeof(header)) != sizeof(header)) {
+		close(ltckpt_statfile.fd);
+		ltckpt_statfile.fd = -1;
+		return -1;
+	}
+	ltckpt_statfile.num_records = 0;
+	ltckpt_statfile.num_buffered = 0;
+
+	return 0;
+}
+
+int ltckpt_statfile_enabled()
+{
+	if (ltckpt_statfile.enabled < 0) {
+		ltckpt_statfile.enabled = util_env_parse_int("CP_STATFILE", 0);
+	}
+	if (!ltckpt_statfile.enabled) {
+		return 0;
+	}
+	if (ltckpt_statfile.fd >= 0 && ltckpt_statfile.pid != getpid()) {
+		/* Forked child: start a file of our own. */
+		close(ltckpt_statfile.fd);
+		ltckpt_statfile.fd = -1;
+	}
+	if (ltckpt_statfile.fd < 0 && ltckpt_statfile_open() < 0) {
+		ltckpt_statfile.enabled = 0;
+	}
+
+	return ltckpt_statfile.enabled;
+}
+
+void ltckpt_statfile_add(uint32_t kind, uint32_t iteration, uint64_t key,
+	uint64_t value)
+{
+	struct ltckpt_stats_record *record;
+
+	if (ltckpt_statfile.num_buffered == LTCKPT_STATFILE_BUFF_RECORDS) {
+		ltckpt_statfile_flush();
+	}
+	record = &ltckpt_statfile.buff[ltckpt_statfile.num_buffered++];
+	record->kind = kind;
+	record->iteration = iteration;
+	record->key = key;
+	record->value = value;
+}
+
+void ltckpt_statfile_flush()
+{
+	size_t len, done = 0;
+	ssize_t ret;
+	char *buff;
+	uint64_t num_records;
+
+	if (ltckpt_statfile.fd < 0) {
+		ltckpt_statfile.num_buffered = 0;
+		return;
+	}
+	buff = (char*) ltckpt_statfile.buff;
+	len = ltckpt_statfile.num_buffered * sizeof(struct ltckpt_stats_record);
+	while (done < len) {
+		ret = write(ltckpt_statfile.fd, buff + done, len - done);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ltckpt_printf_error("ERROR: stat file write failed: %s\n",
+				strerror(errno));
+			break;
+		}
+		done += ret;
+	}
+	/* The header only counts the records that made it to the file. */
+	ltckpt_statfile.num_records += done / sizeof(struct ltckpt_stats_record);
+	ltckpt_statfile.num_buffered = 0;
+
+	num_records = ltckpt_statfile.num_records;
+	do {
+		ret = pwrite(ltckpt_statfile.fd, &num_records, sizeof(num_records),
+			offsetof(struct ltckpt_stats_header, num_records));
+	} while (ret < 0 && errno == EINTR);
+	if (ret != sizeof(num_records)) {
+		ltckpt_printf_error("ERROR: stat file header update failed: %s\n",
+			ret < 0 ? strerror(errno) : "short write");
+	}
+	if (done < len) {
+		/* Records after a partial one would be misaligned, stop here. */
+		close(ltckpt_statfile.fd);
+		ltckpt_statfile.fd = -1;
+		ltckpt_statfile.enabled = 0;
+	}
+}
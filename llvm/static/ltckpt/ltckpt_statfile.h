@@ -0,0 +1,26 @@
+#ifndef LTCKPT_STATFILE_H
+#define LTCKPT_STATFILE_H 1
+
+#include <stdint.h>
+
+/*
+ * Binary statistics dump (see include/ltckpt/statfile.h), enabled with
+ * CP_STATFILE=1 and written to $LOGDIR/ltckpt.stat.<pid>. Records are
+ * buffered and written in batches instead of one printf per entry.
+ */
+#ifndef LTCKPT_STATFILE_BUFF_RECORDS
+#define LTCKPT_STATFILE_BUFF_RECORDS 1024
+#endif
+
+#ifndef __MINIX
+int ltckpt_statfile_enabled();
+void ltckpt_statfile_add(uint32_t kind, uint32_t iteration, uint64_t key,
+	uint64_t value);
+void ltckpt_statfile_flush();
+#else
+#define ltckpt_statfile_enabled() 0
+#define ltckpt_statfile_add(K, I, A, V)
+#define ltckpt_statfile_flush()
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+#include "ltckpt_local.h"
+#include "ltckpt_storeprof.h"
+
+#include <ltckpt/storeprof.h>
+#include <fcntl.h>
+
+typedef struct ltckpt_storeprof_s {
+	uint64_t *counts;
+	uint64_t num_sites;
+	uint64_t hash;
+} ltckpt_storeprof_t;
+
+static ltckpt_storeprof_t ltckpt_storeprof;
+
+void ltckpt_storeprof_register(uint64_t *counts, uint64_t num_sites,
+	uint64_t hash)
+{
+	ltckpt_storeprof.counts = counts;
+	ltckpt_storeprof.num_sites = num_sites;
+	ltckpt_storeprof.hash = hash;
+}
+
+void ltckpt_storeprof_dump()
+{
+	struct ltckpt_storeprof_header header;
+	char path[512];
+	size_t len;
+	int fd;
+
+	if (!ltckpt_storeprof.counts) {
+		return;
+	}
+	memset(&header, 0, sizeof(header));
+	header.magic = LTCKPT_STOREPROF_MAGIC;
+	header.version = LTCKPT_STOREPROF_VERSION;
+	header.pid = getpid();
+	header.hash = ltckpt_storeprof.hash;
+	header.num_sites = ltckpt_storeprof.num_sites;
+
+	snprintf(path, sizeof(path), "%s/%s.%d",
+		CTX(output_conf).dir ? CTX(output_conf).dir : "/tmp",
+		LTCKPT_STOREPROF_FILE, (int) header.pid);
+	fd = open(path, O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		ltckpt_printf_error("ERROR: unable to open store profile %s: %s\n",
+			path, strerror(errno));
+		return;
+	}
+	len = header.num_sites*sizeof(uint64_t);
+	if (write(fd, &header, sizeof(header)) != sizeof(header)
+		|| write(fd, ltckpt_storeprof.counts, len) != (ssize_t) len) {
+		ltckpt_printf_error("ERROR: unable to write store profile %s\n", path);
+	}
+	close(fd);
+}
@@ -0,0 +1,20 @@
+#ifndef LTCKPT_STOREPROF_H
+#define LTCKPT_STOREPROF_H 1
+
+#include <stdint.h>
+
+/*
+ * Store profile (see include/ltckpt/storeprof.h). The ltckpt pass with
+ * -ltckpt_profile_gen registers its per-site counters from
+ * ltckpt_conf_setup() and they are written to
+ * $LOGDIR/ltckpt.sprof.<pid> at exit.
+ */
+#ifndef __MINIX
+void ltckpt_storeprof_register(uint64_t *counts, uint64_t num_sites,
+	uint64_t hash) __attribute__((used));
+void ltckpt_storeprof_dump();
+#else
+#define ltckpt_storeprof_dump()
+#endif
+
+#endif
@@ -130,4 +130,27 @@ static inline region_t * ltckpt_addr_to_region(void * addr)
 #define LTCKPT_STACK_START  (PAGE_ROUND_DOWN(LTCKPT_BITMAP_OFFSET) - LTCKPT_STACK_SIZE)
 #define LTCKPT_STACK_END    (PAGE_ROUND_DOWN(LTCKPT_BITMAP_OFFSET))
 
+/*
+ * Page size backing the bitmap and the shadow space (CP_HUGE_PAGES).
+ * Huge pages cut the TLB misses of the scattered bitmap and shadow
+ * accesses, at the price of a larger RSS for sparse checkpoints.
+ * Explicit huge pages are reserved at mmap() time and fall back to
+ * transparent ones for unaligned regions or when the hugetlbfs pool
+ * cannot cover the whole region.
+ */
+#define BITMAP_HUGE_NONE       0
+#define BITMAP_HUGE_THP        1
+#define BITMAP_HUGE_EXPLICIT   2
+
+#ifndef BITMAP_HUGE_PAGES_DEFAULT
+#define BITMAP_HUGE_PAGES_DEFAULT BITMAP_HUGE_NONE
+#endif
+
+#if (BITMAP_TYPE == BITMAP_PLAIN_BYTE && LTCKPT_SCHEME != LTCKPT_DIFF_SCHEME)
+/* The bitmap is write-protected with 4 KB granularity. */
+#undef BITMAP_HUGE_PAGES_DEFAULT
+#define BITMAP_HUGE_PAGES_DEFAULT BITMAP_HUGE_NONE
+#define BITMAP_HUGE_PAGES_FORCE_NONE 1
+#endif
+
 #endif
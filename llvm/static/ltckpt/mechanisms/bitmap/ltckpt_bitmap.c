@@ -129,25 +129,17 @@ ltckpt_va_t __thread _th_bitmap_offset= LTCKPT_BITMAP_START;
 static ltckpt_va_t bitmap_end      = LTCKPT_BITMAPS_END;
 static ltckpt_va_t current_bitmap  = LTCKPT_BITMAP_START;
 
-static inline ltckpt_va_t fetch_and_inc(ltckpt_va_t * variable, ltckpt_va_t value){
-	asm volatile(
-			"lock; xaddq %%rax, (%2)\n\t"
-			:"=a" (value)                   //output
-			: "a" (value), "m" (variable)  //input
-			:"memory" );
-	return value;
-}
-
 LTCKPT_DECLARE_ATPTHREAD_CREATE_CHILD_HOOK()
 {
 	/*
 	 * we allocate bitmaps from the bottom to the top this means
 	 */
-	_th_bitmap_offset = ltckpt_fetch_and_inc(current_bitmap, LTCKPT_BITMAP_SIZE);
+	_th_bitmap_offset = __sync_fetch_and_add(&current_bitmap, LTCKPT_BITMAP_SIZE);
 	if (_th_bitmap_offset + LTCKPT_BITMAP_SIZE > bitmap_end) {
 		ltckpt_panic("ran out of bitmaps\n");
 	}
-
+	/* Only this thread sets bits in its bitmap. */
+	ltckpt_numa_bind_local(_th_bitmap_offset, LTCKPT_BITMAP_SIZE);
 }
 
 #endif
@@ -27,12 +27,25 @@ EARLY_INIT_CHANGE_STACK(LTCKPT_STACK_START, LTCKPT_STACK_SIZE)
  * our checkpointing library.
  */
 
+static unsigned int ltckpt_huge_flags()
+{
+	switch (CTX(huge_pages)) {
+	case BITMAP_HUGE_THP:
+		return LTCKPT_MAP_HUGE;
+	case BITMAP_HUGE_EXPLICIT:
+		return LTCKPT_MAP_HUGETLB;
+	default:
+		return 0;
+	}
+}
+
 void ltckpt_allocate_bitmap()
 {
 	ltckpt_debug_func();
 	ltckpt_va_t ret = ltckpt_mmap(LTCKPT_BITMAP_START, LTCKPT_BITMAP_SIZE,
 		PROT_WRITE | PROT_READ,
-		LTCKPT_MAP_FIXED | LTCKPT_MAP_PRIVATE |	LTCKPT_MAP_NORESERVE);
+		LTCKPT_MAP_FIXED | LTCKPT_MAP_PRIVATE |	LTCKPT_MAP_NORESERVE
+		| ltckpt_huge_flags());
 
 	if (ret == LTCKPT_MAP_FAILED) {
 		ltckpt_panic("%s", "Could not allocate memory for bitmap.\n");
@@ -57,7 +70,8 @@ void ltckpt_allocate_shadow_space()
 	ltckpt_va_t ret = ltckpt_mmap(LTCKPT_SHADOW_SPACE_START,
 		LTCKPT_SHADOW_SPACE_SIZE,
 		PROT_WRITE | PROT_READ,
-		LTCKPT_MAP_FIXED | LTCKPT_MAP_PRIVATE |	LTCKPT_MAP_NORESERVE);
+		LTCKPT_MAP_FIXED | LTCKPT_MAP_PRIVATE |	LTCKPT_MAP_NORESERVE
+		| ltckpt_huge_flags());
 
 	if (ret == LTCKPT_MAP_FAILED) {
 		ltckpt_panic("%s", "Could not allocate memory for shadow space.\n");
@@ -119,9 +133,17 @@ void ltckpt_bitmap_late_init_hook()
 		return;
 	}
 	ltckpt_debug_func();
+#ifdef BITMAP_HUGE_PAGES_FORCE_NONE
+	CTX(huge_pages) = BITMAP_HUGE_NONE;
+#else
+	CTX(huge_pages) = util_env_parse_int("CP_HUGE_PAGES", BITMAP_HUGE_PAGES_DEFAULT);
+#endif
 	ltckpt_clean_space();
 	ltckpt_allocate_bitmap();
 	ltckpt_allocate_shadow_space();
+	/* fixed addresses, the top of the loop remaps them in place */
+	ltckpt_owned_add(LTCKPT_BITMAP_START, LTCKPT_BITMAP_SIZE);
+	ltckpt_owned_add(LTCKPT_SHADOW_SPACE_START, LTCKPT_SHADOW_SPACE_SIZE);
 	ltckpt_stat_init();
 #if (BITMAP_TYPE == BITMAP_PLAIN_BYTE && LTCKPT_SCHEME != LTCKPT_DIFF_SCHEME)
 	/* mark the end of the pages (for the scanning code)*/
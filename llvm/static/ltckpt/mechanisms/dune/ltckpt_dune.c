@@ -67,9 +67,9 @@ void ltckpt_init_dsmmap()
 	assert(ret == 0);
 
 	if (CTX(skip_mmap)) {
-		ret = util_proc_maps_parse(getpid(), &maps);
+		ret = ltckpt_vmas_parse_filter(&maps, NULL, NULL);
 		if (ret != 0) {
-			ltckpt_panic("util_proc_maps_parse failed: %d\n", ret);
+			ltckpt_panic("ltckpt_vmas_parse_filter failed: %d\n", ret);
 		}
 		util_proc_maps_get_info(&maps, &info);
 		start = info.prog.vm_start;
@@ -1,6 +1,9 @@
 #define LTCKPT_CHECKPOINT_METHOD softdirty
 
 #include "../ltckpt_local.h"
+#include "../ltckpt_statfile.h"
+#include "../ltckpt_compress.h"
+#include <ltckpt/statfile.h>
 #include <common/ut/uthash.h>
 LTCKPT_CHECKPOINT_METHOD_ONCE();
 LTCKPT_DECLARE_EMPTY_STORE_HOOKS();
@@ -9,6 +12,10 @@ LTCKPT_DECLARE_EMPTY_STORE_HOOKS();
 #define PAGE_STAT_SIZE          50000
 #define PAGE_NUM_HIST_SIZE      200000
 
+#ifndef SOFTDIRTY_COMPRESS_DEFAULT
+#define SOFTDIRTY_COMPRESS_DEFAULT LTCKPT_COMPRESS_NONE
+#endif
+
 #define SOFTDIRTY_STAT(S)          (softdirty ? softdirty->S : 0)
 
 static void ltckpt_init_softdirty();
@@ -23,6 +30,8 @@ typedef struct pagestat_s {
 typedef struct {
     char mem[SOFTDIRTY_MAX_PAGES*PAGE_SIZE];
 	unsigned long num_mem_pages;
+	unsigned long mem_pos;
+	unsigned short mem_len[SOFTDIRTY_MAX_PAGES];
     util_proc_maps_t proc_maps;
     util_pagemap_t pagemap;
     
@@ -41,29 +50,50 @@ typedef struct {
 static softdirty_t *softdirty;
 
 
-static int ltckpt_top_of_the_loop_cb(u64_t *entry, void *addr, void *cb_args);
+static int ltckpt_top_of_the_loop_cb(u64_t *entries, void *addr,
+	size_t num_pages, void *cb_args);
 
-static int ltckpt_top_of_the_loop_stat_cb(u64_t *entry, void *addr, void *cb_args)
+static int ltckpt_top_of_the_loop_stat_cb(u64_t *entries, void *addr,
+	size_t num_pages, void *cb_args)
 {
-	pagestat_t *stat = NULL; 
-	HASH_FIND_PTR(softdirty->page_statistics, &addr, stat);
-	if (!stat) {
-		if ( softdirty->pagestat_pos >= PAGE_STAT_SIZE ) {
-			ltckpt_panic("Out of statistics memory\n");
+	pagestat_t *stat;
+	void *page;
+	size_t i;
+
+	for (i = 0; i < num_pages; i++) {
+		page = (char*) addr + i*PAGE_SIZE;
+		stat = NULL;
+		HASH_FIND_PTR(softdirty->page_statistics, &page, stat);
+		if (!stat) {
+			if ( softdirty->pagestat_pos >= PAGE_STAT_SIZE ) {
+				ltckpt_panic("Out of statistics memory\n");
+			}
+			stat = &softdirty->page_statistics_mem[softdirty->pagestat_pos++];
+			stat->count = 0;
+			stat->addr  = page;
+			HASH_ADD_PTR(softdirty->page_statistics, addr, stat);
 		}
-		stat = &softdirty->page_statistics_mem[softdirty->pagestat_pos++];
-		stat->count = 0;
-		stat->addr  = addr;
-		HASH_ADD_PTR(softdirty->page_statistics, addr, stat);
+		stat->count++;
 	}
-	stat->count++;
-	return ltckpt_top_of_the_loop_cb(entry, addr, cb_args);
+	return ltckpt_top_of_the_loop_cb(entries, addr, num_pages, cb_args);
 }
 
 LTCKPT_DECLARE_CTX_PRINT_HOOK() 
 {
 	int i;
-	if (CTX(initialized)) {
+	if (CTX(initialized) && ltckpt_statfile_enabled()) {
+		for ( i=0; i < softdirty->pagestat_pos ; i++) {
+			ltckpt_statfile_add(LTCKPT_STATS_KIND_PAGE_COUNT, 0,
+				(unsigned long) softdirty->page_statistics_mem[i].addr,
+				softdirty->page_statistics_mem[i].count);
+		}
+		for ( i=0; i < softdirty->page_num_hist_len; i++ ) {
+			ltckpt_statfile_add(LTCKPT_STATS_KIND_PAGE_NUM, 0,
+				i, softdirty->page_num_hist[i]);
+		}
+		ltckpt_statfile_flush();
+	}
+	else if (CTX(initialized)) {
 		for ( i=0; i < softdirty->pagestat_pos ; i++) { 
 			ltckpt_printf_force("CTX: STAT_PAGE_COUNT: %p = %d\n", 
 					softdirty->page_statistics_mem[i].addr, 
@@ -79,16 +109,27 @@ LTCKPT_DECLARE_CTX_PRINT_HOOK()
 	ltckpt_ctx_print_default();
 }
 
-static int ltckpt_top_of_the_loop_cb(u64_t *entry, void *addr, void *cb_args)
+static int ltckpt_top_of_the_loop_cb(u64_t *entries, void *addr,
+	size_t num_pages, void *cb_args)
 {
 	(void)(cb_args);
 
-	ltckpt_printf("ltckpt: [ckpt=%lu] Saving dirty page @%p (0x%032llx)\n", CTX(num_checkpoints), addr, *entry);
+	ltckpt_printf("ltckpt: [ckpt=%lu] Saving %zu dirty pages @%p (0x%032llx)\n",
+		CTX(num_checkpoints), num_pages, addr, *entries);
+
+	size_t i, len;
+	char *page = (char*) addr;
 
-	assert(softdirty->num_mem_pages < SOFTDIRTY_MAX_PAGES);
-	memcpy(&softdirty->mem[softdirty->num_mem_pages*PAGE_SIZE], addr, PAGE_SIZE);
-	softdirty->num_mem_pages++;
-	CTX_INC(num_cows);
+	assert(softdirty->num_mem_pages + num_pages <= SOFTDIRTY_MAX_PAGES);
+	for (i = 0; i < num_pages; i++, page += PAGE_SIZE) {
+		assert(softdirty->mem_pos + PAGE_SIZE <= sizeof(softdirty->mem));
+		len = ltckpt_compress_page(CTX(compress), page,
+			&softdirty->mem[softdirty->mem_pos]);
+		softdirty->mem_len[softdirty->num_mem_pages++] = len;
+		softdirty->mem_pos += len;
+		CTX_NEW_COMPRESSED(PAGE_SIZE, len);
+	}
+	CTX(num_cows) += num_pages;
 
 	return 0;
 }
@@ -108,23 +149,25 @@ LTCKPT_DECLARE_TOP_OF_THE_LOOP_HOOK()
 			softdirty->page_num_hist_len = 0;
 	}
 	softdirty->num_mem_pages = 0;
+	softdirty->mem_pos = 0;
 	
 	if (softdirty->stats_enabled) {
-		ret = util_pagemap_proc_walk(&softdirty->pagemap,
+		ret = util_pagemap_proc_walk_runs(&softdirty->pagemap,
 			&softdirty->proc_maps, PME_SOFT_DIRTY,
 			ltckpt_top_of_the_loop_stat_cb, NULL);
 	} else {
-		ret = util_pagemap_proc_walk(&softdirty->pagemap,
+		ret = util_pagemap_proc_walk_runs(&softdirty->pagemap,
 			&softdirty->proc_maps, PME_SOFT_DIRTY,
 			ltckpt_top_of_the_loop_cb, NULL);
 	}
 
 	if (ret < 0)
-		ltckpt_panic("util_pagemap_proc_walk failed: %d %s", ret, strerror(errno));
+		ltckpt_panic("util_pagemap_proc_walk_runs failed: %d %s", ret, strerror(errno));
 	ret = util_pagemap_clear_refs(&softdirty->pagemap, CR_SOFTDIRTY);
 	if (ret < 0)
 		ltckpt_panic("util_pagemap_clear_refs failed: %d %s", ret, strerror(errno));
 
+	CTX_NEW_BYTES_SAVED(softdirty->num_mem_pages*PAGE_SIZE);
 	CTX_NEW_CHECKPOINT();
 }
 
@@ -150,7 +193,7 @@ static void ltckpt_init_softdirty()
 	size_t buff_len;
 	
 	/* Map our entire internal state in 1 mmapped memory chunk. */
-	buff_len = sizeof(softdirty_t)+UTIL_PAGEMMAP_DEFAULT_BUFF_SIZE;
+	buff_len = sizeof(softdirty_t)+UTIL_PAGEMAP_BATCH_BUFF_SIZE;
 	buff = ltkcpt_ctx_get_buff(MIN_MMAP_ADDR, buff_len);
 	softdirty = (softdirty_t*) buff;
 	buff += sizeof(softdirty_t);
@@ -158,17 +201,18 @@ static void ltckpt_init_softdirty()
 	CTX(initialized) = 1;
 
 	softdirty->stats_enabled = CTX(page_statistic_enabled);
+	CTX(compress) = util_env_parse_int("CP_COMPRESS", SOFTDIRTY_COMPRESS_DEFAULT);
 	softdirty->pagestat_pos=0;
 	softdirty->page_num_hist_len=0;
 	softdirty->page_statistics=NULL;
 
 
-	ret = util_proc_maps_parse_filter(getpid(), &softdirty->proc_maps,
+	ret = ltckpt_vmas_parse_filter(&softdirty->proc_maps,
 		ltckpt_init_softdirty_cb, NULL);
 	if (ret)
-		ltckpt_panic("util_proc_maps_parse_filter failed: %d %s", ret, strerror(errno));
+		ltckpt_panic("ltckpt_vmas_parse_filter failed: %d %s", ret, strerror(errno));
 	ret = util_pagemap_init(getpid(), &softdirty->pagemap,
-		buff, UTIL_PAGEMMAP_DEFAULT_BUFF_SIZE);
+		buff, UTIL_PAGEMAP_BATCH_BUFF_SIZE);
 	if (ret)
 		ltckpt_panic("util_pagemap_init failed: %d %s", ret, strerror(errno));
 	ret = util_pagemap_clear_refs(&softdirty->pagemap, CR_SOFTDIRTY);
@@ -46,10 +46,22 @@ extern __attribute__((weak)) int copy_rs_start(void *, ...);
 #define WRITELOG_GRANULARITY         (8) /* the sizeof writelog entries in bytes */
 #define WRITELOG_BYTES          (WRITELOG_MAXLEN*(WRITELOG_GRANULARITY+sizeof(void*)))
 
+/*
+ * Stack bounds recorded at the top of the loop. Stores to live frames, i.e.
+ * between the current frame and wl_stack_hi, are never logged: the frames
+ * are gone by the time the log is restored. wl_stack_lo tracks the deepest
+ * frame that logged an entry, so the restart hook can tell stack entries
+ * apart exactly.
+ */
 #ifdef WRITELOG_PER_THREAD
 
 static __thread char *wl_data = NULL;
 static __thread unsigned long wl_position;
+static __thread char *wl_stack_lo;
+static __thread char *wl_stack_hi;
+static unsigned long wl_position_high_watermark;
+
+static void ltckpt_init_writelog();
 
 LTCKPT_DECLARE_ATPTHREAD_CREATE_CHILD_HOOK()
 {
@@ -61,6 +73,8 @@ LTCKPT_DECLARE_ATPTHREAD_CREATE_CHILD_HOOK()
 static char *wl_data = NULL;
 static unsigned long wl_position;
 static unsigned long wl_position_high_watermark;
+static char *wl_stack_lo;
+static char *wl_stack_hi;
 
 #endif
 
@@ -112,8 +126,33 @@ static int LTCKPT_RESTARTING()
 }
 #endif
 
+/*
+ * The initial environment sits above all the frames of the main thread.
+ * Fall back to the frame of the caller if it moved (or for other threads),
+ * which still covers all the frames below the top of the loop.
+ */
+static inline char *ltckpt_writelog_stack_top(char *frame)
+{
+#ifndef WRITELOG_PER_THREAD
+	extern char **environ;
+	char *top = (char *) environ;
+
+	if (top > frame) {
+		return (char *) (((ltckpt_va_t) top + PAGE_SIZE) & ~((ltckpt_va_t) PAGE_SIZE - 1));
+	}
+#endif
+	return frame;
+}
+
+static inline int ltckpt_writelog_on_stack(const void *addr)
+{
+	return (const char *) addr >= wl_stack_lo && (const char *) addr < wl_stack_hi;
+}
+
 static inline void ltckpt_write_wl(void * addr)
 {
+	char *sp = (char *) &sp;
+
 	/* align address to region boundary */
 	addr = (void *)(LTCKPT_PTR_TO_VA(addr) & ~(WRITELOG_GRANULARITY-1));
 	char *wl_data_start = (char *) LTCKPT_PTR_TO_VA(wl_data);
@@ -124,6 +163,12 @@ static inline void ltckpt_write_wl(void * addr)
 	if (!sa_window__is_open) {
 		return;
 	}
+	if ((char *) addr >= sp && (char *) addr < wl_stack_hi) {
+		return;
+	}
+	if (sp < wl_stack_lo) {
+		wl_stack_lo = sp;
+	}
 
 #if 0
 	lt_kputs("WL:");
@@ -200,7 +245,12 @@ LTCKPT_DECLARE_TOP_OF_THE_LOOP_HOOK()
 #endif
 	}
 
+	CTX_NEW_BYTES_SAVED(wl_position / (sizeof(void*) + sizeof(region_t)) * sizeof(region_t));
 	wl_position=0;
+	wl_stack_lo = (char *) __builtin_frame_address(0);
+	if (wl_stack_hi < wl_stack_lo) {
+		wl_stack_hi = ltckpt_writelog_stack_top(wl_stack_lo);
+	}
 #if !LTCKPT_WRITELOG_ALWAYS_ON
 	ltckpt_writelog_enabled = 1;
 #endif
@@ -231,6 +281,11 @@ static void  ltckpt_init_writelog()
 	}
 	lt_printf("writelog: %x.\n", ret);
 	wl_data = LTCKPT_VA_TO_PTR(ret);
+	ltckpt_owned_add(ret, WRITELOG_BYTES);
+#ifdef WRITELOG_PER_THREAD
+	/* Only the owner writes the log, keep it on its node. */
+	ltckpt_numa_bind_local(ret, WRITELOG_BYTES);
+#endif
 }
 
 LTCKPT_DECLARE_LATE_INIT_HOOK()
@@ -283,7 +338,7 @@ static int ltckpt_can_restore(const void *addr) {
 
 LTCKPT_DECLARE_RESTART_HOOK()
 {
-	void *addr, *datamax;
+	void *addr;
 	char buf[1024], *p = buf, *pend = buf + sizeof(buf);
 	region_t *region;
 	unsigned long entry_size = sizeof(void*) + sizeof(region_t);
@@ -338,7 +393,6 @@ LTCKPT_DECLARE_RESTART_HOOK()
 	stack_entries=0;
 	assert(wl_position % entry_size == 0);
 	assert(num_entries == wl_position/entry_size);
-	datamax = (char*)&num_entries - 4096;
 	while(wl_position >= entry_size) {
 		i++;
 		wl_position -= entry_size;
@@ -355,7 +409,7 @@ LTCKPT_DECLARE_RESTART_HOOK()
 		}
 
 		region = (region_t *) &wl_data[wl_position + sizeof(void*)];
-		if (addr > datamax) {
+		if (ltckpt_writelog_on_stack(addr)) {
 			stack_entries++;
 			continue;
 		}
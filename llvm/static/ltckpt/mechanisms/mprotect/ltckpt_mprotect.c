@@ -1,6 +1,7 @@
 #define LTCKPT_CHECKPOINT_METHOD mprotect
 
 #include "../../ltckpt_local.h"
+#include "../../ltckpt_compress.h"
 LTCKPT_CHECKPOINT_METHOD_ONCE();
 LTCKPT_DECLARE_EMPTY_STORE_HOOKS();
 
@@ -9,6 +10,10 @@ LTCKPT_DECLARE_EMPTY_STORE_HOOKS();
 
 #define MPROTECT_MAX_PAGES     1000
 
+#ifndef MPROTECT_COMPRESS_DEFAULT
+#define MPROTECT_COMPRESS_DEFAULT LTCKPT_COMPRESS_NONE
+#endif
+
 #define LTCKPT_MPROTECT_SAFE(B) do { \
 	int initialized = CTX(initialized); \
 	if (initialized) \
@@ -23,6 +28,7 @@ static void ltckpt_init_mpr();
 typedef struct mpr_page_s {
 	void *addr;
 	void *mem;
+	size_t len;
 } mpr_page_t;
 
 typedef struct {
@@ -34,6 +40,7 @@ typedef struct {
 
 	char mem[MPROTECT_MAX_PAGES*PAGE_SIZE];
 	unsigned long num_mem_pages;
+	unsigned long mem_pos;
 
 	util_proc_maps_t proc_maps;
 	ltckpt_ctx_t ctx;
@@ -44,6 +51,7 @@ static mpr_t *mpr;
 static void ltckpt_mem_flush()
 {
 	mpr->num_mem_pages = 0;
+	mpr->mem_pos = 0;
 }
 
 void ltckpt_page_list_add(mpr_page_t *page)
@@ -56,10 +64,14 @@ void ltckpt_page_list_add(mpr_page_t *page)
 	new_page->addr = page->addr;
 
 	assert(mpr->num_mem_pages < MPROTECT_MAX_PAGES);
-	new_mem = &mpr->mem[mpr->num_mem_pages*PAGE_SIZE];
+	assert(mpr->mem_pos + PAGE_SIZE <= sizeof(mpr->mem));
+	new_mem = &mpr->mem[mpr->mem_pos];
 	new_page->mem = new_mem;
-	memcpy(new_page->mem, (void*)new_page->addr, PAGE_SIZE);
+	new_page->len = ltckpt_compress_page(CTX(compress),
+		(void*)new_page->addr, new_page->mem);
+	mpr->mem_pos += new_page->len;
 	mpr->num_mem_pages++;
+	CTX_NEW_COMPRESSED(PAGE_SIZE, new_page->len);
 }
 
 void ltckpt_page_list_clear_and_iter(mpr_page_t **iter)
@@ -172,6 +184,7 @@ LTCKPT_DECLARE_TOP_OF_THE_LOOP_HOOK()
 		ltckpt_init_mpr();
 	}
 
+	CTX_NEW_BYTES_SAVED(mpr->num_mem_pages*PAGE_SIZE);
 	ltckpt_checkpoint();
 
 	CTX_NEW_CHECKPOINT();
@@ -203,11 +216,12 @@ static void ltckpt_init_mpr()
 	mpr = (mpr_t*) ltkcpt_ctx_get_buff(MIN_MMAP_ADDR, buff_len);
 	ltckpt_ctx_set(&mpr->ctx);
 	CTX(initialized) = 1;
+	CTX(compress) = util_env_parse_int("CP_COMPRESS", MPROTECT_COMPRESS_DEFAULT);
 
-	ret = util_proc_maps_parse_filter(getpid(), &mpr->proc_maps,
+	ret = ltckpt_vmas_parse_filter(&mpr->proc_maps,
 		ltckpt_init_mpr_cb, NULL);
 	if (ret)
-		ltckpt_panic("util_proc_maps_parse_filter failed: %d", ret);
+		ltckpt_panic("ltckpt_vmas_parse_filter failed: %d", ret);
 
 	sigemptyset(&sigset);
 	sigaddset(&sigset, SIGSEGV);
@@ -65,9 +65,9 @@ static void ltckpt_init_smmap()
 	CTX(initialized) = 1;
 
 	if (CTX(skip_mmap)) {
-		ret = util_proc_maps_parse(getpid(), &maps);
+		ret = ltckpt_vmas_parse_filter(&maps, NULL, NULL);
 		if (ret != 0) {
-			ltckpt_panic("util_proc_maps_parse failed: %d\n", ret);
+			ltckpt_panic("ltckpt_vmas_parse_filter failed: %d\n", ret);
 		}
 		util_proc_maps_get_info(&maps, &info);
 		addr = (char*) info.prog.vm_start;
@@ -0,0 +1,86 @@
+/*
+ * Round trip of the page codecs in ltckpt_compress.h: every page saved
+ * with ltckpt_compress_page() must come back unchanged from
+ * ltckpt_decompress_page(), and must not take more than a page.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096
+#endif
+#include <ltckpt_compress.h>
+
+#define NUM_WORDS (PAGE_SIZE/sizeof(uint64_t))
+
+static uint64_t page[NUM_WORDS], out[NUM_WORDS], back[NUM_WORDS];
+
+static int roundtrip(const char *name, int codec)
+{
+    size_t len;
+
+    len = ltckpt_compress_page(codec, page, out);
+    if (len > PAGE_SIZE) {
+        printf("%s/%s: %zu bytes, more than a page\n", name,
+            LTCKPT_COMPRESS_NAME(codec), len);
+        return 1;
+    }
+    memset(back, 0xa5, sizeof(back));
+    ltckpt_decompress_page(out, len, back);
+    if (memcmp(page, back, PAGE_SIZE)) {
+        printf("%s/%s: page differs after decoding %zu bytes\n", name,
+            LTCKPT_COMPRESS_NAME(codec), len);
+        return 1;
+    }
+    return 0;
+}
+
+static int roundtrip_all(const char *name)
+{
+    int codec, ret = 0;
+
+    for (codec = LTCKPT_COMPRESS_NONE; codec <= LTCKPT_COMPRESS_ZRLE; codec++) {
+        ret |= roundtrip(name, codec);
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned i, stride, run, seed;
+    int ret = 0;
+
+    memset(page, 0, sizeof(page));
+    ret |= roundtrip_all("zero");
+
+    /* Sparse pages, with isolated words and runs at both page ends. */
+    for (stride = 2; stride <= NUM_WORDS; stride *= 2) {
+        memset(page, 0, sizeof(page));
+        for (i = 0; i < NUM_WORDS; i += stride) {
+            page[i] = i + 1;
+        }
+        page[NUM_WORDS-1] = ~0ULL;
+        ret |= roundtrip_all("sparse");
+    }
+    for (run = 1; run < 8; run++) {
+        memset(page, 0, sizeof(page));
+        for (i = 0; i < NUM_WORDS; i++) {
+            page[i] = (i/run) % 2 ? i : 0;
+        }
+        ret |= roundtrip_all("runs");
+    }
+
+    /* Random pages, fully random and with random zero words. */
+    for (seed = 1; seed <= 64; seed++) {
+        srand(seed);
+        for (i = 0; i < NUM_WORDS; i++) {
+            page[i] = ((uint64_t) rand() << 32) | rand();
+            if (seed % 2 && rand() % 4) {
+                page[i] = 0;
+            }
+        }
+        ret |= roundtrip_all("random");
+    }
+
+    return ret;
+}
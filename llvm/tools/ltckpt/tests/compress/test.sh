@@ -0,0 +1,15 @@
+#!/bin/bash
+
+set -o errexit
+set -o nounset
+
+ROOT=$( cd $( dirname $0 )/../.. && pwd )
+LTCKPTDIR=$ROOT/../../static/ltckpt
+
+TMP=$( mktemp -d )
+trap "rm -rf $TMP" EXIT
+
+echo " - Page codec round trip (zero, sparse and random pages)..."
+${CC:-gcc} -Wall -I$LTCKPTDIR -o $TMP/compress_roundtrip $ROOT/tests/compress/compress_roundtrip.c
+$TMP/compress_roundtrip
+echo "   Done."
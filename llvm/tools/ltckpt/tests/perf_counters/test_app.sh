@@ -31,6 +31,8 @@ TEST_NAME=performance_counters
 RECOMPILE_LIBS=${RECOMPILE_LIBS:-0}
 DO_BASELINE=${DO_BASELINE:-1}
 DO_BITMAP=${DO_BITMAP:-1}
+DO_BITMAP_HUGE=${DO_BITMAP_HUGE:-0}
+BITMAP_HUGE_PAGES=${BITMAP_HUGE_PAGES:-1}
 DO_UNDOLOG=${DO_UNDOLOG:-1}
 DO_SMMAP=${DO_SMMAP:-0}
 DO_FORK=${DO_FORK:-1}
@@ -131,6 +133,19 @@ do_performance_counters_exp bitmap $BITMAP_EXP_RUNS ltckpt_performance_pre_gen_c
 
 fi
 
+#
+# Performance experiment: Bitmap backed by huge pages (compare the TLB
+# counters against bitmap; BITMAP_HUGE_PAGES=2 for hugetlbfs pages)
+#
+if [ $DO_BITMAP_HUGE -eq 1 ]; then
+
+run_app_cmd "CP_METHOD=bitmap ./clientctl buildcp"
+export CP_HUGE_PAGES=$BITMAP_HUGE_PAGES
+do_performance_counters_exp bitmap_huge $BITMAP_EXP_RUNS ltckpt_performance_pre_gen_cb
+unset CP_HUGE_PAGES
+
+fi
+
 #
 # Performance experiment: Undolog
 #
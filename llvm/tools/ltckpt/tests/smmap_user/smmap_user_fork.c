@@ -0,0 +1,94 @@
+/*
+ * Checkpoint/rollback with the userspace smmap backend, before and after
+ * fork(). The child maps the range again, like ltckpt_init_smmap() does
+ * from its atfork handler, and must only see its own dirty pages.
+ */
+#define _GNU_SOURCE
+#include <smmap/smmap.h>
+#include <sys/wait.h>
+
+#define NUM_PAGES 16
+#define SIZE      (NUM_PAGES*SMMAP_USER_PAGE_SIZE)
+
+static char *range, *shadow;
+
+static void fill(int value)
+{
+    int i;
+
+    for (i = 0; i < NUM_PAGES; i += 3) {
+        range[i*SMMAP_USER_PAGE_SIZE] = value;
+        range[i*SMMAP_USER_PAGE_SIZE + SMMAP_USER_PAGE_SIZE - 1] = value;
+    }
+}
+
+static int check(const char *who, int value)
+{
+    int i;
+
+    for (i = 0; i < NUM_PAGES; i += 3) {
+        if (range[i*SMMAP_USER_PAGE_SIZE] != value
+            || range[i*SMMAP_USER_PAGE_SIZE + SMMAP_USER_PAGE_SIZE - 1] != value) {
+            printf("%s: page %d reads %d after rollback, expected %d\n",
+                who, i, range[i*SMMAP_USER_PAGE_SIZE], value);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int checkpoint_rollback(const char *who, int value)
+{
+    fill(value);
+    if (smctl(SMMAP_SMCTL_CHECKPOINT, 0) < 0) {
+        perror("smctl(CHECKPOINT)");
+        return 1;
+    }
+    fill(value + 1);
+    if (smctl(SMMAP_SMCTL_ROLLBACK_DEFAULT, 0) < 0) {
+        perror("smctl(ROLLBACK)");
+        return 1;
+    }
+    return check(who, value);
+}
+
+int main()
+{
+    int status;
+    pid_t pid;
+
+    range = mmap(NULL, 2*SIZE, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (range == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    shadow = range + SIZE;
+    memset(range, 0, SIZE);
+    if (smmap(range, shadow, SIZE) < 0) {
+        perror("smmap");
+        return 1;
+    }
+    if (checkpoint_rollback("parent", 10)) {
+        return 1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        if (smmap(range, shadow, SIZE) < 0) {
+            perror("smmap (child)");
+            return 1;
+        }
+        return checkpoint_rollback("child", 20) || checkpoint_rollback("child", 30);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        return 1;
+    }
+
+    /* the child's checkpoints must not leak into the parent's image */
+    return check("parent", 10) || checkpoint_rollback("parent", 40);
+}
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+set -o errexit
+set -o nounset
+
+ROOT=$( cd $( dirname $0 )/../.. && pwd )
+LLVMINC=$ROOT/../../include
+
+TMP=$( mktemp -d )
+trap "rm -rf $TMP" EXIT
+
+echo " - Userspace smmap checkpoint/rollback across fork()..."
+${CC:-gcc} -Wall -DSMMAP_USERSPACE -I$LLVMINC -o $TMP/smmap_user_fork $ROOT/tests/smmap_user/smmap_user_fork.c
+$TMP/smmap_user_fork
+echo "   Done."
@@ -0,0 +1,672 @@
+/*
+ * Record-and-replay harness for the ltckpt recovery policies on Linux.
+ *
+ * A toy key-value server runs a MINIX-style receive loop and logs every
+ * request at the top of the loop ("record"). "replay" feeds a log back,
+ * crashes the server at the sites enabled on the shutter board and recovers
+ * through ltckpt_recovery_select_policy(), the same selection made by
+ * ltckpt_recovery_dispatcher(). The MINIX primitives used by the recovery
+ * actions are emulated: error replies are counted, sys_kill() marks the
+ * client dead and sys_abort() restarts the server by replaying the requests
+ * completed so far. Handlers write through an undo log, as with the writelog
+ * mechanism, which is rolled back on a crash.
+ *
+ * At the end the server state is compared against a crash-free replay of
+ * the completed requests to check that recovery left it consistent.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ltckpt_printf_error(...) fprintf(stderr, __VA_ARGS__)
+
+#include "ltckpt_recover.h"
+#include "ltckpt_hist.h"
+
+#define KV_LOG_MAGIC     0x6b767270
+#define KV_LOG_VERSION   1
+
+#define KV_NUM_KEYS      4096
+#define KV_NUM_USERS     64          /* user processes, killed on process-specific recovery */
+#define KV_NUM_SOURCES   (KV_NUM_USERS + 2)
+#define KV_SOURCE_SERVER KV_NUM_USERS        /* another system server */
+#define KV_SOURCE_KERNEL (KV_NUM_USERS + 1)  /* notifications, never replied to */
+#define KV_UNDO_MAX      16
+
+enum kv_type_e {
+	KV_GET,
+	KV_PUT,
+	KV_OPEN,
+	KV_CLOSE,
+	KV_SYNC,
+	KV_NOTIFY,
+	__KV_NUM_TYPES
+};
+
+/* One crash site per handler, named after the request type. */
+static const char *kv_site_names[__KV_NUM_TYPES] = {
+	"get", "put", "open", "close", "sync", "notify"
+};
+
+typedef struct kv_msg_s {
+	uint32_t source;
+	uint32_t type;
+	uint32_t key;
+	uint32_t value;
+} kv_msg_t;
+
+typedef struct kv_log_hdr_s {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_msgs;
+	uint64_t seed;
+} kv_log_hdr_t;
+
+typedef struct kv_state_s {
+	uint32_t table[KV_NUM_KEYS];
+	uint32_t session[KV_NUM_SOURCES];
+	uint32_t num_updates;
+} kv_state_t;
+
+typedef struct kv_undo_s {
+	uint32_t *addr;
+	uint32_t old;
+} kv_undo_t;
+
+#define KV_MSG_DONE   0x1
+#define KV_MSG_KILL   0x2
+
+typedef struct kv_policy_stats_s {
+	unsigned long long crashes;
+	unsigned long long recovered;
+	unsigned long long restarts;
+	ltckpt_hist_t latency;
+} kv_policy_stats_t;
+
+/* Runtime state the recovery window hooks operate on. */
+window_shutter g_shutter_board[LTCKPT_MAX_WINDOW_SHUTTERS];
+char g_module_name[LTCKPT_MODULE_NAME_SIZE] = "kvserver";
+UINT64_T g_num_window_shutters = __KV_NUM_TYPES;
+UINT64_T g_num_kernelcall_shutters = 0;
+unsigned int g_recovery_bitmask;
+unsigned int g_recovery_naive_mode = LTCKPT_RECOVERY_NAIVE_MODE_DEFAULT;
+int sa_window__is_open;
+
+static kv_state_t kv;
+static uint32_t kv_external;   /* writes that left the process, never rolled back */
+static uint8_t kv_dead[KV_NUM_SOURCES];
+static kv_undo_t kv_undo[KV_UNDO_MAX];
+static unsigned kv_undo_len;
+
+static int kv_inject;
+static int kv_minix_gating;
+static unsigned kv_period = 1;
+static unsigned long long kv_transits[__KV_NUM_TYPES];
+/* Per-site window transitions, merged into g_shutter_board[].prof for the stats. */
+static wshutter_prof_t kv_shutter_prof[LTCKPT_MAX_WINDOW_SHUTTERS];
+static sigjmp_buf kv_env;
+static unsigned long long kv_crash_ns;
+
+static const char *kv_policy_names[] = LTCKPT_RECOVERY_POLICY_NAMES;
+static kv_policy_stats_t kv_stats[__NUM_LTCKPT_RECOVERY_POLICIES];
+static ltckpt_hist_t kv_undo_hist;
+static unsigned long long kv_error_replies, kv_kills, kv_dropped;
+
+static void usage(const char *progname)
+{
+	int i;
+
+	printf("usage:\n");
+	printf("  %s -r log [ -n num_msgs ] [ -S seed ]\n", progname);
+	printf("  %s -p log [ -s sites ] [ -P period ] [ -m naive_mode ] [ -w ]\n", progname);
+	printf("  -r: run the server on a generated workload and record its requests\n");
+	printf("  -p: replay a recorded log, injecting crashes\n");
+	printf("  -s: comma-separated list of crash sites (default: all)\n");
+	printf("  -P: crash every N-th transit of an enabled site (default: 1)\n");
+	printf("  -m: naive recovery mode (%d, %d, %d or %d)\n",
+		LTCKPT_RECOVERY_NAIVE_MODE_DEFAULT,
+		LTCKPT_RECOVERY_NAIVE_MODE_NEVER_REPLY,
+		LTCKPT_RECOVERY_NAIVE_MODE_CONTIDIONAL_REPLY,
+		LTCKPT_RECOVERY_NAIVE_MODE_ALWAYS_REPLY);
+	printf("  -w: only crash in open idempotent windows, like ltckpt_do_suicide()\n");
+	printf("sites:");
+	for (i = 0; i < __KV_NUM_TYPES; i++) {
+		printf(" %s", kv_site_names[i]);
+	}
+	printf("\n");
+	exit(1);
+}
+
+static unsigned long long kv_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*+++ Recovery window hooks, as in ltckpt_recover.c +++*/
+
+static void kv_window_open()
+{
+	sa_window__is_open = 1;
+	g_recovery_bitmask = LTCKPT_RECOVERY_MASK_IDEMPOTENT;
+	kv_undo_len = 0;
+}
+
+static void kv_transit_window(UINT64_T site_id)
+{
+#if LTCKPT_WINDOW_PROF
+	CHECK_SHUTTER_BOARD_SIZE(site_id, )
+	ltckpt_wshutter_prof_transit(&kv_shutter_prof[site_id], 0, 0);
+#endif
+}
+
+static void kv_set_idempotent_recovery(UINT64_T site_id)
+{
+	kv_transit_window(site_id);
+	g_recovery_bitmask |= LTCKPT_RECOVERY_MASK_IDEMPOTENT;
+}
+
+static void kv_set_request_specific_recovery(UINT64_T site_id)
+{
+	/* The runtime also sets the idempotent bit here. */
+	kv_transit_window(site_id);
+	g_recovery_bitmask |= LTCKPT_RECOVERY_MASK_IDEMPOTENT;
+}
+
+static void kv_set_process_local_recovery(UINT64_T site_id)
+{
+	kv_transit_window(site_id);
+	g_recovery_bitmask |= LTCKPT_RECOVERY_MASK_PROCESS_SPECIFIC;
+}
+
+static void kv_set_fail_stop_recovery(UINT64_T site_id)
+{
+	kv_transit_window(site_id);
+	sa_window__is_open = 0;
+	g_recovery_bitmask |= LTCKPT_RECOVERY_MASK_FAIL_STOP;
+}
+
+static void kv_do_suicide_per_site(UINT64_T site_id)
+{
+	CHECK_SHUTTER_BOARD_SIZE(site_id, )
+
+	if (!kv_inject || !g_shutter_board[site_id].do_suicide) {
+		return;
+	}
+	if (kv_minix_gating && (!sa_window__is_open
+		|| g_recovery_bitmask != LTCKPT_RECOVERY_MASK_IDEMPOTENT)) {
+		return;
+	}
+	if (++kv_transits[site_id] % kv_period) {
+		return;
+	}
+
+	volatile char *p = 0;
+	(*p)++;
+}
+
+static void kv_crash_handler(int sig)
+{
+	kv_crash_ns = kv_now_ns();
+	siglongjmp(kv_env, 1);
+}
+
+/*+++ Server +++*/
+
+static inline void kv_store(uint32_t *addr, uint32_t value)
+{
+	if (kv_undo_len == KV_UNDO_MAX) {
+		fprintf(stderr, "error: undo log overflow\n");
+		exit(1);
+	}
+	kv_undo[kv_undo_len].addr = addr;
+	kv_undo[kv_undo_len].old = *addr;
+	kv_undo_len++;
+	*addr = value;
+}
+
+static void kv_rollback()
+{
+	while (kv_undo_len > 0) {
+		kv_undo_len--;
+		*kv_undo[kv_undo_len].addr = kv_undo[kv_undo_len].old;
+	}
+}
+
+static void kv_reset()
+{
+	memset(&kv, 0, sizeof(kv));
+	kv_undo_len = 0;
+}
+
+/* Returns the reply value, or a negative errno. */
+static int kv_handle(const kv_msg_t *m)
+{
+	uint32_t key = m->key % KV_NUM_KEYS;
+
+	switch (m->type) {
+	case KV_GET:
+		kv_set_idempotent_recovery(KV_GET);
+		kv_do_suicide_per_site(KV_GET);
+		return (int) (kv.table[key] & 0x7fffffff);
+	case KV_PUT:
+		if (!kv.session[m->source]) {
+			return -EPERM;
+		}
+		kv_set_request_specific_recovery(KV_PUT);
+		kv_store(&kv.table[key], m->value);
+		kv_do_suicide_per_site(KV_PUT);
+		kv_store(&kv.num_updates, kv.num_updates + 1);
+		return OK;
+	case KV_OPEN:
+	case KV_CLOSE:
+		kv_set_process_local_recovery(m->type);
+		kv_store(&kv.session[m->source], m->type == KV_OPEN);
+		kv_do_suicide_per_site(m->type);
+		return OK;
+	case KV_SYNC:
+		kv_set_fail_stop_recovery(KV_SYNC);
+		kv_external++;
+		kv_do_suicide_per_site(KV_SYNC);
+		return OK;
+	case KV_NOTIFY:
+		kv_store(&kv.num_updates, kv.num_updates + 1);
+		kv_do_suicide_per_site(KV_NOTIFY);
+		return OK;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Cleanup done on the exit notification of a killed client. */
+static void kv_client_exit(uint32_t source)
+{
+	kv.session[source] = 0;
+}
+
+/* Rebuild the state from the first num completed requests (no crashes). */
+static void kv_rebuild(const kv_msg_t *msgs, const uint8_t *flags, uint64_t num)
+{
+	int inject = kv_inject;
+	uint64_t i;
+
+	kv_inject = 0;
+	kv_reset();
+	for (i = 0; i < num; i++) {
+		if (flags[i] & KV_MSG_DONE) {
+			kv_window_open();
+			kv_handle(&msgs[i]);
+		}
+		if (flags[i] & KV_MSG_KILL) {
+			kv_client_exit(msgs[i].source);
+		}
+	}
+	sa_window__is_open = 0;
+	kv_inject = inject;
+}
+
+static void kv_recover(const kv_msg_t *msgs, uint8_t *flags, uint64_t cur)
+{
+	const kv_msg_t *m = &msgs[cur];
+	ltckpt_recovery_policy_t policy;
+	int replyable, r = LTCKPT_RECOVERY_FAILURE;
+
+	kv_rollback();
+	replyable = m->source == KV_SOURCE_KERNEL ? 0 : 1;
+	policy = ltckpt_recovery_select_policy(g_recovery_bitmask, replyable,
+		g_recovery_naive_mode);
+	switch (policy) {
+	case LTCKPT_RECOVERY_POLICY_IDEMPOTENT:
+	case LTCKPT_RECOVERY_POLICY_REQUEST_SPECIFIC:
+		kv_error_replies++;
+		r = LTCKPT_RECOVERY_SUCCESS;
+		break;
+	case LTCKPT_RECOVERY_POLICY_PROCESS_SPECIFIC:
+		if (m->source < KV_NUM_USERS) {
+			kv_dead[m->source] = 1;
+			kv_client_exit(m->source);
+			flags[cur] |= KV_MSG_KILL;
+			kv_kills++;
+		}
+		else {
+			kv_error_replies++;
+		}
+		r = LTCKPT_RECOVERY_SUCCESS;
+		break;
+	default:
+		break;
+	}
+	if (g_recovery_naive_mode != LTCKPT_RECOVERY_NAIVE_MODE_DEFAULT
+		&& policy != LTCKPT_RECOVERY_POLICY_FAIL_STOP) {
+		r = LTCKPT_RECOVERY_SUCCESS;
+	}
+	kv_stats[policy].crashes++;
+	if (r == LTCKPT_RECOVERY_SUCCESS) {
+		kv_stats[policy].recovered++;
+	}
+	else {
+		/* Fail-stop and failed recovery both reset the system. */
+		kv_rebuild(msgs, flags, cur);
+		kv_stats[policy].restarts++;
+	}
+	sa_window__is_open = 0;
+	ltckpt_hist_add(&kv_stats[policy].latency, kv_now_ns() - kv_crash_ns);
+}
+
+static void kv_run(const kv_msg_t *msgs, uint8_t *flags, uint64_t num)
+{
+	static volatile uint64_t cur;
+
+	for (cur = 0; cur < num; cur++) {
+		const kv_msg_t *m = &msgs[cur];
+
+		if (kv_dead[m->source]) {
+			kv_dropped++;
+			continue;
+		}
+		kv_window_open();
+		if (sigsetjmp(kv_env, 1)) {
+			kv_recover(msgs, flags, cur);
+			continue;
+		}
+		if (kv_handle(m) == -EPERM) {
+			kv_error_replies++;
+		}
+		sa_window__is_open = 0;
+		ltckpt_hist_add(&kv_undo_hist, kv_undo_len * sizeof(kv_undo_t));
+		flags[cur] |= KV_MSG_DONE;
+	}
+}
+
+/*+++ Record +++*/
+
+static uint64_t kv_rand(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static void kv_generate(kv_msg_t *m, uint64_t *state)
+{
+	unsigned r = kv_rand(state) % 100;
+
+	m->source = kv_rand(state) % (KV_NUM_USERS + 1);
+	m->key = kv_rand(state);
+	m->value = kv_rand(state);
+	if (r < 50) {
+		m->type = KV_GET;
+	}
+	else if (r < 75) {
+		m->type = KV_PUT;
+	}
+	else if (r < 80) {
+		m->type = KV_OPEN;
+	}
+	else if (r < 85) {
+		m->type = KV_CLOSE;
+	}
+	else if (r < 90) {
+		m->type = KV_SYNC;
+	}
+	else {
+		m->type = KV_NOTIFY;
+		m->source = KV_SOURCE_KERNEL;
+	}
+}
+
+static int kv_record(const char *path, uint64_t num, uint64_t seed)
+{
+	kv_log_hdr_t hdr;
+	kv_msg_t m;
+	uint64_t i, state = seed ? seed : 1;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file) {
+		fprintf(stderr, "error: cannot open \"%s\": %s\n", path, strerror(errno));
+		return 1;
+	}
+	hdr.magic = KV_LOG_MAGIC;
+	hdr.version = KV_LOG_VERSION;
+	hdr.num_msgs = num;
+	hdr.seed = seed;
+	fwrite(&hdr, sizeof(hdr), 1, file);
+
+	kv_reset();
+	for (i = 0; i < num; i++) {
+		/* Receive, log at the top of the loop, handle. */
+		kv_generate(&m, &state);
+		fwrite(&m, sizeof(m), 1, file);
+		kv_window_open();
+		kv_handle(&m);
+		sa_window__is_open = 0;
+		ltckpt_hist_add(&kv_undo_hist, kv_undo_len * sizeof(kv_undo_t));
+	}
+	if (fclose(file)) {
+		fprintf(stderr, "error: cannot write \"%s\": %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	printf("messages: %llu\n", (unsigned long long) num);
+	printf("log_bytes: %llu\n", (unsigned long long) (sizeof(hdr) + num * sizeof(m)));
+	printf("undo_bytes: p50 %llu p99 %llu max %llu\n",
+		ltckpt_hist_percentile(&kv_undo_hist, 500),
+		ltckpt_hist_percentile(&kv_undo_hist, 990), kv_undo_hist.max);
+	return 0;
+}
+
+/*+++ Replay +++*/
+
+static void kv_print_stats(uint64_t num)
+{
+	unsigned long long crashes = 0, recovered = 0;
+	int i;
+
+	for (i = 0; i < __NUM_LTCKPT_RECOVERY_POLICIES; i++) {
+		kv_policy_stats_t *s = &kv_stats[i];
+
+		crashes += s->crashes;
+		recovered += s->recovered;
+		if (!s->crashes) {
+			continue;
+		}
+		printf("policy %s: crashes %llu recovered %llu (%.1f%%) restarts %llu "
+			"latency_ns min %llu p50 %llu p99 %llu max %llu\n",
+			kv_policy_names[i], s->crashes, s->recovered,
+			100.0 * s->recovered / s->crashes, s->restarts,
+			s->latency.min, ltckpt_hist_percentile(&s->latency, 500),
+			ltckpt_hist_percentile(&s->latency, 990), s->latency.max);
+	}
+	printf("messages: %llu dropped %llu error_replies %llu kills %llu\n",
+		(unsigned long long) num, kv_dropped, kv_error_replies, kv_kills);
+	printf("log_bytes: %llu\n",
+		(unsigned long long) (sizeof(kv_log_hdr_t) + num * sizeof(kv_msg_t)));
+	printf("undo_bytes: p50 %llu p99 %llu max %llu\n",
+		ltckpt_hist_percentile(&kv_undo_hist, 500),
+		ltckpt_hist_percentile(&kv_undo_hist, 990), kv_undo_hist.max);
+	printf("crashes: %llu recovered %llu (%.1f%%)\n", crashes, recovered,
+		crashes ? 100.0 * recovered / crashes : 100.0);
+	for (i = 0; i < __KV_NUM_TYPES; i++) {
+		g_shutter_board[i].prof = kv_shutter_prof[i];
+		if (g_shutter_board[i].prof.num_end) {
+			printf("site %s: transits %llu\n", kv_site_names[i],
+				g_shutter_board[i].prof.num_end);
+		}
+	}
+}
+
+static int kv_replay(const char *path)
+{
+	const kv_log_hdr_t *hdr;
+	const kv_msg_t *msgs;
+	kv_state_t state;
+	uint32_t external;
+	struct sigaction sa;
+	struct stat st;
+	uint8_t *flags;
+	uint64_t num;
+	void *addr;
+	int fd, consistent;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "error: cannot open \"%s\": %s\n", path, strerror(errno));
+		return 1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "error: \"%s\" is not a replay log\n", path);
+		close(fd);
+		return 1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map \"%s\": %s\n", path, strerror(errno));
+		return 1;
+	}
+	hdr = (const kv_log_hdr_t *) addr;
+	if (hdr->magic != KV_LOG_MAGIC || hdr->version != KV_LOG_VERSION) {
+		fprintf(stderr, "error: \"%s\" is not a replay log\n", path);
+		munmap(addr, st.st_size);
+		return 1;
+	}
+	num = (st.st_size - sizeof(*hdr)) / sizeof(kv_msg_t);
+	if (hdr->num_msgs < num) {
+		num = hdr->num_msgs;
+	}
+	msgs = (const kv_msg_t *) (hdr + 1);
+	flags = calloc(num ? num : 1, sizeof(uint8_t));
+	if (!flags) {
+		fprintf(stderr, "error: out of memory\n");
+		munmap(addr, st.st_size);
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = kv_crash_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, NULL);
+
+	kv_reset();
+	kv_inject = 1;
+	kv_run(msgs, flags, num);
+	kv_inject = 0;
+
+	/* Compare against a crash-free run of the completed requests. */
+	state = kv;
+	external = kv_external;
+	kv_rebuild(msgs, flags, num);
+	consistent = !memcmp(&state, &kv, sizeof(kv));
+	kv_external = external;
+
+	kv_print_stats(num);
+	printf("consistent: %s\n", consistent ? "yes" : "no");
+
+	free(flags);
+	munmap(addr, st.st_size);
+	return consistent ? 0 : 1;
+}
+
+static int kv_parse_sites(char *sites)
+{
+	char *name;
+	int i;
+
+	for (name = strtok(sites, ","); name; name = strtok(NULL, ",")) {
+		for (i = 0; i < __KV_NUM_TYPES; i++) {
+			if (!strcmp(name, kv_site_names[i])) {
+				break;
+			}
+		}
+		if (i == __KV_NUM_TYPES) {
+			fprintf(stderr, "error: unknown site \"%s\"\n", name);
+			return -1;
+		}
+		g_shutter_board[i].do_suicide = 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *record_path = NULL, *replay_path = NULL;
+	char *sites = NULL, *end;
+	uint64_t num = 100000, seed = 1;
+	int i, r;
+
+	while ((r = getopt(argc, argv, "r:p:n:S:s:P:m:w")) >= 0) {
+		switch (r) {
+		case 'r':
+			record_path = optarg;
+			break;
+		case 'p':
+			replay_path = optarg;
+			break;
+		case 'n':
+			num = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			sites = optarg;
+			break;
+		case 'P':
+			kv_period = atoi(optarg);
+			if (kv_period < 1) {
+				kv_period = 1;
+			}
+			break;
+		case 'm':
+			g_recovery_naive_mode = strtoul(optarg, &end, 0);
+			if (*optarg == '\0' || *end != '\0'
+				|| (g_recovery_naive_mode != LTCKPT_RECOVERY_NAIVE_MODE_DEFAULT
+				&& g_recovery_naive_mode != LTCKPT_RECOVERY_NAIVE_MODE_NEVER_REPLY
+				&& g_recovery_naive_mode != LTCKPT_RECOVERY_NAIVE_MODE_CONTIDIONAL_REPLY
+				&& g_recovery_naive_mode != LTCKPT_RECOVERY_NAIVE_MODE_ALWAYS_REPLY)) {
+				fprintf(stderr, "error: invalid naive mode \"%s\"\n\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'w':
+			kv_minix_gating = 1;
+			break;
+		default:
+			fprintf(stderr, "unknown option specified\n\n");
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (!record_path == !replay_path || optind < argc) {
+		usage(argv[0]);
+	}
+	if (record_path) {
+		return kv_record(record_path, num, seed);
+	}
+
+	if (sites) {
+		if (kv_parse_sites(sites) < 0) {
+			return 1;
+		}
+	}
+	else {
+		for (i = 0; i < __KV_NUM_TYPES; i++) {
+			g_shutter_board[i].do_suicide = 1;
+		}
+	}
+	return kv_replay(replay_path);
+}
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/ltckpt/snapshot.h"
+
+static int print_ranges;
+static uint64_t lookup_addr;
+static int lookup;
+
+static void usage(const char *progname)
+{
+	printf("usage:\n");
+	printf("  %s [ -r ] [ -a addr ] path...\n", progname);
+	printf("  -r: print every range of the snapshot\n");
+	printf("  -a: print the checkpointed 64-bit word at addr\n");
+	exit(1);
+}
+
+static void print_word(const char *path, const struct ltckpt_snapshot_range *range,
+	const char *data)
+{
+	uint64_t word;
+
+	if (lookup_addr < range->addr || lookup_addr + sizeof(word) > range->addr + range->len) {
+		return;
+	}
+	memcpy(&word, data + (lookup_addr - range->addr), sizeof(word));
+	printf("%s: 0x%llx = 0x%llx\n", path, (unsigned long long) lookup_addr,
+		(unsigned long long) word);
+	lookup = 2;
+}
+
+static int process_path(const char *path)
+{
+	const struct ltckpt_snapshot_header *header;
+	const struct ltckpt_snapshot_range *range;
+	struct stat st;
+	uint64_t i, offset;
+	char approach[sizeof(header->approach) + 1];
+	void *addr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "error: cannot open \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < LTCKPT_SNAPSHOT_HEADER_SIZE) {
+		fprintf(stderr, "error: \"%s\" is not an ltckpt snapshot\n", path);
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	header = (const struct ltckpt_snapshot_header *) addr;
+	if (header->magic == 0) {
+		fprintf(stderr, "error: \"%s\" is an incomplete snapshot\n", path);
+		munmap(addr, st.st_size);
+		return -1;
+	}
+	if (header->magic != LTCKPT_SNAPSHOT_MAGIC ||
+		header->version != LTCKPT_SNAPSHOT_VERSION) {
+		fprintf(stderr, "error: \"%s\" is not an ltckpt snapshot\n", path);
+		munmap(addr, st.st_size);
+		return -1;
+	}
+
+	memcpy(approach, header->approach, sizeof(header->approach));
+	approach[sizeof(header->approach)] = '\0';
+	if (!lookup) {
+		printf("%s: pid=%u, checkpoint=%llu, approach=%s, ranges=%llu, bytes=%llu\n",
+			path, header->pid, (unsigned long long) header->checkpoint, approach,
+			(unsigned long long) header->num_ranges,
+			(unsigned long long) header->num_bytes);
+	}
+
+	offset = LTCKPT_SNAPSHOT_HEADER_SIZE;
+	for (i = 0; i < header->num_ranges; i++) {
+		if (offset + sizeof(*range) > st.st_size) {
+			break;
+		}
+		range = (const struct ltckpt_snapshot_range *) ((char *) addr + offset);
+		offset += sizeof(*range);
+		if (offset + range->len > st.st_size) {
+			break;
+		}
+		if (print_ranges) {
+			printf("  [0x%llx, 0x%llx) %llu\n", (unsigned long long) range->addr,
+				(unsigned long long) (range->addr + range->len),
+				(unsigned long long) range->len);
+		}
+		if (lookup) {
+			print_word(path, range, (char *) addr + offset);
+		}
+		offset += range->len;
+	}
+	if (i < header->num_ranges) {
+		fprintf(stderr, "warning: \"%s\" is truncated after %llu ranges\n",
+			path, (unsigned long long) i);
+	}
+
+	munmap(addr, st.st_size);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int r, ret = 0;
+
+	while ((r = getopt(argc, argv, "ra:")) >= 0) {
+		switch (r) {
+		case 'r':
+			print_ranges = 1;
+			break;
+		case 'a':
+			lookup_addr = strtoull(optarg, NULL, 0);
+			lookup = 1;
+			break;
+		default:
+			fprintf(stderr, "unknown option specified\n\n");
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+	}
+
+	for (; optind < argc; optind++) {
+		if (process_path(argv[optind]) < 0) {
+			ret = 1;
+		}
+	}
+
+	/* Not in any range: zero page or not checkpointed memory. */
+	if (lookup == 1) {
+		fprintf(stderr, "0x%llx not found\n", (unsigned long long) lookup_addr);
+		ret = 1;
+	}
+
+	return ret;
+}
@@ -0,0 +1,154 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../../include/ltckpt/statfile.h"
+
+static const char *kind_names[] = {
+	[LTCKPT_STATS_KIND_STORE_COUNT] = "store_count",
+	[LTCKPT_STATS_KIND_PAGE_COUNT] = "page_count",
+	[LTCKPT_STATS_KIND_PAGE_NUM] = "page_num",
+};
+
+static int csv;
+
+static void usage(const char *progname)
+{
+	printf("usage:\n");
+	printf("  %s [ -c ] path...\n", progname);
+	printf("  -c: print CSV instead of the CTX text format\n");
+	exit(1);
+}
+
+static void print_record_text(const struct ltckpt_stats_record *record)
+{
+	/* Same lines as the printf-based dumps in the ltckpt runtime. */
+	switch (record->kind) {
+	case LTCKPT_STATS_KIND_STORE_COUNT:
+		printf("%u 0x%p %u\n", record->iteration,
+			(void *) (uintptr_t) record->key, (unsigned) record->value);
+		break;
+	case LTCKPT_STATS_KIND_PAGE_COUNT:
+		printf("CTX: STAT_PAGE_COUNT: %p = %u\n",
+			(void *) (uintptr_t) record->key, (unsigned) record->value);
+		break;
+	case LTCKPT_STATS_KIND_PAGE_NUM:
+		printf("CTX: STAT_PAGE_NUM: %llu = %llu\n",
+			(unsigned long long) record->key,
+			(unsigned long long) record->value);
+		break;
+	default:
+		fprintf(stderr, "warning: skipping record of unknown kind %u\n",
+			record->kind);
+		break;
+	}
+}
+
+static void print_record_csv(const struct ltckpt_stats_record *record,
+	uint32_t pid)
+{
+	const char *kind = "unknown";
+
+	if (record->kind < __LTCKPT_STATS_NUM_KINDS && kind_names[record->kind]) {
+		kind = kind_names[record->kind];
+	}
+	printf("%u,%s,%u,0x%llx,%llu\n", pid, kind, record->iteration,
+		(unsigned long long) record->key,
+		(unsigned long long) record->value);
+}
+
+static int process_path(const char *path)
+{
+	const struct ltckpt_stats_header *header;
+	const struct ltckpt_stats_record *records;
+	struct stat st;
+	uint64_t i, num_records;
+	void *addr;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "error: cannot open \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(*header)) {
+		fprintf(stderr, "error: \"%s\" is not an ltckpt statistics file\n", path);
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		fprintf(stderr, "error: cannot map \"%s\": %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	header = (const struct ltckpt_stats_header *) addr;
+	if (header->magic != LTCKPT_STATS_MAGIC ||
+		header->version != LTCKPT_STATS_VERSION ||
+		header->record_size != sizeof(struct ltckpt_stats_record)) {
+		fprintf(stderr, "error: \"%s\" is not an ltckpt statistics file\n", path);
+		munmap(addr, st.st_size);
+		return -1;
+	}
+
+	/* Trust the file size if the header was not updated (e.g., crash). */
+	num_records = (st.st_size - sizeof(*header)) / header->record_size;
+	if (header->num_records < num_records) {
+		fprintf(stderr, "warning: \"%s\" advertises %llu records, reading %llu\n",
+			path, (unsigned long long) header->num_records,
+			(unsigned long long) num_records);
+	}
+
+	records = (const struct ltckpt_stats_record *) (header + 1);
+	for (i = 0; i < num_records; i++) {
+		if (csv) {
+			print_record_csv(&records[i], header->pid);
+		} else {
+			print_record_text(&records[i]);
+		}
+	}
+
+	munmap(addr, st.st_size);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int r, ret = 0;
+
+	while ((r = getopt(argc, argv, "c")) >= 0) {
+		switch (r) {
+		case 'c':
+			csv = 1;
+			break;
+		default:
+			fprintf(stderr, "unknown option specified\n\n");
+			usage(argv[0]);
+			break;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+	}
+
+	if (csv) {
+		printf("pid,kind,iteration,key,value\n");
+	}
+	for (; optind < argc; optind++) {
+		if (process_path(argv[optind]) < 0) {
+			ret = 1;
+		}
+	}
+
+	return ret;
+}